@@ -0,0 +1,226 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/access-log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <kj/debug.h>
+#include <kj/io.h>
+
+#include "src/util.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+const char kAccessLogHeader[] = "# ca-table access log v1\n";
+
+// Number of samples to collect before FlushAccessLogsIfDue() adds them to
+// the sidecar file.
+const size_t kFlushSamples = 1024;
+
+// Samples are also added once they are this old, so that a lightly loaded
+// process doesn't hold them indefinitely.
+const auto kFlushInterval = std::chrono::minutes(1);
+
+// Set by recorders that have samples due to be flushed.
+std::atomic<bool> flush_due{false};
+
+std::mutex recorders_mutex;
+
+// Never destroyed, since tables may be closed by static destructors.
+auto& recorders = *new std::map<std::string, std::unique_ptr<AccessRecorder>>;
+
+uint64_t SampleInterval() {
+  static const uint64_t interval = [] {
+    const auto value = getenv("CA_TABLE_ACCESS_SAMPLE");
+    return value ? strtoull(value, nullptr, 10) : 0;
+  }();
+  return interval;
+}
+
+std::string ReadAll(int fd) {
+  struct stat st;
+  KJ_SYSCALL(fstat(fd, &st));
+
+  std::string result(st.st_size, '\0');
+  if (!result.empty()) ReadWithOffset(fd, &result[0], result.size(), 0);
+  return result;
+}
+
+// Adds the entries in `data' to `blocks'.  Malformed lines, such as those
+// left by a process that died while writing, are ignored.
+void ParseAccessLog(const std::string& data,
+                    std::unordered_map<uint64_t, BlockAccess>& blocks) {
+  size_t begin = 0;
+  while (begin < data.size()) {
+    auto end = data.find('\n', begin);
+    if (end == std::string::npos) break;
+
+    const auto line = data.substr(begin, end - begin);
+    begin = end + 1;
+
+    unsigned long long offset, size, count;
+    if (line.empty() || line[0] == '#' ||
+        3 != sscanf(line.c_str(), "%llu %llu %llu", &offset, &size, &count))
+      continue;
+
+    auto& block = blocks[offset];
+    block.offset = offset;
+    block.size = std::max<uint64_t>(block.size, size);
+    block.count += count;
+  }
+}
+
+}  // namespace
+
+std::string AccessLogPath(const std::string& table_path) {
+  return table_path + ".access";
+}
+
+std::vector<BlockAccess> ReadAccessLog(const std::string& path) {
+  const auto raw_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (raw_fd == -1) {
+    if (errno == ENOENT) return {};
+    KJ_FAIL_SYSCALL("open", errno, path);
+  }
+  kj::AutoCloseFd fd(raw_fd);
+
+  KJ_SYSCALL(flock(fd, LOCK_SH), path);
+
+  std::unordered_map<uint64_t, BlockAccess> blocks;
+  ParseAccessLog(ReadAll(fd), blocks);
+
+  std::vector<BlockAccess> result;
+  result.reserve(blocks.size());
+  for (const auto& block : blocks) result.emplace_back(block.second);
+
+  std::sort(result.begin(), result.end(),
+            [](const BlockAccess& lhs, const BlockAccess& rhs) {
+              if (lhs.count != rhs.count) return lhs.count > rhs.count;
+              return lhs.offset < rhs.offset;
+            });
+
+  return result;
+}
+
+AccessRecorder* AccessRecorder::Get(const std::string& path) {
+  const auto sample_interval = SampleInterval();
+  if (!sample_interval) return nullptr;
+
+  std::lock_guard<std::mutex> lock(recorders_mutex);
+
+  static bool registered = false;
+  if (!registered) {
+    atexit(FlushAccessLogs);
+    registered = true;
+  }
+
+  auto& result = recorders[path];
+  if (!result) result.reset(new AccessRecorder(path, sample_interval));
+  return result.get();
+}
+
+AccessRecorder::AccessRecorder(const std::string& path,
+                               uint64_t sample_interval)
+    : path_(path),
+      sample_interval_(sample_interval),
+      last_flush_(std::chrono::steady_clock::now()) {}
+
+void AccessRecorder::RecordSample(uint64_t offset, uint64_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failed_) return;
+
+  auto& block = pending_[offset];
+  block.offset = offset;
+  block.size = std::max(block.size, size);
+  // Each sample stands for `sample_interval_' reads, so that counts recorded
+  // with different intervals can be added up.
+  block.count += sample_interval_;
+
+  // Flushing locks and rewrites the sidecar file, which is too slow for the
+  // read path, so it's left to FlushAccessLogsIfDue().
+  if (++pending_samples_ >= kFlushSamples ||
+      std::chrono::steady_clock::now() - last_flush_ >= kFlushInterval)
+    flush_due.store(true, std::memory_order_relaxed);
+}
+
+void AccessRecorder::Flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  FlushLocked();
+}
+
+void AccessRecorder::FlushLocked() {
+  if (pending_.empty() || failed_) return;
+
+  const auto log_path = AccessLogPath(path_);
+
+  try {
+    const auto raw_fd =
+        open(log_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (raw_fd == -1) KJ_FAIL_SYSCALL("open", errno, log_path);
+    kj::AutoCloseFd fd(raw_fd);
+
+    // Serializes updates from concurrent processes.  Released when `fd' is
+    // closed.
+    KJ_SYSCALL(flock(fd, LOCK_EX), log_path);
+
+    auto blocks = std::move(pending_);
+    ParseAccessLog(ReadAll(fd), blocks);
+
+    std::string output = kAccessLogHeader;
+    for (const auto& block : blocks) {
+      const auto& access = block.second;
+      output += StringPrintf("%llu %llu %llu\n",
+                             static_cast<unsigned long long>(access.offset),
+                             static_cast<unsigned long long>(access.size),
+                             static_cast<unsigned long long>(access.count));
+    }
+
+    KJ_SYSCALL(ftruncate(fd, 0), log_path);
+    for (size_t offset = 0; offset < output.size();) {
+      ssize_t ret;
+      KJ_SYSCALL(ret = pwrite(fd, output.data() + offset,
+                              output.size() - offset, offset),
+                 log_path);
+      offset += ret;
+    }
+  } catch (kj::Exception e) {
+    // Recording must never make reads fail, so give up on this table.
+    KJ_LOG(WARNING, "disabling access recording", log_path, e);
+    failed_ = true;
+  }
+
+  pending_.clear();
+  pending_samples_ = 0;
+  last_flush_ = std::chrono::steady_clock::now();
+}
+
+void FlushAccessLogs() {
+  std::lock_guard<std::mutex> lock(recorders_mutex);
+  for (auto& recorder : recorders) recorder.second->Flush();
+}
+
+void FlushAccessLogsIfDue() {
+  if (flush_due.load(std::memory_order_relaxed) && flush_due.exchange(false))
+    FlushAccessLogs();
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
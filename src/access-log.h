@@ -0,0 +1,90 @@
+#ifndef CA_TABLE_ACCESS_LOG_H_
+#define CA_TABLE_ACCESS_LOG_H_ 1
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <kj/common.h>
+
+// Block access recording, used to warm up the page cache after a restart.
+//
+// When the environment variable CA_TABLE_ACCESS_SAMPLE is set to a positive
+// integer N, one of every N block reads of each table is recorded, and the
+// counts are added to a sidecar file next to the table, named by
+// AccessLogPath(), outside the read path: at exit, or when the program calls
+// FlushAccessLogsIfDue() between statements.  Several processes may update the same sidecar file.
+// `ca-warm' reads the sidecar files, and prefetches the hottest blocks.
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+struct BlockAccess {
+  uint64_t offset;
+  uint64_t size;
+  // Estimated number of reads.
+  uint64_t count;
+};
+
+std::string AccessLogPath(const std::string& table_path);
+
+// Returns the blocks listed in an access log, hottest first.  Returns an
+// empty list if the file does not exist.
+std::vector<BlockAccess> ReadAccessLog(const std::string& path);
+
+class AccessRecorder {
+ public:
+  // Returns the recorder for the table at `path', or null if recording is
+  // disabled.  The returned object lives until the process exits.
+  static AccessRecorder* Get(const std::string& path);
+
+  void Record(uint64_t offset, uint64_t size) {
+    if (reads_.fetch_add(1, std::memory_order_relaxed) % sample_interval_)
+      return;
+    RecordSample(offset, size);
+  }
+
+  // Adds the samples recorded since the last call to the sidecar file.
+  void Flush();
+
+  KJ_DISALLOW_COPY(AccessRecorder);
+
+ private:
+  AccessRecorder(const std::string& path, uint64_t sample_interval);
+
+  void RecordSample(uint64_t offset, uint64_t size);
+
+  void FlushLocked();
+
+  const std::string path_;
+  const uint64_t sample_interval_;
+
+  std::atomic<uint64_t> reads_{0};
+
+  std::mutex mutex_;
+  // Samples not yet written, keyed by block offset.
+  std::unordered_map<uint64_t, BlockAccess> pending_;
+  size_t pending_samples_ = 0;
+  std::chrono::steady_clock::time_point last_flush_;
+  bool failed_ = false;
+};
+
+// Flushes all access recorders.  Called automatically at exit, but processes
+// that end by a signal or _exit() must call it themselves.
+void FlushAccessLogs();
+
+// Flushes all access recorders if one of them has collected enough samples,
+// or held them long enough.  Cheap otherwise, so long-running programs can
+// call it after every statement.
+void FlushAccessLogsIfDue();
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !CA_TABLE_ACCESS_LOG_H_
@@ -2,17 +2,27 @@
 #include "config.h"
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cerrno>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
 #include <vector>
 
 #include <err.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <sys/stat.h>
 #include <sysexits.h>
 #include <unistd.h>
 
@@ -20,14 +30,20 @@
 #include <re2/re2.h>
 
 #include "src/ca-table.h"
+#include "src/output-buffer.h"
 #include "src/schema.h"
+#include "src/thread-pool.h"
 #include "src/util.h"
 
 namespace ca_table = cantera::table;
 
 enum Option {
+  kOptionAggregate = 'a',
+  kOptionFrom = 'f',
+  kOptionJobs = 'j',
   kOptionKeyFilter = 'k',
   kOptionPrefix = 'P',
+  kOptionTo = 't',
   kOptionTSFormat = 'F',
 };
 
@@ -49,163 +65,588 @@ const char* date_format = "%Y-%m-%d %H:%M:%S";
 TSFormat ts_format;
 
 std::unique_ptr<re2::RE2> key_filter;
+// Only keys in [first_key, last_key) are read.  An empty `last_key' means no
+// upper bound.
 std::string first_key, last_key;
 
+// Only time series values with offsets in [min_time, max_time] are read.
+bool has_time_range;
+uint64_t min_time = 0, max_time = std::numeric_limits<uint64_t>::max();
+
+// If non-zero, time series are printed as aggregates of buckets of this many
+// seconds.
+uint64_t bucket_size;
+
 time_t interval = 1;
 
 struct option kLongOptions[] = {
+    {"aggregate", required_argument, nullptr, kOptionAggregate},
     {"count", no_argument, &count_only, 1},
     {"delimiter", required_argument, NULL, 'D'},
     {"date-format", required_argument, NULL, 'A'},
     {"ts-format", required_argument, nullptr, kOptionTSFormat},
     {"format", required_argument, NULL, 'O'},
+    {"from", required_argument, nullptr, kOptionFrom},
+    {"jobs", required_argument, nullptr, kOptionJobs},
     {"key-filter", required_argument, NULL, kOptionKeyFilter},
     {"keys-only", no_argument, &keys_only, 1},
     {"schema", required_argument, NULL, 'S'},
     {"raw", no_argument, NULL, 'R'},
     {"prefix", required_argument, NULL, kOptionPrefix},
+    {"to", required_argument, nullptr, kOptionTo},
     {"version", no_argument, &print_version, 1},
     {"help", no_argument, &print_help, 1},
     {0, 0, 0, 0}};
 
-std::unique_ptr<ca_table::Schema> schema;
-std::unique_ptr<ca_table::Table> table_handle;
+// Size of the parts dumped by each job, in bytes of table data.  Parts much
+// smaller than the table let the jobs share the work evenly.
+const off_t kPartSize = 16 << 20;
 
-void DumpIndexRaw() {
-  cantera::string_view key, offset_score;
+// Amount of output buffered for each part waiting for earlier parts to be
+// written.  Jobs wait when their part's buffer is full.
+const size_t kMaxBufferedOutput = 16 << 20;
 
-  while (table_handle->ReadRow(key, offset_score)) {
-    if (key_filter &&
-        !RE2::FullMatch(re2::StringPiece(key.data(), key.size()),
-                        *key_filter)) {
-      if (key >= last_key) break;
-      continue;
-    }
+// Number of postings whose summaries are looked up together by DumpIndex().
+const size_t kSummaryBatchSize = 1 << 16;
 
-    printf("%.*s\n", static_cast<int>(key.size()), key.data());
+const char* table_path;
+const char* schema_path;
 
-    std::vector<ca_table::ca_offset_score> offsets;
+// Per-job state, since tables are not thread safe.
+struct Worker {
+  std::unique_ptr<ca_table::Table> table;
+  std::unique_ptr<ca_table::Schema> schema;
+};
 
-    ca_offset_score_parse(offset_score, &offsets);
-    for (size_t i = 0; i < offsets.size(); ++i) {
-      printf("\t%lu %g\n", offsets[i].offset, offsets[i].score);
+std::mutex idle_workers_mutex;
+std::vector<std::unique_ptr<Worker>> idle_workers;
+
+std::unique_ptr<Worker> AcquireWorker() {
+  {
+    std::lock_guard<std::mutex> lock(idle_workers_mutex);
+    if (!idle_workers.empty()) {
+      auto result = std::move(idle_workers.back());
+      idle_workers.pop_back();
+      return result;
     }
   }
+
+  auto result = std::make_unique<Worker>();
+  result->table = ca_table::TableFactory::Open(nullptr, table_path);
+  if (schema_path) {
+    result->schema = std::make_unique<ca_table::Schema>(schema_path);
+    result->schema->Load();
+  }
+  return result;
 }
 
-void DumpIndex() {
-  cantera::string_view key, offset_score, summary;
+void ReleaseWorker(std::unique_ptr<Worker> worker) {
+  std::lock_guard<std::mutex> lock(idle_workers_mutex);
+  idle_workers.emplace_back(std::move(worker));
+}
 
-  while (table_handle->ReadRow(key, offset_score)) {
-    if (key_filter &&
-        !RE2::FullMatch(re2::StringPiece(key.data(), key.size()),
-                        *key_filter)) {
-      if (key >= last_key) break;
-      continue;
+// Signature of the functions dumping the rows of `worker.table' from the
+// current position up to, but not including, `end'.  An empty `end' means
+// the end of the table.
+typedef void (*DumpFunction)(Worker& worker, const std::string& end,
+                             FILE* output);
+
+// Reads the next row, returning false at `end'.  Rows not matching the key
+// filter are skipped.
+bool ReadRow(ca_table::Table& table, const std::string& end,
+             cantera::string_view& key, cantera::string_view& value) {
+  while (table.ReadRow(key, value)) {
+    if (!end.empty() && !ca_table::internal::CompareUTF8(key, end))
+      return false;
+
+    if (!key_filter ||
+        RE2::FullMatch(re2::StringPiece(key.data(), key.size()), *key_filter))
+      return true;
+  }
+
+  return false;
+}
+
+std::atomic<size_t> row_count{0};
+
+void CountRows(Worker& worker, const std::string& end, FILE* output) {
+  cantera::string_view key, value;
+  size_t count = 0;
+  while (ReadRow(*worker.table, end, key, value)) ++count;
+  row_count += count;
+}
+
+void DumpCounts(Worker& worker, const std::string& end, FILE* output) {
+  ca_table::internal::OutputBuffer out(output);
+  cantera::string_view key, value;
+  std::vector<ca_table::ca_offset_score> offsets;
+
+  while (ReadRow(*worker.table, end, key, value)) {
+    out.Append(key);
+    out.Append('\t');
+    if (has_time_range) {
+      offsets.clear();
+      ca_table::ca_offset_score_parse_range(value, min_time, max_time,
+                                            &offsets);
+      out.AppendUInt64(offsets.size());
+    } else {
+      const auto begin = reinterpret_cast<const uint8_t*>(value.data());
+      out.AppendUInt64(
+          ca_table::ca_offset_score_count(begin, begin + value.size()));
     }
+    out.Append('\n');
+  }
+
+  out.Flush();
+}
+
+void DumpKeys(Worker& worker, const std::string& end, FILE* output) {
+  ca_table::internal::OutputBuffer out(output);
+  cantera::string_view key, value;
+
+  while (ReadRow(*worker.table, end, key, value)) {
+    out.Append(key);
+    out.Append('\n');
+  }
+
+  out.Flush();
+}
+
+void DumpIndexRaw(Worker& worker, const std::string& end, FILE* output) {
+  ca_table::internal::OutputBuffer out(output);
+  cantera::string_view key, offset_score;
+  std::vector<ca_table::ca_offset_score> offsets;
 
-    std::vector<ca_table::ca_offset_score> offsets;
+  while (ReadRow(*worker.table, end, key, offset_score)) {
+    out.Append(key);
+    out.Append('\n');
 
+    offsets.clear();
     ca_offset_score_parse(offset_score, &offsets);
+    for (const auto& offset : offsets) {
+      out.Append('\t');
+      out.AppendUInt64(offset.offset);
+      out.Append(' ');
+      out.AppendFloat(offset.score);
+      out.Append('\n');
+    }
+  }
 
-    for (size_t i = 0; i < offsets.size(); ++i) {
-      auto j = schema->summary_tables.size();
+  out.Flush();
+}
 
-      while (--j &&
-             std::get<uint64_t>(schema->summary_tables[j]) > offsets[i].offset)
-        ;
+// Prints the summary and score of each posting in `postings', in order.  The
+// summaries are read in offset order, so that each summary block is read once
+// per batch, and summaries shared by several postings are read once.
+void ResolveSummaries(Worker& worker,
+                      const std::vector<ca_table::ca_offset_score>& postings,
+                      ca_table::internal::OutputBuffer& out) {
+  auto& summary_tables = worker.schema->summary_tables;
+
+  std::vector<uint32_t> order(postings.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&postings](uint32_t lhs, uint32_t rhs) {
+                     return postings[lhs].offset < postings[rhs].offset;
+                   });
+
+  // The text printed for each posting, excluding its score, is stored in
+  // `text' at [begin, end).
+  std::string text;
+  std::vector<std::pair<size_t, size_t>> ranges(postings.size());
+
+  cantera::string_view summary_key, summary;
+  auto j = summary_tables.size() - 1;
+
+  for (size_t i = 0; i < order.size(); ++i) {
+    const auto offset = postings[order[i]].offset;
+
+    if (i && offset == postings[order[i - 1]].offset) {
+      ranges[order[i]] = ranges[order[i - 1]];
+      continue;
+    }
 
-      schema->summary_tables[j].second->Seek(
-          offsets[i].offset - std::get<uint64_t>(schema->summary_tables[j]),
-          SEEK_SET);
+    // Summary tables are sorted by their first offset, and so are the
+    // postings, so the right table is never before the previous one.
+    while (j && std::get<uint64_t>(summary_tables[j]) > offset) --j;
+    while (j + 1 < summary_tables.size() &&
+           std::get<uint64_t>(summary_tables[j + 1]) <= offset)
+      ++j;
+
+    auto& table = *summary_tables[j].second;
+    table.Seek(offset - std::get<uint64_t>(summary_tables[j]), SEEK_SET);
+    KJ_REQUIRE(table.ReadRow(summary_key, summary));
+
+    const auto begin = text.size();
+    text.append(summary_key.data(), summary_key.size());
+    text.push_back('\t');
+    text.append(summary.data(), summary.size());
+    text.push_back('\t');
+    ranges[order[i]] = std::make_pair(begin, text.size());
+  }
 
-      KJ_REQUIRE(schema->summary_tables[j].second->ReadRow(key, summary));
+  for (size_t i = 0; i < postings.size(); ++i) {
+    out.Append(text.data() + ranges[i].first,
+               ranges[i].second - ranges[i].first);
+    out.AppendFloat(postings[i].score);
+    out.Append('\n');
+  }
+}
+
+void DumpIndex(Worker& worker, const std::string& end, FILE* output) {
+  ca_table::internal::OutputBuffer out(output);
+  cantera::string_view key, offset_score;
+  std::vector<ca_table::ca_offset_score> postings;
+
+  while (ReadRow(*worker.table, end, key, offset_score)) {
+    ca_offset_score_parse(offset_score, &postings);
 
-      printf("%.*s\t%.*s\t%.9g\n", static_cast<int>(key.size()),
-             key.data(), static_cast<int>(summary.size()),
-             summary.data(), offsets[i].score);
+    if (postings.size() >= kSummaryBatchSize) {
+      ResolveSummaries(worker, postings, out);
+      postings.clear();
     }
   }
+
+  if (!postings.empty()) ResolveSummaries(worker, postings, out);
+
+  out.Flush();
 }
 
-void DumpSummaries() {
+void DumpSummaries(Worker& worker, const std::string& end, FILE* output) {
+  ca_table::internal::OutputBuffer out(output);
   cantera::string_view key, summary;
 
-  while (table_handle->ReadRow(key, summary)) {
-    if (key_filter &&
-        !RE2::FullMatch(re2::StringPiece(key.data(), key.size()),
-                        *key_filter)) {
-      if (ca_table::internal::CompareUTF8(last_key, key)) break;
-      continue;
-    }
+  while (ReadRow(*worker.table, end, key, summary)) {
+    out.Append(key);
+    out.Append('\t');
+    out.Append(summary);
+    out.Append('\n');
+  }
+
+  out.Flush();
+}
 
-    printf("%.*s\t%.*s\n", static_cast<int>(key.size()),
-           key.data(),
-           static_cast<int>(summary.size()), summary.data());
+void DumpAggregates(Worker& worker, const std::string& end, FILE* output) {
+  ca_table::internal::OutputBuffer out(output);
+  ca_table::internal::TimeFormatter time_formatter(date_format);
+  const bool unix_time = !strcmp(date_format, "%s");
+
+  cantera::string_view key, offset_score;
+  std::vector<ca_table::ca_offset_score_bucket> buckets;
+
+  while (ReadRow(*worker.table, end, key, offset_score)) {
+    buckets.clear();
+    ca_table::ca_offset_score_aggregate(offset_score, min_time, max_time,
+                                        bucket_size, &buckets);
+
+    for (const auto& bucket : buckets) {
+      out.Append(key);
+      out.Append('\t');
+      if (unix_time)
+        out.AppendUInt64(bucket.offset);
+      else
+        out.Append(time_formatter.Format(bucket.offset));
+      out.Append('\t');
+      out.AppendUInt64(bucket.count);
+      out.Append('\t');
+      out.AppendDouble(bucket.sum);
+      out.Append('\t');
+      out.AppendFloat(bucket.min);
+      out.Append('\t');
+      out.AppendFloat(bucket.max);
+      out.Append('\t');
+      out.AppendDouble(bucket.sum / bucket.count);
+      out.Append('\n');
+    }
   }
+
+  out.Flush();
 }
 
-void DumpTimeSeries() {
+void DumpTimeSeries(Worker& worker, const std::string& end, FILE* output) {
+  ca_table::internal::OutputBuffer out(output);
+  ca_table::internal::TimeFormatter time_formatter(date_format);
+  const bool unix_time = !strcmp(date_format, "%s");
+
   cantera::string_view key, offset_score;
+  std::vector<ca_table::ca_offset_score> offsets;
+
+  while (ReadRow(*worker.table, end, key, offset_score)) {
+    offsets.clear();
+    if (has_time_range) {
+      ca_table::ca_offset_score_parse_range(offset_score, min_time, max_time,
+                                            &offsets);
+      if (offsets.empty()) continue;
+    } else {
+      ca_table::ca_offset_score_parse(offset_score, &offsets);
+    }
 
-  while (table_handle->ReadRow(key, offset_score)) {
-    if (key_filter &&
-        !RE2::FullMatch(re2::StringPiece(key.data(), key.size()),
-                        *key_filter)) {
-      if (ca_table::internal::CompareUTF8(last_key, key)) break;
+    if (ts_format == kTSFormatCount) {
+      out.Append(key);
+      out.Append('\t');
+      out.AppendUInt64(offsets.size());
+      out.Append('\n');
       continue;
     }
 
-    std::vector<ca_table::ca_offset_score> offsets;
+    for (const auto& offset : offsets) {
+      out.Append(key);
+      out.Append('\t');
 
-    ca_table::ca_offset_score_parse(offset_score, &offsets);
+      if (unix_time) {
+        KJ_REQUIRE(!offset.HasPercentiles());
+        out.AppendUInt64(offset.offset);
+      } else {
+        out.Append(time_formatter.Format(offset.offset));
+      }
 
-    if (ts_format == kTSFormatCount) {
-      printf("%.*s\t%zu\n", static_cast<int>(key.size()), key.data(),
-             offsets.size());
-    } else {
-      if (!strcmp(date_format, "%s")) {
-        for (size_t i = 0; i < offsets.size(); ++i) {
-          KJ_REQUIRE(!offsets[i].HasPercentiles());
+      out.Append('\t');
+      out.AppendFloat(offset.score);
 
-          printf("%.*s\t%llu\t%.9g\n", static_cast<int>(key.size()), key.data(),
-                 (long long unsigned)offsets[i].offset, offsets[i].score);
+      if (offset.HasPercentiles()) {
+        for (const auto score : {offset.score_pct5, offset.score_pct25,
+                                 offset.score_pct75, offset.score_pct95}) {
+          out.Append(' ');
+          out.AppendFloat(score);
         }
-      } else {
-        for (size_t i = 0; i < offsets.size(); ++i) {
-          if (offsets[i].HasPercentiles()) {
-            const time_t time = offsets[i].offset;
-            struct tm tm;
-            memset(&tm, 0, sizeof(tm));
+      }
 
-            gmtime_r(&time, &tm);
+      out.Append('\n');
+    }
+  }
 
-            char time_buffer[64];
-            strftime(time_buffer, sizeof(time_buffer), date_format, &tm);
+  out.Flush();
+}
 
-            printf("%.*s\t%s\t%.9g %.9g %.9g %.9g %.9g\n",
-                   static_cast<int>(key.size()), key.data(), time_buffer,
-                   offsets[i].score, offsets[i].score_pct5,
-                   offsets[i].score_pct25, offsets[i].score_pct75,
-                   offsets[i].score_pct95);
+// Dumps the rows in [begin, end).
+void DumpPart(DumpFunction dump, const std::string& begin,
+              const std::string& end, FILE* output) {
+  auto worker = AcquireWorker();
+  worker->table->SeekToKey(begin);
+  dump(*worker, end, output);
+  ReleaseWorker(std::move(worker));
+}
 
-          } else {
-            const time_t time = offsets[i].offset;
-            struct tm tm;
-            memset(&tm, 0, sizeof(tm));
+// Splits [first_key, last_key) into parts that can be dumped in parallel.
+// Returns the start key of each part.
+std::vector<std::string> SplitKeyRange(size_t jobs) {
+  auto worker = AcquireWorker();
 
-            gmtime_r(&time, &tm);
+  struct stat st;
+  KJ_SYSCALL(ca_table_stat(worker->table.get(), &st), table_path);
+  const auto part_count =
+      std::max(jobs, static_cast<size_t>(st.st_size / kPartSize));
 
-            char time_buffer[64];
-            strftime(time_buffer, sizeof(time_buffer), date_format, &tm);
+  auto split_keys = worker->table->SplitKeys(part_count);
 
-            printf("%.*s\t%s\t%.9g\n", static_cast<int>(key.size()), key.data(),
-                   time_buffer, offsets[i].score);
-          }
-        }
+  // LevelDB tables, and write-once tables of a single block, can't be split.
+  if (split_keys.empty()) {
+    warnx("%s: table can't be split into parts, so --jobs has no effect",
+          table_path);
+  }
+
+  std::vector<std::string> result{first_key};
+  for (auto& key : split_keys) {
+    if (!ca_table::internal::CompareUTF8(first_key, key)) continue;
+    if (!last_key.empty() && !ca_table::internal::CompareUTF8(key, last_key))
+      break;
+    result.emplace_back(std::move(key));
+  }
+
+  ReleaseWorker(std::move(worker));
+
+  return result;
+}
+
+// Writes the output of parts dumped in parallel to stdout, in part order.
+// The output of the earliest unfinished part is written as it's produced,
+// while later parts buffer theirs, and their jobs wait when the buffer is
+// full.  Parts must be started in order, so the earliest one always has a
+// job making progress.
+class OrderedOutput {
+ public:
+  explicit OrderedOutput(size_t part_count) : parts_(part_count) {
+    for (size_t i = 0; i < part_count; ++i) {
+      parts_[i].output = this;
+      parts_[i].index = i;
+    }
+  }
+
+  KJ_DISALLOW_COPY(OrderedOutput);
+
+  // Returns a stream for the output of part `index'.  Closing the stream
+  // marks the part as finished.
+  FILE* Open(size_t index) {
+    const auto result = fopencookie(&parts_[index], "w",
+                                    {nullptr, &Write, nullptr, &Close});
+    if (!result) KJ_FAIL_SYSCALL("fopencookie", errno);
+    return result;
+  }
+
+  // Throws if writing to stdout failed.
+  void Check() {
+    if (errno_) KJ_FAIL_SYSCALL("fwrite", errno_);
+  }
+
+ private:
+  struct Part {
+    OrderedOutput* output;
+    size_t index;
+    std::string buffer;
+    bool finished = false;
+  };
+
+  static ssize_t Write(void* cookie, const char* data, size_t size) {
+    auto& part = *static_cast<Part*>(cookie);
+    auto& self = *part.output;
+
+    std::unique_lock<std::mutex> lock(self.mutex_);
+    self.cv_.wait(lock, [&self, &part, size] {
+      return self.current_ == part.index ||
+             part.buffer.size() + size <= kMaxBufferedOutput;
+    });
+
+    if (self.current_ != part.index) {
+      part.buffer.append(data, size);
+      return size;
+    }
+
+    // Only the current part changes `current_', so the rest can be done
+    // without the lock.
+    lock.unlock();
+
+    if (!self.WriteOutput(part.buffer.data(), part.buffer.size()) ||
+        !self.WriteOutput(data, size))
+      return 0;
+    std::string().swap(part.buffer);
+
+    return size;
+  }
+
+  static int Close(void* cookie) {
+    auto& part = *static_cast<Part*>(cookie);
+    auto& self = *part.output;
+
+    std::unique_lock<std::mutex> lock(self.mutex_);
+    part.finished = true;
+
+    // Writes the buffers of this and any following finished parts.
+    while (self.current_ < self.parts_.size() &&
+           self.parts_[self.current_].finished) {
+      auto& buffer = self.parts_[self.current_].buffer;
+      self.WriteOutput(buffer.data(), buffer.size());
+      std::string().swap(buffer);
+      ++self.current_;
+    }
+
+    self.cv_.notify_all();
+
+    return 0;
+  }
+
+  // Writes `data' to stdout, and returns false if this or an earlier write
+  // failed.
+  bool WriteOutput(const char* data, size_t size) {
+    if (errno_) return false;
+    if (size && 1 != fwrite(data, size, 1, stdout)) errno_ = errno;
+    return !errno_;
+  }
+
+  std::vector<Part> parts_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  // The earliest unfinished part.
+  size_t current_ = 0;
+
+  std::atomic<int> errno_{0};
+};
+
+// Dumps [first_key, last_key) using `jobs' threads, writing the output of
+// each part in key order.
+void DumpParallel(DumpFunction dump, size_t jobs) {
+  const auto starts = SplitKeyRange(jobs);
+
+  OrderedOutput output(starts.size());
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+
+  // ParallelFor() starts the parts in order.  Each part is opened and closed
+  // even after an error, since later parts wait for it.
+  ca_table::internal::ThreadPool thread_pool(jobs - 1);
+  thread_pool.ParallelFor(0, starts.size(), 1, [&](size_t begin, size_t end) {
+    for (auto i = begin; i != end; ++i) {
+      const auto part_output = output.Open(i);
+      KJ_DEFER(fclose(part_output));
+
+      if (failed) continue;
+
+      try {
+        DumpPart(dump, starts[i],
+                 i + 1 < starts.size() ? starts[i + 1] : last_key,
+                 part_output);
+      } catch (...) {
+        if (!failed.exchange(true)) error = std::current_exception();
       }
     }
+  });
+
+  if (error) std::rethrow_exception(error);
+  output.Check();
+}
+
+// Parses a number of seconds, with an optional unit suffix.
+uint64_t ParseDuration(const char* string) {
+  char* endptr;
+  errno = 0;
+  const auto value = strtoull(string, &endptr, 10);
+  if (errno || endptr == string)
+    errx(EX_USAGE, "Failed to parse duration '%s'", string);
+
+  uint64_t unit;
+  switch (*endptr) {
+    case 0:
+    case 's':
+      unit = 1;
+      break;
+    case 'm':
+      unit = 60;
+      break;
+    case 'h':
+      unit = 3600;
+      break;
+    case 'd':
+      unit = 86400;
+      break;
+    case 'w':
+      unit = 7 * 86400;
+      break;
+    default:
+      errx(EX_USAGE, "Unknown duration unit in '%s'", string);
   }
+
+  if (*endptr && endptr[1])
+    errx(EX_USAGE, "Failed to parse duration '%s'", string);
+
+  return value * unit;
+}
+
+// Parses a --from or --to argument, in the --date-format format or as a
+// date.
+uint64_t ParseTime(const char* string) {
+  if (!strcmp(date_format, "%s"))
+    return ca_table::internal::StringToUInt64(string);
+
+  for (const auto format : {date_format, "%Y-%m-%d"}) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+
+    const auto endptr = strptime(string, format, &tm);
+    if (endptr && !*endptr) return timegm(&tm);
+  }
+
+  errx(EX_USAGE, "Failed to parse time '%s'", string);
 }
 
 }  // namespace
@@ -213,8 +654,10 @@ void DumpTimeSeries() {
 int main(int argc, char** argv) try {
   const char* format = "time-series";
 
-  const char* schema_path = NULL;
   bool raw = false;
+  size_t jobs = 1;
+  const char* from = nullptr;
+  const char* to = nullptr;
 
   int i;
 
@@ -245,6 +688,24 @@ int main(int argc, char** argv) try {
           errx(EX_USAGE, "Unknown time series format '%s'", optarg);
         break;
 
+      case kOptionAggregate:
+        bucket_size = ParseDuration(optarg);
+        if (!bucket_size) errx(EX_USAGE, "Bucket size must be positive");
+        break;
+
+      case kOptionFrom:
+        from = optarg;
+        break;
+
+      case kOptionTo:
+        to = optarg;
+        break;
+
+      case kOptionJobs:
+        jobs = ca_table::internal::StringToUInt64(optarg);
+        if (!jobs) errx(EX_USAGE, "Job count must be positive");
+        break;
+
       case kOptionKeyFilter:
         key_filter = std::make_unique<re2::RE2>(optarg);
         break;
@@ -294,13 +755,27 @@ int main(int argc, char** argv) try {
     printf(
         "Usage: %s [OPTION]... TABLE\n"
         "\n"
+        "      --aggregate=DURATION   print the count, sum, minimum, maximum "
+        "and\n"
+        "                             average of time series values in "
+        "buckets\n"
+        "                             of DURATION, given in seconds or with "
+        "an\n"
+        "                             m, h, d or w suffix\n"
         "      --count                print record count instead of normal "
         "output\n"
         "      --delimiter=DELIMITER  set input delimiter [%c]\n"
         "      --date-format=FORMAT   use provided date format [%s]\n"
         "      --date=DATE            use DATE as timestamp\n"
+        "      --from=TIME            only print time series values at or "
+        "after TIME\n"
+        "      --to=TIME              only print time series values before "
+        "TIME\n"
         "      --key-filter=REGEX     only read keys matching REGEX\n"
         "      --keys-only            do not print values\n"
+        "      --jobs=N               dump N parts of the table in parallel "
+        "[1]; only\n"
+        "                             write-once tables can be split\n"
         "      --interval=INTERVAL    sample interval if both --date and --key "
         "are\n"
         "                             given\n"
@@ -322,53 +797,38 @@ int main(int argc, char** argv) try {
   if (optind + 1 != argc)
     errx(EX_USAGE, "Usage: %s [OPTION]... TABLE", argv[0]);
 
-  table_handle = ca_table::TableFactory::Open(nullptr, argv[optind]);
+  table_path = argv[optind];
 
   if (key_filter) {
-    KJ_REQUIRE(key_filter->PossibleMatchRange(&first_key, &last_key, 64));
+    std::string min, max;
+    KJ_REQUIRE(key_filter->PossibleMatchRange(&min, &max, 64));
+
+    // `max' is inclusive, and the smallest key following it is `max' plus a
+    // NUL byte.
+    max.push_back(0);
+
+    if (ca_table::internal::CompareUTF8(first_key, min)) first_key = min;
+    if (last_key.empty() || ca_table::internal::CompareUTF8(max, last_key))
+      last_key = max;
   }
 
-  table_handle->SeekToKey(first_key);
+  if (from || to) {
+    has_time_range = true;
+    if (from) min_time = ParseTime(from);
+    if (to) {
+      const auto end_time = ParseTime(to);
+      if (end_time <= min_time) errx(EX_USAGE, "Empty time range");
+      max_time = end_time - 1;
+    }
+  }
+
+  DumpFunction dump;
 
   if (count_only) {
-    cantera::string_view key, value;
-    if (!keys_only && !strcmp(format, "time-series")) {
-      while (table_handle->ReadRow(key, value)) {
-        if (key_filter &&
-            !RE2::FullMatch(re2::StringPiece(key.data(), key.size()),
-                            *key_filter)) {
-          if (ca_table::internal::CompareUTF8(last_key, key)) break;
-          continue;
-        }
-        const auto begin = reinterpret_cast<const uint8_t*>(value.data());
-        const auto end = begin + value.size();
-        printf("%.*s\t%zu\n", static_cast<int>(key.size()), key.data(),
-               ca_table::ca_offset_score_count(begin, end));
-      }
-    } else {
-      size_t count = 0;
-      while (table_handle->ReadRow(key, value)) {
-        if (key_filter &&
-            !RE2::FullMatch(re2::StringPiece(key.data(), key.size()),
-                            *key_filter)) {
-          if (ca_table::internal::CompareUTF8(last_key, key)) break;
-          continue;
-        }
-        ++count;
-      }
-      printf("%zu\n", count);
-    }
+    dump = (!keys_only && !strcmp(format, "time-series")) ? DumpCounts
+                                                          : CountRows;
   } else if (keys_only) {
-    cantera::string_view key, value;
-    while (table_handle->ReadRow(key, value)) {
-      if (key_filter &&
-          !RE2::FullMatch(re2::StringPiece(key.data(), key.size()),
-                          *key_filter)) {
-        if (ca_table::internal::CompareUTF8(last_key, key)) break;
-        continue;
-      }
-      printf("%.*s\n", static_cast<int>(key.size()), key.data());
-    }
+    dump = DumpKeys;
   } else if (!strcmp(format, "index")) {
     if (!schema_path && !raw) {
       errx(
@@ -376,21 +836,23 @@ int main(int argc, char** argv) try {
           "--output-format=index can only be used with --schema=PATH or --raw");
     }
 
-    if (raw) {
-      DumpIndexRaw();
-    } else {
-      schema = std::make_unique<ca_table::Schema>(schema_path);
-      schema->Load();
-
-      DumpIndex();
-    }
+    dump = raw ? DumpIndexRaw : DumpIndex;
   } else if (!strcmp(format, "summaries")) {
-    DumpSummaries();
+    dump = DumpSummaries;
   } else if (!strcmp(format, "time-series")) {
-    DumpTimeSeries();
+    dump = bucket_size ? DumpAggregates : DumpTimeSeries;
   } else {
     errx(EX_USAGE, "Invalid format '%s'", format);
   }
+
+  if (dump != DumpIndex) schema_path = nullptr;
+
+  if (jobs > 1)
+    DumpParallel(dump, jobs);
+  else
+    DumpPart(dump, first_key, last_key, stdout);
+
+  if (dump == CountRows) printf("%zu\n", row_count.load());
 } catch (kj::Exception e) {
   KJ_LOG(FATAL, e);
   return EXIT_FAILURE;
@@ -34,6 +34,7 @@
 #include "src/ca-table.h"
 #include "src/util.h"
 #include "src/schema.h"
+#include "src/trace.h"
 
 namespace ca_table = cantera::table;
 
@@ -52,11 +53,20 @@ enum DataType { kDataTypeIndex, kDataTypeSummaries, kDataTypeTimeSeries };
 uint64_t shard_count = 1;
 uint64_t shard_index = 0;
 
+// If true, index postings are sharded by the hash of their document key
+// instead of by index key, so that each shard has the postings of its own
+// documents, and summaries are sharded the same way.
+bool shard_by_document;
+
 int print_version;
 int print_help;
 int no_unescape;
 int verbose;
 
+// If true, time series get a skip index for time range lookups.  Readers
+// older than the skip index can't parse such time series.
+int time_series_index;
+
 MergeMode merge_mode = kMergeUnion;
 
 char delimiter = '\t';
@@ -69,18 +79,25 @@ enum Option {
   kAddKeyPrefixOption = 1,
   kDateFormatOption,
   kDelimiterOption,
+  kDocValuesOption,
+  kImpactThresholdOption,
   kInputFormatOption,
   kInputUnsorted,
   kKeyFilterOption,
   kMergeModeMotion,
   kOutputBackend,
+  kOutputBlockRestartInterval,
+  kOutputBlockSize,
   kOutputCompression,
   kOutputCompressionLevel,
+  kOutputFilterBitsPerKey,
   kOutputSeekable,
   kOutputTypeOption,
   kSchemaOption,
+  kShardByOption,
   kShardCountOption,
   kShardIndexOption,
+  kSketchThresholdOption,
   kStripKeyPrefixOption,
   kThresholdOption,
 };
@@ -89,23 +106,34 @@ struct option kLongOptions[] = {
     {"add-key-prefix", required_argument, nullptr, kAddKeyPrefixOption},
     {"date-format", required_argument, nullptr, kDateFormatOption},
     {"delimiter", required_argument, nullptr, kDelimiterOption},
+    {"doc-values", required_argument, nullptr, kDocValuesOption},
+    {"impact-threshold", required_argument, nullptr,
+     kImpactThresholdOption},
     {"input-format", required_argument, nullptr, kInputFormatOption},
     {"input-unsorted", no_argument, nullptr, kInputUnsorted},
     {"key-filter", required_argument, nullptr, kKeyFilterOption},
     {"merge-mode", required_argument, nullptr, kMergeModeMotion},
     {"no-unescape", no_argument, &no_unescape, 1},
     {"output-backend", required_argument, nullptr, kOutputBackend},
+    {"output-block-restart-interval", required_argument, nullptr,
+     kOutputBlockRestartInterval},
+    {"output-block-size", required_argument, nullptr, kOutputBlockSize},
     {"output-compression", required_argument, nullptr, kOutputCompression},
     {"output-compression-level", required_argument, nullptr,
      kOutputCompressionLevel},
+    {"output-filter-bits-per-key", required_argument, nullptr,
+     kOutputFilterBitsPerKey},
     {"output-seekable", no_argument, nullptr, kOutputSeekable},
     {"output-type", required_argument, nullptr, kOutputTypeOption},
     {"output-format", required_argument, nullptr, kOutputTypeOption},
     {"schema", required_argument, nullptr, kSchemaOption},
+    {"shard-by", required_argument, nullptr, kShardByOption},
     {"shard-count", required_argument, nullptr, kShardCountOption},
     {"shard-index", required_argument, nullptr, kShardIndexOption},
+    {"sketch-threshold", required_argument, nullptr, kSketchThresholdOption},
     {"strip-key-prefix", required_argument, nullptr, kStripKeyPrefixOption},
     {"threshold", required_argument, nullptr, kThresholdOption},
+    {"time-series-index", no_argument, &time_series_index, 1},
     {"verbose", no_argument, &verbose, 1},
     {"version", no_argument, &print_version, 1},
     {"help", no_argument, &print_help, 1},
@@ -144,6 +172,18 @@ size_t max_sorted_value_index = 0;
 float threshold;
 bool has_threshold;
 
+// Index posting lists with at least this many values also get a copy ordered
+// by score.  Zero disables impact indexes.
+size_t impact_threshold;
+
+// Index posting lists with at least this many values also get a sketch of
+// their offsets.  Zero disables sketches.
+size_t sketch_threshold;
+
+// Index keys matching this get doc values, for looking up the scores of
+// given documents.
+std::unique_ptr<re2::RE2> doc_values_filter;
+
 std::string strip_key_prefix;
 std::string add_key_prefix;
 
@@ -178,9 +218,40 @@ void AddOffsetScore(uint64_t offset, const ca_table::ca_score& score) {
   values.push_back(value);
 }
 
+void WriteIndex(const std::string& key,
+                const std::vector<ca_table::ca_offset_score>& data) {
+  unsigned int options = 0;
+  if (impact_threshold && data.size() >= impact_threshold)
+    options |= ca_table::CA_INDEX_IMPACT;
+  if (sketch_threshold && data.size() >= sketch_threshold)
+    options |= ca_table::CA_INDEX_SKETCH;
+  if (doc_values_filter && RE2::FullMatch(key, *doc_values_filter))
+    options |= ca_table::CA_INDEX_DOC_VALUES;
+
+  ca_table::ca_table_write_index(table_handle.get(), key, &data[0],
+                                 data.size(), options);
+}
+
+void WriteTimeSeries(const std::string& key,
+                     const std::vector<ca_table::ca_offset_score>& data) {
+  if (time_series_index) {
+    ca_table::ca_table_write_time_series(table_handle.get(), key, &data[0],
+                                         data.size());
+  } else {
+    ca_table::ca_table_write_offset_score(table_handle.get(), key, &data[0],
+                                          data.size());
+  }
+}
+
+// Returns true if rows with the key `key' belong in another shard.
+bool InOtherShard(const cantera::string_view& key) {
+  return shard_count > 1 &&
+         (ca_table::internal::Hash(key) % shard_count) != shard_index;
+}
+
 void FlushValues(const std::string& key,
                         std::vector<ca_table::ca_offset_score>&& time_series) {
-  if ((shard_count > 1 && (ca_table::internal::Hash(key) % shard_count) != shard_index) ||
+  if ((!shard_by_document && InOtherShard(key)) ||
       (key_filter && !RE2::FullMatch(key, *key_filter))) {
     max_sorted_value_index = 0;
     return;
@@ -218,8 +289,20 @@ void FlushValues(const std::string& key,
       time_series.begin(), time_series.end(),
       [](const auto& lhs, const auto& rhs) { return lhs.offset < rhs.offset; });
 
-  ca_table_write_offset_score(table_handle.get(), c_key, &time_series[0],
-                              time_series.size());
+  if (do_map_documents) {
+    WriteIndex(c_key, time_series);
+  } else {
+    WriteTimeSeries(c_key, time_series);
+  }
+}
+
+void WriteOffsetScore(DataType output_type, const std::string& key,
+                      const std::vector<ca_table::ca_offset_score>& data) {
+  if (output_type == kDataTypeTimeSeries) {
+    WriteTimeSeries(key, data);
+  } else {
+    WriteIndex(key, data);
+  }
 }
 
 void FlushValues(const std::string& key) {
@@ -282,14 +365,18 @@ void parse_data(const char* begin, const char* end, parse_state& state) {
           if (do_map_documents) {
             state.no_match = 1;
 
-            for (auto i = schema->summary_tables.size(); i-- > 0;) {
-              if (schema->summary_tables[i].second->SeekToKey(offset)) {
-                current_offset = schema->summary_tables[i].second->Offset() +
-                                 std::get<uint64_t>(schema->summary_tables[i]);
+            // Postings of documents in other shards are left out.
+            if (!shard_by_document || !InOtherShard(offset)) {
+              for (auto i = schema->summary_tables.size(); i-- > 0;) {
+                const auto& summary_table = schema->summary_tables[i];
+                if (summary_table.second->SeekToKey(offset)) {
+                  current_offset = summary_table.second->Offset() +
+                                   std::get<uint64_t>(summary_table);
 
-                state.no_match = 0;
+                  state.no_match = 0;
 
-                break;
+                  break;
+                }
               }
             }
           } else {
@@ -329,10 +416,14 @@ void parse_data(const char* begin, const char* end, parse_state& state) {
 
         if (!was_escaped && ch == '\n') {
           if (do_summaries) {
-            if (add_key_prefix.empty()) {
-              table_handle->InsertRow(current_key, value_string);
-            } else {
-              table_handle->InsertRow(add_key_prefix + current_key, value_string);
+            // Summaries of documents in other shards are left out.
+            if (!shard_by_document || !InOtherShard(current_key)) {
+              if (add_key_prefix.empty()) {
+                table_handle->InsertRow(current_key, value_string);
+              } else {
+                table_handle->InsertRow(add_key_prefix + current_key,
+                                        value_string);
+              }
             }
           } else if (state.no_match) {
             state.no_match = 0;
@@ -392,7 +483,7 @@ void parse_data(const char* begin, const char* end, parse_state& state) {
 
 void SimpleMergeCallback(const std::string& key,
                                 std::vector<std::vector<char>>& data) {
-  if (shard_count > 1 && (ca_table::internal::Hash(key) % shard_count) != shard_index) return;
+  if (InOtherShard(key)) return;
 
   KJ_REQUIRE(data.size() == 1, data.size(),
              "Duplicate detected; you must choose a merge mode");
@@ -408,7 +499,7 @@ void SimpleMergeCallback(const std::string& key,
 
 void MergeTimeSeriesCallback(const std::string& key,
                                     std::vector<std::vector<char>>& data) {
-  if (shard_count > 1 && (ca_table::internal::Hash(key) % shard_count) != shard_index) return;
+  if (InOtherShard(key)) return;
 
   if (data.size() == 1) {
     // TODO(mortehu): Support strip_key_prefix.
@@ -506,7 +597,7 @@ void MergeTimeSeriesCallback(const std::string& key,
 
 void MergeSummariesCallback(std::string key,
                                    std::vector<std::vector<char>>& data) {
-  if (shard_count > 1 && (ca_table::internal::Hash(key) % shard_count) != shard_index) return;
+  if (InOtherShard(key)) return;
 
   if (!add_key_prefix.empty()) key += add_key_prefix;
 
@@ -541,11 +632,12 @@ void MergeSummariesCallback(std::string key,
 }
 
 void CopyTable(ca_table::Table* input, ca_table::Table* output) {
+  CA_TRACE_SPAN("load", "copy");
+
   cantera::string_view key, value;
 
   while (input->ReadRow(key, value)) {
-    if (shard_count > 1 && (ca_table::internal::Hash(key) % shard_count) != shard_index)
-      continue;
+    if (InOtherShard(key)) continue;
 
     if (key_filter &&
         !RE2::FullMatch(re2::StringPiece(key.data(), key.size()), *key_filter))
@@ -581,6 +673,9 @@ int main(int argc, char** argv) try {
       ca_table::kTableCompressionDefault;
   uint64_t output_compression_level = 0;
   bool output_seekable = false;
+  uint64_t output_block_size = 0;
+  uint64_t output_block_restart_interval = 0;
+  uint64_t output_filter_bits_per_key = 0;
 
   const char* schema_path = NULL;
 
@@ -661,6 +756,18 @@ int main(int argc, char** argv) try {
         output_backend = optarg;
         break;
 
+      case kOutputBlockRestartInterval:
+        output_block_restart_interval =
+            ca_table::internal::StringToUInt64(optarg);
+        KJ_REQUIRE(output_block_restart_interval > 0 &&
+                   output_block_restart_interval <= INT_MAX);
+        break;
+
+      case kOutputBlockSize:
+        output_block_size = ca_table::internal::StringToUInt64(optarg);
+        KJ_REQUIRE(output_block_size > 0);
+        break;
+
       case kOutputCompression:
         if (!strcmp(optarg, "none")) {
           output_compression = ca_table::kTableCompressionNone;
@@ -675,6 +782,11 @@ int main(int argc, char** argv) try {
         output_compression_level = ca_table::internal::StringToUInt64(optarg);
         break;
 
+      case kOutputFilterBitsPerKey:
+        output_filter_bits_per_key = ca_table::internal::StringToUInt64(optarg);
+        KJ_REQUIRE(output_filter_bits_per_key <= INT_MAX);
+        break;
+
       case kOutputSeekable:
         output_seekable = true;
         break;
@@ -683,6 +795,16 @@ int main(int argc, char** argv) try {
         schema_path = optarg;
         break;
 
+      case kShardByOption:
+        if (!strcmp(optarg, "document")) {
+          shard_by_document = true;
+        } else if (!strcmp(optarg, "key")) {
+          shard_by_document = false;
+        } else {
+          errx(EX_USAGE, "Unknown shard type: %s", optarg);
+        }
+        break;
+
       case kShardCountOption:
         shard_count = ca_table::internal::StringToUInt64(optarg);
         KJ_REQUIRE(shard_count > 0);
@@ -696,6 +818,18 @@ int main(int argc, char** argv) try {
         strip_key_prefix = optarg;
         break;
 
+      case kDocValuesOption:
+        doc_values_filter = std::make_unique<re2::RE2>(optarg);
+        break;
+
+      case kImpactThresholdOption:
+        impact_threshold = ca_table::internal::StringToUInt64(optarg);
+        break;
+
+      case kSketchThresholdOption:
+        sketch_threshold = ca_table::internal::StringToUInt64(optarg);
+        break;
+
       case kThresholdOption:
         threshold = ca_table::internal::StringToUInt64(optarg);
         has_threshold = true;
@@ -712,6 +846,11 @@ int main(int argc, char** argv) try {
         "      --date-format=FORMAT   use provided date format [%s]\n"
         "      --date=DATE            use DATE as timestamp\n"
         "      --delimiter=DELIMITER  input delimiter [%c]\n"
+        "      --doc-values=REGEX     add doc values to index keys matching "
+        "REGEX\n"
+        "      --impact-threshold=COUNT\n"
+        "                             add a copy ordered by score to index\n"
+        "                               keys with at least COUNT values\n"
         "      --input-format=FORMAT  format of input data\n"
         "      --input-unsorted       input data is not sorted\n"
         "      --key=KEY              use KEY as key\n"
@@ -720,18 +859,35 @@ int main(int argc, char** argv) try {
         "      --no-unescape          don't apply any unescaping logic\n"
         "      --output-backend=TYPE  type of output storage backend\n"
         "                               (leveldb-table|write-once)\n"
+        "      --output-block-restart-interval=COUNT\n"
+        "                             keys between restart points in\n"
+        "                               leveldb-table blocks\n"
+        "      --output-block-size=BYTES\n"
+        "                             uncompressed leveldb-table block size\n"
         "      --output-compression=TYPE\n"
         "                             output compression method\n"
         "                               (default|none|zstd)\n"
         "      --output-compression-level=LEVEL\n"
         "                             output compression level\n"
+        "      --output-filter-bits-per-key=BITS\n"
+        "                             add a bloom filter to leveldb-table output\n"
         "      --output-seekable      output needs to be seekable\n"
         "      --output-type=TYPE     type of output table\n"
         "                               (index|summaries|time-series)\n"
         "      --schema=PATH          schema file for index building\n"
+        "      --shard-by=TYPE        shard index tables by index key or by\n"
+        "                               document (key|document) [key]\n"
+        "      --shard-count=N        number of shards\n"
+        "      --shard-index=I        only output shard I, counting from 0\n"
+        "      --sketch-threshold=COUNT\n"
+        "                             add a sketch for count estimates to\n"
+        "                               index keys with at least COUNT values\n"
         "      --strip-key-prefix=PREFIX\n"
         "                             remove PREFIX from keys\n"
         "      --threshold=SCORE      minimum score to include in output\n"
+        "      --time-series-index    add a skip index to time series, for\n"
+        "                               time range lookups; older readers\n"
+        "                               can't read the output\n"
         "      --help     display this help and exit\n"
         "      --verbose  display format information\n"
         "      --version  display version information\n"
@@ -748,6 +904,9 @@ int main(int argc, char** argv) try {
     return EXIT_SUCCESS;
   }
 
+  if (shard_by_document && output_type == kDataTypeTimeSeries)
+    errx(EX_USAGE, "time series can't be sharded by document");
+
   if (output_type == kDataTypeIndex) {
     if (schema_path == nullptr) {
       errx(EX_USAGE,
@@ -779,10 +938,21 @@ int main(int argc, char** argv) try {
       .SetCompression(output_compression)
       .SetCompressionLevel(output_compression_level)
       .SetInputUnsorted(input_unsorted)
-      .SetOutputSeekable(output_seekable);
+      .SetOutputSeekable(output_seekable)
+      .SetBlockSize(output_block_size)
+      .SetBlockRestartInterval(output_block_restart_interval)
+      .SetFilterBitsPerKey(output_filter_bits_per_key);
 
   if (!output_backend) output_backend = "leveldb-table";
 
+  if (strcmp(output_backend, "leveldb-table") &&
+      (output_block_size || output_block_restart_interval ||
+       output_filter_bits_per_key)) {
+    errx(EX_USAGE,
+         "block size, restart interval and filter options are only supported "
+         "by the leveldb-table backend");
+  }
+
   if (optind + 1 > argc)
     errx(EX_USAGE, "Usage: %s [OPTION]... TABLE [INPUT]...", argv[0]);
 
@@ -808,6 +978,8 @@ int main(int argc, char** argv) try {
                                                   output_options);
 
     for (auto& input : inputs) {
+      CA_TRACE_SPAN("load", "read-columnfile");
+
       cantera::ColumnFileReader reader(std::move(input));
 
       switch (output_type) {
@@ -815,6 +987,8 @@ int main(int argc, char** argv) try {
           while (!reader.End()) {
             auto& row = reader.GetRow();
             KJ_REQUIRE(row.size() == 2);
+            if (shard_by_document && InOtherShard(row[0].second.value()))
+              continue;
             table_handle->InsertRow(row[0].second.value(),
                                     row[1].second.value());
           }
@@ -830,8 +1004,7 @@ int main(int argc, char** argv) try {
 
             if (row[0].second.value() != key) {
               if (!data.empty()) {
-                ca_table::ca_table_write_offset_score(table_handle.get(), key, &data[0],
-                                            data.size());
+                WriteOffsetScore(output_type, key, data);
                 data.clear();
               }
               key = row[0].second.value().to_string();
@@ -839,6 +1012,9 @@ int main(int argc, char** argv) try {
 
             uint64_t offset;
             if (output_type == kDataTypeIndex) {
+              if (shard_by_document && InOtherShard(row[1].second.value()))
+                continue;
+
               bool match_found = false;
               for (auto i = schema->summary_tables.size(); i-- > 0;) {
                 if (schema->summary_tables[i].second->SeekToKey(
@@ -879,8 +1055,7 @@ int main(int argc, char** argv) try {
           }
 
           if (!data.empty()) {
-            ca_table::ca_table_write_offset_score(table_handle.get(), key, &data[0],
-                                        data.size());
+            WriteOffsetScore(output_type, key, data);
             data.clear();
           }
         } break;
@@ -894,6 +1069,8 @@ int main(int argc, char** argv) try {
 
     kj::AutoCloseFd input(STDIN_FILENO);
 
+    CA_TRACE_SPAN("load", "parse-input");
+
     if (-1 == (file_size = lseek(input, 0, SEEK_END))) {
       parse_state state;
 
@@ -924,6 +1101,11 @@ int main(int argc, char** argv) try {
     }
   } else {
     KJ_REQUIRE(input_format == kFormatAuto || input_format == kFormatCaTable);
+
+    // Index tables only have the offsets of documents, not their keys.
+    if (shard_by_document && output_type == kDataTypeIndex)
+      errx(EX_USAGE, "--shard-by=document needs text or columnfile input");
+
     std::vector<std::unique_ptr<ca_table::Table>> tables;
 
     for (i = optind; i < argc; ++i) {
@@ -959,7 +1141,10 @@ int main(int argc, char** argv) try {
 
   if (!values.empty()) FlushValues(current_key);
 
-  table_handle->Sync();
+  {
+    CA_TRACE_SPAN("load", "sync");
+    table_handle->Sync();
+  }
 } catch (kj::Exception e) {
   KJ_LOG(FATAL, e);
   return EXIT_FAILURE;
@@ -21,18 +21,29 @@
 #include "config.h"
 #endif
 
+#include <algorithm>
 #include <cerrno>
+#include <csignal>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include <err.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <kj/debug.h>
+#include <kj/io.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <sysexits.h>
 #include <unistd.h>
 
@@ -41,25 +52,46 @@
 #include <readline/history.h>
 #include <readline/readline.h>
 
+#include "src/access-log.h"
 #include "src/ca-table.h"
 #include "src/query.h"
+#include "src/trace.h"
 
 namespace ca_table = cantera::table;
 
 namespace {
 
+// The schema given on the command line, or every shard if there are several.
+using SchemaList = std::vector<std::shared_ptr<ca_table::SchemaManager>>;
+
 enum Option : int {
   kOptionCommand = 'c',
   kOptionUnknown = '?',
+  kOptionListen = 256,
+  kOptionWorkers,
+  kOptionCASCacheSize,
+  kOptionCASCacheDir,
+  kOptionMemoryLimit,
+  kOptionStatementTimeout,
 };
 
 int print_version;
 int print_help;
+int batch_mode;
+
+const char kDefaultTimeFormat[] = "%Y-%m-%dT%H:%M:%S";
 
 const char kDefaultSchemaPath[] = "/data/index/current/schema.txt";
 
 struct option kLongOptions[] = {
     {"command", required_argument, NULL, kOptionCommand},
+    {"listen", required_argument, NULL, kOptionListen},
+    {"workers", required_argument, NULL, kOptionWorkers},
+    {"batch", no_argument, &batch_mode, 1},
+    {"cas-cache-size", required_argument, NULL, kOptionCASCacheSize},
+    {"cas-cache-dir", required_argument, NULL, kOptionCASCacheDir},
+    {"memory-limit", required_argument, NULL, kOptionMemoryLimit},
+    {"statement-timeout", required_argument, NULL, kOptionStatementTimeout},
     {"version", no_argument, &print_version, 1},
     {"help", no_argument, &print_help, 1},
     {nullptr, 0, nullptr, 0}};
@@ -72,6 +104,16 @@ static void stdout_error(const char *errmsg) {
   std::cout << Json::FastWriter().write(error);
 }
 
+static void set_schemas(ca_table::QueryParseContext& context,
+                        const SchemaList& schemas) {
+  context.schemas = schemas.front();
+  if (schemas.size() > 1) context.shards = schemas;
+}
+
+static void reload_schemas(const SchemaList& schemas) {
+  for (const auto& schema : schemas) schema->Reload();
+}
+
 static void parse_string(ca_table::QueryParseContext &context, const char *command, bool use_std_err) {
   FILE* file;
 
@@ -94,13 +136,268 @@ static void parse_string(ca_table::QueryParseContext &context, const char *comma
   fclose(file);
 }
 
+// The runtime parameters of a worker that SET may change, other than the
+// output and time formats, as they were before its first connection.
+struct RuntimeDefaults {
+  size_t memory_limit = ca_table::CA_memory_limit;
+  uint64_t statement_timeout = ca_table::CA_statement_timeout;
+  std::string trace_path = ca_table::internal::TracePath();
+};
+
+// Writes out a trace started with SET TRACE, and resumes the worker's own
+// tracing, if any.
+static void restore_trace(const RuntimeDefaults& defaults) {
+  if (ca_table::internal::TracePath() == defaults.trace_path) return;
+
+  ca_table::internal::StopTrace();
+  if (!defaults.trace_path.empty())
+    ca_table::internal::ResumeTrace(defaults.trace_path.c_str());
+}
+
+// Runs the statements in `request' with a fresh parse context, so that the
+// parser's arena is released after every request.
+static void serve_request(const SchemaList& schemas, const char* request) {
+  ca_table::QueryParseContext context;
+  set_schemas(context, schemas);
+  context.batch_mode = batch_mode;
+
+  // Have the server reload the schema in every worker, not just this one.
+  context.reload_schema = [] { kill(getppid(), SIGHUP); };
+
+  parse_string(context, request, true);
+}
+
+// Serves one client connection.  Every line received is a request containing
+// one or more statements.  The output of each request is written to the
+// client, followed by a NUL byte.  Runtime parameters changed with SET only
+// last until the client disconnects.
+static void serve_connection(const SchemaList& schemas,
+                             const RuntimeDefaults& defaults, int client_fd) {
+  ca_table::CA_output_format = ca_table::CA_PARAM_VALUE_JSON;
+  strcpy(ca_table::CA_time_format, kDefaultTimeFormat);
+  ca_table::CA_memory_limit = defaults.memory_limit;
+  ca_table::CA_statement_timeout = defaults.statement_timeout;
+
+  int input_fd;
+  KJ_SYSCALL(input_fd = dup(client_fd));
+
+  auto input = fdopen(input_fd, "r");
+  if (!input) {
+    close(input_fd);
+    KJ_FAIL_SYSCALL("fdopen", errno);
+  }
+  KJ_DEFER(fclose(input));
+
+  KJ_SYSCALL(dup2(client_fd, STDOUT_FILENO));
+
+  char* line = nullptr;
+  size_t line_size = 0;
+  KJ_DEFER(free(line));
+
+  while (-1 != getline(&line, &line_size, input)) {
+    serve_request(schemas, line);
+
+    putchar_unlocked(0);
+    if (EOF == fflush(stdout) || ferror(stdout)) break;
+  }
+
+  clearerr(stdout);
+}
+
+// Worker process entry point.  Accepts and serves connections until killed.
+static void worker_main(const SchemaList& schemas, int listen_fd) {
+  // Writes to disconnected clients should fail, not kill the worker.
+  signal(SIGPIPE, SIG_IGN);
+
+  // Responses are flushed explicitly at the end of every request.
+  setvbuf(stdout, nullptr, _IOFBF, BUFSIZ);
+
+  // Restores standard output after each connection.
+  int null_fd;
+  KJ_SYSCALL(null_fd = open("/dev/null", O_WRONLY));
+
+  const RuntimeDefaults defaults;
+
+  for (;;) {
+    int client_fd = accept(listen_fd, nullptr, nullptr);
+    if (client_fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      KJ_FAIL_SYSCALL("accept", errno);
+    }
+    kj::AutoCloseFd client(client_fd);
+
+    try {
+      serve_connection(schemas, defaults, client_fd);
+    } catch (kj::Exception e) {
+      KJ_LOG(ERROR, e);
+    }
+
+    try {
+      restore_trace(defaults);
+    } catch (kj::Exception e) {
+      KJ_LOG(ERROR, e);
+    }
+
+    fflush(stdout);
+    clearerr(stdout);
+    KJ_SYSCALL(dup2(null_fd, STDOUT_FILENO));
+  }
+}
+
+static pid_t start_worker(const SchemaList& schemas, int listen_fd,
+                          const sigset_t& old_mask) {
+  pid_t pid;
+  KJ_SYSCALL(pid = fork());
+  if (pid) return pid;
+
+  try {
+    sigset_t mask = old_mask;
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGTERM);
+    KJ_SYSCALL(sigprocmask(SIG_SETMASK, &mask, nullptr));
+
+    // Reloads the schema in the background on SIGHUP.  Statements that are
+    // already running finish on the previous generation.  On SIGTERM, writes
+    // the pending block access samples and trace events, since exit handlers
+    // don't run.
+    std::thread([schemas] {
+      sigset_t signal_mask;
+      sigemptyset(&signal_mask);
+      sigaddset(&signal_mask, SIGHUP);
+      sigaddset(&signal_mask, SIGTERM);
+
+      for (;;) {
+        int sig;
+        if (sigwait(&signal_mask, &sig)) continue;
+
+        if (sig == SIGTERM) {
+          ca_table::internal::FlushAccessLogs();
+          ca_table::internal::StopTrace();
+          _exit(EXIT_SUCCESS);
+        }
+
+        try {
+          reload_schemas(schemas);
+        } catch (kj::Exception e) {
+          KJ_LOG(ERROR, e);
+        }
+      }
+    }).detach();
+
+    worker_main(schemas, listen_fd);
+  } catch (kj::Exception e) {
+    KJ_LOG(ERROR, e);
+  }
+
+  ca_table::internal::FlushAccessLogs();
+  ca_table::internal::StopTrace();
+  _exit(EXIT_FAILURE);
+}
+
+// Listens for clients on the Unix socket at `path', and serves them with
+// `worker_count' worker processes.  The schema and its tables are opened
+// before the workers are forked, so every worker starts out warm and shares
+// the page cache.  Tables are read with pread() or mmap(), so the inherited
+// file descriptors are safe to share.  Each worker serves one connection at a
+// time, so clients beyond `worker_count' wait in the listen queue.
+//
+// On SIGHUP, the schema is reloaded, and if that succeeds, every worker is
+// told to reload it too.  Returns when interrupted by SIGINT or SIGTERM.
+static void serve(const SchemaList& schemas, const char* path,
+                  size_t worker_count) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  KJ_REQUIRE(strlen(path) < sizeof(addr.sun_path), "socket path too long",
+             path);
+  strcpy(addr.sun_path, path);
+
+  // Remove the socket left behind by a previous server, but nothing else.
+  struct stat st;
+  if (0 == lstat(path, &st) && S_ISSOCK(st.st_mode))
+    KJ_SYSCALL(unlink(path), path);
+
+  int listen_fd;
+  KJ_SYSCALL(listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  kj::AutoCloseFd listen_socket(listen_fd);
+
+  KJ_SYSCALL(bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr),
+                  sizeof(addr)),
+             path);
+  KJ_DEFER(unlink(path));
+
+  KJ_SYSCALL(listen(listen_fd, SOMAXCONN));
+
+  for (const auto& schema : schemas) schema->Current()->IndexTables();
+
+  sigset_t mask, old_mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  KJ_SYSCALL(sigprocmask(SIG_BLOCK, &mask, &old_mask));
+
+  std::unordered_set<pid_t> workers;
+  KJ_DEFER({
+    for (auto pid : workers) kill(pid, SIGTERM);
+    while (!workers.empty()) {
+      auto pid = wait(nullptr);
+      if (pid == -1 && errno != EINTR) break;
+      workers.erase(pid);
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+  });
+
+  for (size_t i = 0; i < worker_count; ++i)
+    workers.emplace(start_worker(schemas, listen_fd, old_mask));
+
+  for (;;) {
+    int sig, error;
+    if (0 != (error = sigwait(&mask, &sig))) KJ_FAIL_SYSCALL("sigwait", error);
+
+    if (sig == SIGHUP) {
+      try {
+        reload_schemas(schemas);
+      } catch (kj::Exception e) {
+        KJ_LOG(ERROR, "schema reload failed", e);
+        continue;
+      }
+
+      for (auto pid : workers) kill(pid, SIGHUP);
+      continue;
+    }
+
+    if (sig != SIGCHLD) break;
+
+    // Replace workers that have died.
+    pid_t pid;
+    int status;
+    while (0 < (pid = waitpid(-1, &status, WNOHANG))) {
+      if (!workers.erase(pid)) continue;
+
+      if (WIFSIGNALED(status)) {
+        KJ_LOG(ERROR, "worker killed by signal", pid, WTERMSIG(status));
+      } else {
+        KJ_LOG(ERROR, "worker exited", pid, WEXITSTATUS(status));
+      }
+
+      workers.emplace(start_worker(schemas, listen_fd, old_mask));
+    }
+  }
+}
+
 int main(int argc, char** argv) try {
   ca_table::QueryParseContext context;
-  const char* schema_path = nullptr;
+  SchemaList schemas;
   const char* command = nullptr;
+  const char* listen_path = nullptr;
+  size_t worker_count = std::max(std::thread::hardware_concurrency(), 1U);
+  size_t cas_cache_size = 64 << 20;
+  const char* cas_cache_dir = nullptr;
   int i;
 
-  strcpy(ca_table::CA_time_format, "%Y-%m-%dT%H:%M:%S");
+  strcpy(ca_table::CA_time_format, kDefaultTimeFormat);
 
   while (-1 != (i = getopt_long(argc, argv, "c:", kLongOptions, 0))) {
     if (!i) continue;
@@ -110,6 +407,50 @@ int main(int argc, char** argv) try {
         command = optarg;
         break;
 
+      case kOptionListen:
+        listen_path = optarg;
+        break;
+
+      case kOptionWorkers: {
+        char* endptr;
+        errno = 0;
+        auto value = strtoul(optarg, &endptr, 0);
+        if (errno || *endptr || !value)
+          errx(EX_USAGE, "Invalid worker count '%s'", optarg);
+        worker_count = value;
+      } break;
+
+      case kOptionCASCacheSize: {
+        char* endptr;
+        errno = 0;
+        auto value = strtoull(optarg, &endptr, 0);
+        if (errno || *endptr)
+          errx(EX_USAGE, "Invalid CAS cache size '%s'", optarg);
+        cas_cache_size = value;
+      } break;
+
+      case kOptionCASCacheDir:
+        cas_cache_dir = optarg;
+        break;
+
+      case kOptionMemoryLimit: {
+        char* endptr;
+        errno = 0;
+        auto value = strtoull(optarg, &endptr, 0);
+        if (errno || *endptr)
+          errx(EX_USAGE, "Invalid memory limit '%s'", optarg);
+        ca_table::CA_memory_limit = value;
+      } break;
+
+      case kOptionStatementTimeout: {
+        char* endptr;
+        errno = 0;
+        auto value = strtoull(optarg, &endptr, 0);
+        if (errno || *endptr)
+          errx(EX_USAGE, "Invalid statement timeout '%s'", optarg);
+        ca_table::CA_statement_timeout = value;
+      } break;
+
       case kOptionUnknown:
         errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
     }
@@ -117,13 +458,29 @@ int main(int argc, char** argv) try {
 
   if (print_help) {
     printf(
-        "Usage: %s [OPTION]... [SCHEMA]\n"
+        "Usage: %s [OPTION]... [SCHEMA]...\n"
         "\n"
         "  -c, --command=STRING       execute commands in STRING and exit\n"
+        "      --listen=PATH          serve clients on the Unix socket PATH\n"
+        "      --workers=N            number of server worker processes\n"
+        "      --batch                parse each script or request before\n"
+        "                             running it, and read index keys used\n"
+        "                             by several statements only once\n"
+        "      --cas-cache-size=BYTES memory used for CAS objects [64 MiB]\n"
+        "      --cas-cache-dir=DIR    also store fetched CAS objects in DIR\n"
+        "      --memory-limit=BYTES   memory each statement may use for\n"
+        "                             intermediate results, or 0 for no\n"
+        "                             limit [4 GiB]\n"
+        "      --statement-timeout=MS fail statements running longer than\n"
+        "                             MS milliseconds [no limit]\n"
         "      --help     display this help and exit\n"
         "      --version  display version information and exit\n"
         "\n"
         "If SCHEMA is not specified, %s will be used instead.\n"
+        "If several are specified, they are treated as document shards, as\n"
+        "created by ca-load --shard-by=document, and queries are evaluated on\n"
+        "all of them in parallel.  SELECT and CORRELATE only work with a\n"
+        "single schema.\n"
         "\n"
         "Report bugs to <morten.hustveit@gmail.com>\n",
         argv[0], kDefaultSchemaPath);
@@ -137,16 +494,22 @@ int main(int argc, char** argv) try {
   }
 
   if (optind == argc) {
-    schema_path = kDefaultSchemaPath;
-  } else if (optind + 1 == argc) {
-    schema_path = argv[optind++];
+    schemas.emplace_back(
+        std::make_shared<ca_table::SchemaManager>(kDefaultSchemaPath));
   } else {
-    errx(EX_USAGE, "Usage: %s [OPTION]... [SCHEMA]", argv[0]);
+    for (; optind < argc; ++optind)
+      schemas.emplace_back(
+          std::make_shared<ca_table::SchemaManager>(argv[optind]));
   }
 
-  context.schema = std::make_unique<ca_table::Schema>(schema_path);
+  set_schemas(context, schemas);
+  context.batch_mode = batch_mode;
+
+  ca_table::CA_set_cas_cache(cas_cache_size, cas_cache_dir);
 
-  if (command) {
+  if (listen_path) {
+    serve(schemas, listen_path, worker_count);
+  } else if (command) {
     KJ_CONTEXT(command);
 
     parse_string(context, command, true);
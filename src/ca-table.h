@@ -9,6 +9,7 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <fcntl.h>
@@ -33,6 +34,10 @@ class Table;
 class SeekableTable;
 class TableOptions;
 
+namespace internal {
+class MemoryCharge;
+}  // namespace internal
+
 // Escape string for use in tab delimited format.
 std::string Escape(const string_view& str);
 
@@ -56,8 +61,21 @@ void ProcessQuery(std::vector<ca_offset_score>& offsets, const Query* query,
                   Schema* schema, bool make_headers = false,
                   bool use_max = true);
 
+// Like ProcessQuery(), but may leave out values whose offsets are not in
+// `selection', which must be sorted by offset.  Plain index keys with doc
+// values are read without decoding the whole posting list.  Sets `all_zero'
+// to whether every value of the query, selected or not, has a zero score.
+void ProcessQueryForOffsets(std::vector<ca_offset_score>& offsets,
+                            const Query* query, Schema* schema,
+                            const std::vector<ca_offset_score>& selection,
+                            bool use_max, bool* all_zero);
+
 void PrintQuery(const Query* query);
 
+// Adds the index keys that `query' looks up by name to `keys', as written in
+// the query.
+void CollectIndexKeys(const Query* query, std::vector<std::string>& keys);
+
 // Removes from `lhs' every offset contained `rhs', including duplicates.
 // Returns the number of elements left in `rhs'.
 size_t SubtractOffsets(struct ca_offset_score* lhs, size_t lhs_count,
@@ -97,12 +115,42 @@ enum ca_offset_score_type {
 
   // Nothing at all.
   CA_OFFSET_SCORE_EMPTY = 16,
+
+  // Index of the blocks that follow, giving the offset range, encoded size,
+  // and value count, sum, minimum and maximum of each block.  The blocks are
+  // stored as consecutive posting lists in any of the formats above, with
+  // ascending offsets.
+  CA_OFFSET_SCORE_SKIP_INDEX = 17,
+
+  // Copy of the values that follow, split into buckets by descending score.
+  // Gives the total value count, and the score range and encoded size of each
+  // bucket.  Each bucket is a posting list in any of the formats above, with
+  // ascending offsets.  Ignored when reading values in offset order.
+  CA_OFFSET_SCORE_IMPACT_INDEX = 18,
+
+  // Theta sketch of the offsets of the values that follow, for estimating
+  // the sizes of query results without decoding them.  Gives the size of the
+  // sketch, which is skipped when reading values.
+  CA_OFFSET_SCORE_SKETCH = 19,
+
+  CA_OFFSET_SCORE_LAST = CA_OFFSET_SCORE_SKETCH
 };
 
 /*****************************************************************************/
 
 struct ca_score;
 
+// Aggregate of the scores of the values in a range of offsets.
+struct ca_offset_score_bucket {
+  // First offset of the range.
+  uint64_t offset = 0;
+
+  uint64_t count = 0;
+  double sum = 0.0;
+  float min = std::numeric_limits<float>::infinity();
+  float max = -std::numeric_limits<float>::infinity();
+};
+
 struct ca_offset_score {
   ca_offset_score() {}
 
@@ -212,6 +260,21 @@ class TableOptions {
     return *this;
   }
 
+  TableOptions& SetBlockSize(size_t block_size) {
+    block_size_ = block_size;
+    return *this;
+  }
+
+  TableOptions& SetBlockRestartInterval(int block_restart_interval) {
+    block_restart_interval_ = block_restart_interval;
+    return *this;
+  }
+
+  TableOptions& SetFilterBitsPerKey(int filter_bits_per_key) {
+    filter_bits_per_key_ = filter_bits_per_key;
+    return *this;
+  }
+
   int GetFileFlags() const { return file_flags_; }
   mode_t GetFileMode() const { return file_mode_; }
 
@@ -222,6 +285,10 @@ class TableOptions {
   bool GetInputUnsorted() const { return input_unsorted_; }
   bool GetOutputSeekable() const { return output_seekable_; }
 
+  size_t GetBlockSize() const { return block_size_; }
+  int GetBlockRestartInterval() const { return block_restart_interval_; }
+  int GetFilterBitsPerKey() const { return filter_bits_per_key_; }
+
  private:
   // File creation options.
   int file_flags_ = 0;
@@ -235,6 +302,12 @@ class TableOptions {
   bool no_fsync_ = false;
   bool input_unsorted_ = false;
   bool output_seekable_ = false;
+
+  // Block layout options, currently only used by the LevelDB table backend.
+  // Zero selects the backend's default.
+  size_t block_size_ = 0;
+  int block_restart_interval_ = 0;
+  int filter_bits_per_key_ = 0;
 };
 
 /*****************************************************************************/
@@ -274,6 +347,18 @@ class Table {
 
   virtual bool ReadRow(struct iovec* key, struct iovec* value) = 0;
 
+  // Returns at most `count - 1' keys, in ascending order, that split the table
+  // into at most `count' parts of roughly equal size.  Each part starts at the
+  // first row whose key is not less than its split key, so parts can be read
+  // independently using SeekToKey().  Tables that don't know their layout
+  // return no keys.
+  virtual std::vector<std::string> SplitKeys(size_t count);
+
+  // Stores the smallest and largest key in the table, and returns true.
+  // Tables that are empty, or can't tell without a full scan, return false.
+  // Does not move the cursor.
+  virtual bool GetKeyRange(std::string* first_key, std::string* last_key);
+
   inline bool ReadRow(string_view& key, string_view& value) {
     struct iovec k, v;
     if (!ReadRow(&k, &v)) return false;
@@ -322,9 +407,56 @@ class TableFactory {
 void ca_schema_query(Schema* schema,
                      const struct query_statement& stmt);
 
+// Evaluates a query statement on every shard in parallel, and prints the
+// results as if they came from one schema.  Shards must hold disjoint sets of
+// documents, each with its own summaries and postings.  Each shard finds its own highest
+// scoring results, and summaries are read only for the requested page.
+void ca_sharded_query(const std::vector<Schema*>& shards,
+                      const struct query_statement& stmt);
+
+// Prints an estimate of the number of results of `query', from the sketches
+// stored with large posting lists, without decoding them where possible.
+// Shards hold disjoint documents, so their estimates are added up.
+void ca_schema_estimate_count(const std::vector<Schema*>& shards,
+                              const Query* query);
+
 void ca_schema_query_correlate(Schema* schema, const Query* query_A,
                                const Query* query_B);
 
+// Looks up a set of index keys ahead of the statements that use them, in key
+// order, and keeps their decoded posting lists.  While an instance exists,
+// queries on `schema' in the same thread use these lists instead of reading
+// the keys again.  The lists are charged to the memory budget of the thread
+// that creates the instance, if any, which throws if they don't fit, and the
+// constructor checks the deadline of the thread between keys.
+class IndexKeyPrefetch {
+ public:
+  // `keys' are written as in queries, and may contain duplicates.
+  IndexKeyPrefetch(Schema* schema, std::vector<std::string> keys);
+
+  ~IndexKeyPrefetch();
+
+  KJ_DISALLOW_COPY(IndexKeyPrefetch);
+
+  // Returns the posting lists of `key' in `schema', one per index table
+  // containing the key, or nullptr if the key has not been prefetched.
+  static const std::vector<std::vector<ca_offset_score>>* Find(
+      Schema* schema, const char* key);
+
+  // Returns the memory held by the lists prefetched in this thread.
+  static size_t MemoryUsed();
+
+ private:
+  Schema* schema_;
+
+  std::unordered_map<std::string, std::vector<std::vector<ca_offset_score>>>
+      postings_;
+
+  std::unique_ptr<internal::MemoryCharge> memory_;
+
+  IndexKeyPrefetch* previous_;
+};
+
 /*****************************************************************************/
 
 void ca_table_write_offset_score(Table* table,
@@ -332,6 +464,33 @@ void ca_table_write_offset_score(Table* table,
                                  const struct ca_offset_score* values,
                                  size_t count);
 
+// Writes time series values, whose offsets are timestamps, with a skip index
+// for time range lookups.  Readers predating CA_OFFSET_SCORE_SKIP_INDEX can't
+// parse the result; use ca_table_write_offset_score() for them.
+void ca_table_write_time_series(Table* table, const string_view& key,
+                                const struct ca_offset_score* values,
+                                size_t count);
+
+// Optional indexes added by ca_table_write_index().
+enum ca_index_option {
+  // A copy of the values ordered by score, for
+  // ca_offset_score_parse_score_range() and ca_offset_score_parse_top().
+  CA_INDEX_IMPACT = 1 << 0,
+
+  // A skip index over small blocks of values, for looking up the scores of
+  // given offsets with ca_offset_score_lookup().
+  CA_INDEX_DOC_VALUES = 1 << 1,
+
+  // A sketch of the offsets, for estimating result counts.
+  CA_INDEX_SKETCH = 1 << 2,
+};
+
+// Writes index values like ca_table_write_offset_score(), adding the indexes
+// given by `options', a combination of ca_index_option values.
+void ca_table_write_index(Table* table, const string_view& key,
+                          const struct ca_offset_score* values, size_t count,
+                          unsigned int options);
+
 /*****************************************************************************/
 
 void ca_format_integer(uint8_t** output, uint64_t value);
@@ -342,6 +501,32 @@ size_t ca_format_offset_score(uint8_t* output, size_t output_size,
                               const struct ca_offset_score* values,
                               size_t count);
 
+// Returns the maximum size of the output of ca_format_offset_score_indexed().
+size_t ca_offset_score_indexed_size(const struct ca_offset_score* values,
+                                    size_t count, size_t block_size);
+
+// Encodes values like ca_format_offset_score(), but splits values sorted by
+// offset into blocks of `block_size' values behind a skip index, so that
+// ca_offset_score_parse_range() only needs to decode the blocks overlapping
+// the requested range.  Values that are not sorted by offset are encoded
+// without an index.
+size_t ca_format_offset_score_indexed(uint8_t* output, size_t output_size,
+                                      const struct ca_offset_score* values,
+                                      size_t count, size_t block_size);
+
+// Returns the maximum size of the output of ca_format_offset_score_impact().
+size_t ca_offset_score_impact_size(const struct ca_offset_score* values,
+                                   size_t count, size_t bucket_size);
+
+// Encodes a copy of values split into buckets of `bucket_size' values by
+// descending score.  The output must be followed by the values encoded with
+// ca_format_offset_score() or ca_format_offset_score_indexed().  Returns 0
+// without writing anything unless the values have unique, ascending offsets
+// and no NaN scores.
+size_t ca_format_offset_score_impact(uint8_t* output, size_t output_size,
+                                     const struct ca_offset_score* values,
+                                     size_t count, size_t bucket_size);
+
 void ca_format_enable_trace(bool enable);
 
 /*****************************************************************************/
@@ -357,8 +542,47 @@ uint64_t ca_offset_score_max_offset(const uint8_t* begin, const uint8_t* end);
 void ca_offset_score_parse(string_view input,
                            std::vector<ca_offset_score>* output);
 
+// Like ca_offset_score_parse(), but only outputs the values whose offsets are
+// in [min_offset, max_offset].  If the values have a skip index, only the
+// blocks overlapping the range are decoded.
+void ca_offset_score_parse_range(string_view input, uint64_t min_offset,
+                                 uint64_t max_offset,
+                                 std::vector<ca_offset_score>* output);
+
 size_t ca_offset_score_count(const uint8_t* begin, const uint8_t* end);
 
+// Outputs the values with scores in [min_score, max_score], in offset order.
+// If the values have an impact index, only the buckets overlapping the range
+// are decoded.
+void ca_offset_score_parse_score_range(string_view input, double min_score,
+                                       double max_score,
+                                       std::vector<ca_offset_score>* output);
+
+// Outputs at least the `count' values with the highest scores, or all values
+// if there are fewer, in no particular order.  If the values have an impact
+// index, only the buckets with the highest scores are decoded.  Returns the
+// total number of values.
+size_t ca_offset_score_parse_top(string_view input, size_t count,
+                                 std::vector<ca_offset_score>* output);
+
+// Outputs the values whose offsets are in `keys', which must be sorted by
+// offset, in offset order.  If the values have a skip index, only the blocks
+// containing any of the offsets are decoded.  If `summary' is not null, it
+// is set to the count, sum, minimum and maximum of all the values.
+void ca_offset_score_lookup(string_view input, const ca_offset_score* keys,
+                            size_t key_count,
+                            std::vector<ca_offset_score>* output,
+                            ca_offset_score_bucket* summary);
+
+// Adds up the scores of the values with offsets in [min_offset, max_offset],
+// in buckets of offsets that are multiples of `bucket_size', and appends the
+// non-empty buckets to `output' in ascending order.  Blocks behind a skip
+// index that fit in a single bucket are added from their stored summaries
+// without being decoded.
+void ca_offset_score_aggregate(string_view input, uint64_t min_offset,
+                               uint64_t max_offset, uint64_t bucket_size,
+                               std::vector<ca_offset_score_bucket>* output);
+
 /*****************************************************************************/
 
 int ca_table_merge(std::vector<std::unique_ptr<Table>>& tables,
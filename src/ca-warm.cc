@@ -0,0 +1,182 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <kj/debug.h>
+#include <kj/io.h>
+
+#include "src/access-log.h"
+#include "src/thread-pool.h"
+#include "src/util.h"
+
+namespace ca_table = cantera::table;
+
+namespace {
+
+enum Option {
+  kOptionJobs = 'j',
+  kOptionLimit = 'l',
+};
+
+int print_version;
+int print_help;
+int verbose;
+
+struct option kLongOptions[] = {
+    {"jobs", required_argument, nullptr, kOptionJobs},
+    {"limit", required_argument, nullptr, kOptionLimit},
+    {"verbose", no_argument, &verbose, 1},
+    {"version", no_argument, &print_version, 1},
+    {"help", no_argument, &print_help, 1},
+    {nullptr, 0, nullptr, 0}};
+
+struct Block {
+  int fd;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t count;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) try {
+  size_t jobs = std::max(std::thread::hardware_concurrency(), 1U);
+  uint64_t limit = 0;
+  int i;
+
+  while ((i = getopt_long(argc, argv, "j:l:", kLongOptions, 0)) != -1) {
+    switch (i) {
+      case 0:
+        break;
+
+      case kOptionJobs:
+        jobs = ca_table::internal::StringToUInt64(optarg);
+        if (!jobs) errx(EX_USAGE, "Job count must be positive");
+        break;
+
+      case kOptionLimit:
+        limit = ca_table::internal::StringToUInt64(optarg);
+        break;
+
+      case '?':
+        errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
+    }
+  }
+
+  if (print_help) {
+    printf(
+        "Usage: %s [OPTION]... TABLE...\n"
+        "\n"
+        "Reads the most frequently accessed blocks of each TABLE into the\n"
+        "page cache, hottest first.  Block access counts are recorded in\n"
+        "TABLE.access by programs run with CA_TABLE_ACCESS_SAMPLE=N in the\n"
+        "environment.\n"
+        "\n"
+        "  -j, --jobs=N           number of parallel reads [number of CPUs]\n"
+        "  -l, --limit=BYTES      stop after reading BYTES [no limit]\n"
+        "      --verbose          print a summary when done\n"
+        "      --help     display this help and exit\n"
+        "      --version  display version information\n"
+        "\n"
+        "Report bugs to <morten.hustveit@gmail.com>\n",
+        argv[0]);
+
+    return EXIT_SUCCESS;
+  }
+
+  if (print_version) {
+    fprintf(stdout, "%s\n", PACKAGE_STRING);
+
+    return EXIT_SUCCESS;
+  }
+
+  if (optind == argc)
+    errx(EX_USAGE, "Usage: %s [OPTION]... TABLE...", argv[0]);
+
+  std::vector<kj::AutoCloseFd> files;
+  std::vector<Block> blocks;
+
+  for (i = optind; i < argc; ++i) {
+    const auto log = ca_table::internal::ReadAccessLog(
+        ca_table::internal::AccessLogPath(argv[i]));
+    if (log.empty()) {
+      if (verbose) fprintf(stderr, "%s: no access log\n", argv[i]);
+      continue;
+    }
+
+    files.emplace_back(
+        ca_table::internal::OpenFile(argv[i], O_RDONLY | O_CLOEXEC));
+    const auto fd = files.back().get();
+
+    struct stat st;
+    KJ_SYSCALL(fstat(fd, &st), argv[i]);
+
+    for (const auto& access : log) {
+      // Skip blocks beyond the end of the file, in case the table has been
+      // replaced since the log was written.
+      if (access.offset + access.size > static_cast<uint64_t>(st.st_size))
+        continue;
+      blocks.push_back(Block{fd, access.offset, access.size, access.count});
+    }
+  }
+
+  std::stable_sort(
+      blocks.begin(), blocks.end(),
+      [](const Block& lhs, const Block& rhs) { return lhs.count > rhs.count; });
+
+  if (limit) {
+    uint64_t total = 0;
+    auto end = blocks.begin();
+    while (end != blocks.end() && total + end->size <= limit)
+      total += (end++)->size;
+    blocks.erase(end, blocks.end());
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::atomic<uint64_t> bytes_read{0};
+
+  // Blocks are claimed in order, so the hottest blocks are read first even
+  // though several reads are in flight.
+  ca_table::internal::ThreadPool thread_pool(jobs - 1);
+  thread_pool.ParallelFor(0, blocks.size(), 1, [&blocks, &bytes_read](
+                                                   size_t begin, size_t end) {
+    std::vector<char> buffer;
+    for (auto j = begin; j != end; ++j) {
+      const auto& block = blocks[j];
+      buffer.resize(block.size);
+      ca_table::internal::ReadWithOffset(block.fd, buffer.data(), block.size,
+                                         block.offset);
+      bytes_read += block.size;
+    }
+  });
+
+  if (verbose) {
+    const auto elapsed = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    fprintf(stderr, "Read %zu blocks, %llu bytes in %.3f seconds\n",
+            blocks.size(), static_cast<unsigned long long>(bytes_read.load()),
+            elapsed);
+  }
+} catch (kj::Exception e) {
+  KJ_LOG(FATAL, e);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,207 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/cas-cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <kj/debug.h>
+#include <kj/io.h>
+
+#include "src/util.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+// Checks whether a string may be a valid domain name.
+bool IsValidDomainName(const std::string& name) {
+  if (name.size() < 3) return false;
+
+  if (name[0] == '.' || name.back() == '.') return false;
+
+  return true;
+}
+
+// Returns true if `key' can be used as a file name as is.
+bool IsSafeFileName(const std::string& key) {
+  return !key.empty() && key.size() < 256 &&
+         std::all_of(key.begin(), key.end(), [](char ch) {
+           return std::isalnum(static_cast<unsigned char>(ch)) || ch == '-' ||
+                  ch == '_';
+         });
+}
+
+size_t NamesSize(const std::vector<CASName>& names) {
+  auto result = sizeof(names);
+  for (const auto& name : names) {
+    result += sizeof(name) + name.name.size() + name.header.size() +
+              name.header_key.size();
+  }
+  return result;
+}
+
+}  // namespace
+
+std::vector<CASName> ParseCASNames(const string_view& data) {
+  std::vector<CASName> result;
+  std::unordered_set<std::string> seen;
+
+  std::string name, header, header_key;
+
+  auto add_name = [&result, &seen, &header, &header_key](std::string name) {
+    if (HasPrefix(name, "www.")) name.erase(0, 4);
+    if (!IsValidDomainName(name) || !seen.emplace(name).second) return;
+    result.push_back(CASName{std::move(name), header, header_key});
+  };
+
+  bool in_header = false;
+  size_t header_idx = 0;
+  for (auto ch : data) {
+    if (in_header) {
+      if (std::isalnum(ch) || strchr(" .,_&-", ch)) {
+        header.push_back(ch);
+      } else if (ch == '}') {
+        header_key = StringPrintf("%06zu", header_idx++);
+        in_header = false;
+      } else {
+        header.clear();
+        in_header = false;
+      }
+    } else if (ch == '{') {
+      in_header = true;
+      header.clear();
+    } else if (std::isalnum(ch) || ch == '.' || ch == '-') {
+      name.push_back(std::tolower(ch));
+    } else if (!name.empty()) {
+      add_name(std::move(name));
+      name.clear();
+    }
+  }
+  if (!name.empty()) add_name(std::move(name));
+
+  return result;
+}
+
+CASCache::CASCache(FetchFunction fetch, size_t memory_limit,
+                   std::string directory, size_t fetch_threads)
+    : fetch_(std::move(fetch)),
+      memory_limit_(memory_limit),
+      directory_(std::move(directory)),
+      thread_pool_(std::max(fetch_threads, size_t(1)) - 1) {}
+
+std::vector<std::shared_ptr<const std::vector<CASName>>> CASCache::Get(
+    const std::vector<std::string>& keys) {
+  std::vector<std::shared_ptr<const std::vector<CASName>>> result;
+  std::vector<size_t> missing;
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    result.emplace_back(Find(keys[i]));
+    if (!result.back()) missing.emplace_back(i);
+  }
+
+  // The calling thread fetches too, so a single object is fetched without
+  // involving the thread pool.
+  thread_pool_.ParallelFor(
+      0, missing.size(), 1,
+      [this, &keys, &missing, &result](size_t begin, size_t end) {
+        for (auto i = begin; i != end; ++i) {
+          const auto& key = keys[missing[i]];
+          auto names = std::make_shared<const std::vector<CASName>>(
+              ParseCASNames(Load(key)));
+          Insert(key, names);
+          result[missing[i]] = std::move(names);
+        }
+      });
+
+  return result;
+}
+
+std::shared_ptr<const std::vector<CASName>> CASCache::Find(
+    const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto i = entries_.find(key);
+  if (i == entries_.end()) return nullptr;
+
+  lru_.splice(lru_.begin(), lru_, i->second.lru_position);
+
+  return i->second.names;
+}
+
+void CASCache::Insert(const std::string& key,
+                      std::shared_ptr<const std::vector<CASName>> names) {
+  const auto size = NamesSize(*names);
+  if (size > memory_limit_) return;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Another thread may have fetched the same object.
+  if (entries_.count(key)) return;
+
+  lru_.emplace_front(key);
+  entries_.emplace(key, Entry{std::move(names), size, lru_.begin()});
+  memory_used_ += size;
+
+  while (memory_used_ > memory_limit_) {
+    auto i = entries_.find(lru_.back());
+    memory_used_ -= i->second.size;
+    entries_.erase(i);
+    lru_.pop_back();
+  }
+}
+
+std::string CASCache::Load(const std::string& key) {
+  if (directory_.empty() || !IsSafeFileName(key)) return fetch_(key);
+
+  const auto path = directory_ + "/" + key;
+
+  const auto raw_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (raw_fd != -1) {
+    kj::AutoCloseFd fd(raw_fd);
+
+    struct stat st;
+    KJ_SYSCALL(fstat(fd, &st), path);
+
+    std::string result(st.st_size, '\0');
+    if (!result.empty()) ReadWithOffset(fd, &result[0], result.size(), 0);
+    return result;
+  }
+
+  if (errno != ENOENT) KJ_FAIL_SYSCALL("open", errno, path);
+
+  auto result = fetch_(key);
+
+  // Files appear complete or not at all, since they are written under
+  // another name first.  Failing to store one must not make the query fail.
+  try {
+    auto fd = AnonTemporaryFile(directory_.c_str());
+    for (size_t offset = 0; offset < result.size();) {
+      ssize_t ret;
+      KJ_SYSCALL(ret = pwrite(fd, result.data() + offset,
+                              result.size() - offset, offset),
+                 path);
+      offset += ret;
+    }
+    LinkAnonTemporaryFile(fd, path.c_str());
+  } catch (kj::Exception e) {
+    KJ_LOG(WARNING, "failed to store CAS object", path, e);
+  }
+
+  return result;
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
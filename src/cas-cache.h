@@ -0,0 +1,95 @@
+#ifndef CA_TABLE_CAS_CACHE_H_
+#define CA_TABLE_CAS_CACHE_H_ 1
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <kj/common.h>
+
+#include "src/ca-table.h"
+#include "src/thread-pool.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// A DNS name listed in a CAS object, with the "{HEADER}" it appeared under.
+struct CASName {
+  std::string name;
+  std::string header;
+  // Orders headers by their first appearance.
+  std::string header_key;
+};
+
+// Extracts the DNS names from a CAS object, in order of first appearance,
+// without "www." prefixes and duplicates.
+std::vector<CASName> ParseCASNames(const string_view& data);
+
+// Caches the DNS names of CAS objects, for "FIELD-in:KEY" keywords.  A CAS
+// key identifies the content of its object, so entries never go stale.
+//
+// The most recently used lists are kept in memory, up to a total size.  If a
+// directory is given, fetched objects are also stored there as files named
+// by their keys, which survive restarts and are shared between processes.
+class CASCache {
+ public:
+  // Fetches an object.  Called from several threads at once.
+  using FetchFunction = std::function<std::string(const std::string& key)>;
+
+  CASCache(FetchFunction fetch, size_t memory_limit,
+           std::string directory = std::string(), size_t fetch_threads = 8);
+
+  KJ_DISALLOW_COPY(CASCache);
+
+  // Returns the names in each of the given objects.  Objects missing from
+  // the cache are fetched in parallel.  Safe to call from any thread.
+  std::vector<std::shared_ptr<const std::vector<CASName>>> Get(
+      const std::vector<std::string>& keys);
+
+  std::shared_ptr<const std::vector<CASName>> Get(const std::string& key) {
+    return Get(std::vector<std::string>{key}).front();
+  }
+
+ private:
+  struct Entry {
+    std::shared_ptr<const std::vector<CASName>> names;
+    size_t size;
+    // Position in `lru_'.
+    std::list<std::string>::iterator lru_position;
+  };
+
+  // Returns the cached names of `key', or nullptr.
+  std::shared_ptr<const std::vector<CASName>> Find(const std::string& key);
+
+  void Insert(const std::string& key,
+              std::shared_ptr<const std::vector<CASName>> names);
+
+  // Returns the object from the directory, or from `fetch_', in which case it
+  // is added to the directory.
+  std::string Load(const std::string& key);
+
+  const FetchFunction fetch_;
+  const size_t memory_limit_;
+  const std::string directory_;
+
+  ThreadPool thread_pool_;
+
+  std::mutex mutex_;
+
+  // Keys, most recently used first.
+  std::list<std::string> lru_;
+  std::unordered_map<std::string, Entry> entries_;
+  size_t memory_used_ = 0;
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !CA_TABLE_CAS_CACHE_H_
@@ -0,0 +1,142 @@
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "src/cas-cache.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace cantera::table::internal;
+
+namespace {
+
+// Stands in for a CAS server, counting the objects fetched.
+struct FakeCAS {
+  std::string operator()(const std::string& key) {
+    ++fetches;
+    std::lock_guard<std::mutex> lock(mutex);
+    return objects.at(key);
+  }
+
+  std::map<std::string, std::string> objects;
+  std::atomic<size_t> fetches{0};
+  std::mutex mutex;
+};
+
+}  // namespace
+
+struct CASCacheTest : testing::Test {};
+
+TEST_F(CASCacheTest, ParseNames) {
+  const auto names = ParseCASNames(
+      "www.Example.com, example.com\n{Partners}\nfoo.org bar.net x {Bad!\n"
+      "{Other} a.b.c");
+
+  ASSERT_EQ(4U, names.size());
+
+  EXPECT_EQ("example.com", names[0].name);
+  EXPECT_EQ("", names[0].header);
+
+  EXPECT_EQ("foo.org", names[1].name);
+  EXPECT_EQ("Partners", names[1].header);
+  EXPECT_EQ("000000", names[1].header_key);
+
+  EXPECT_EQ("bar.net", names[2].name);
+  EXPECT_EQ("Partners", names[2].header);
+
+  EXPECT_EQ("a.b.c", names[3].name);
+  EXPECT_EQ("Other", names[3].header);
+  EXPECT_EQ("000001", names[3].header_key);
+}
+
+TEST_F(CASCacheTest, FetchesOnce) {
+  FakeCAS cas;
+  cas.objects["a"] = "one.com two.com";
+  cas.objects["b"] = "three.com";
+
+  CASCache cache([&cas](const std::string& key) { return cas(key); },
+                 1 << 20);
+
+  EXPECT_EQ(2U, cache.Get("a")->size());
+  EXPECT_EQ(2U, cache.Get("a")->size());
+  EXPECT_EQ(1U, cas.fetches);
+
+  const auto lists = cache.Get({"a", "b", "a"});
+  ASSERT_EQ(3U, lists.size());
+  EXPECT_EQ("one.com", lists[0]->front().name);
+  EXPECT_EQ("three.com", lists[1]->front().name);
+  EXPECT_EQ(lists[0], lists[2]);
+  EXPECT_EQ(2U, cas.fetches);
+}
+
+TEST_F(CASCacheTest, ParallelFetch) {
+  FakeCAS cas;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < 100; ++i) {
+    keys.emplace_back("key" + std::to_string(i));
+    cas.objects[keys.back()] = "host" + std::to_string(i) + ".com";
+  }
+
+  CASCache cache([&cas](const std::string& key) { return cas(key); },
+                 1 << 20, std::string(), 4);
+
+  const auto lists = cache.Get(keys);
+  ASSERT_EQ(keys.size(), lists.size());
+  for (size_t i = 0; i < keys.size(); ++i)
+    EXPECT_EQ("host" + std::to_string(i) + ".com", lists[i]->front().name);
+  EXPECT_EQ(keys.size(), cas.fetches);
+}
+
+TEST_F(CASCacheTest, EvictsLeastRecentlyUsed) {
+  FakeCAS cas;
+  for (const auto key : {"a", "b", "c"})
+    cas.objects[key] = std::string(key) + std::string(1000, 'x') + ".com";
+
+  // Room for two lists.
+  CASCache cache([&cas](const std::string& key) { return cas(key); }, 2500);
+
+  cache.Get("a");
+  cache.Get("b");
+  cache.Get("a");
+  cache.Get("c");
+  EXPECT_EQ(3U, cas.fetches);
+
+  cache.Get("a");
+  EXPECT_EQ(3U, cas.fetches);
+
+  cache.Get("b");
+  EXPECT_EQ(4U, cas.fetches);
+}
+
+TEST_F(CASCacheTest, Directory) {
+  char directory[] = "/tmp/cas-cache-test-XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(directory));
+
+  FakeCAS cas;
+  cas.objects["abc123"] = "example.com";
+  cas.objects["../escape"] = "example.org";
+
+  {
+    CASCache cache([&cas](const std::string& key) { return cas(key); }, 0,
+                   directory);
+    EXPECT_EQ("example.com", cache.Get("abc123")->front().name);
+    EXPECT_EQ("example.org", cache.Get("../escape")->front().name);
+    EXPECT_EQ(2U, cas.fetches);
+  }
+
+  // A new cache finds the object in the directory.  Keys that are not safe
+  // file names are never stored.
+  CASCache cache([&cas](const std::string& key) { return cas(key); }, 0,
+                 directory);
+  EXPECT_EQ("example.com", cache.Get("abc123")->front().name);
+  EXPECT_EQ(2U, cas.fetches);
+  EXPECT_EQ("example.org", cache.Get("../escape")->front().name);
+  EXPECT_EQ(3U, cas.fetches);
+
+  EXPECT_EQ(0, unlink((std::string(directory) + "/abc123").c_str()));
+  EXPECT_EQ(0, rmdir(directory));
+}
@@ -10,7 +10,10 @@
 #include <mutex>
 
 #include "src/ca-table.h"
+#include "src/deadline.h"
 #include "src/keywords.h"
+#include "src/memory-budget.h"
+#include "src/output-buffer.h"
 #include "src/query.h"
 #include "src/thread-pool.h"
 #include "src/util.h"
@@ -136,13 +139,20 @@ void ProcessRange(const string_view& key,
   // Cutoff at >55% and <45%.
   if (std::fabs(log_odds) < std::log(.55 / (1.0 - .55))) return;
 
-  std::unique_lock<std::mutex> lk(output_mutex);
-
   KJ_REQUIRE(match_count_A > 0 || match_count_B > 0, match_count_A,
              match_count_B);
 
-  printf("%.3f\t%zu\t%zu\t%.*s", log_odds, match_count_A, match_count_B,
-         static_cast<int>(key.size()), key.data());
+  // The line is formatted before taking the output lock, and written with a
+  // single call.
+  char buffer[32 + 2 * kMaxIntegerLength];
+  auto o = buffer + snprintf(buffer, 32, "%.3f\t", log_odds);
+  o = FormatUInt64(o, match_count_A);
+  *o++ = '\t';
+  o = FormatUInt64(o, match_count_B);
+  *o++ = '\t';
+
+  std::string line(buffer, o);
+  line.append(key.data(), key.size());
 
   std::string min_score_string, max_score_string;
   if (!Keywords::GetInstance().IsTimestamped(key)) {
@@ -161,16 +171,18 @@ void ProcessRange(const string_view& key,
   // Print range operator, if applicable.
   if (std::isfinite(min_score)) {
     if (std::isfinite(max_score)) {
-      printf("[%s,%s]", min_score_string.c_str(), max_score_string.c_str());
+      line += "[" + min_score_string + "," + max_score_string + "]";
     } else {
-      printf("≥%s", min_score_string.c_str());
+      line += "≥" + min_score_string;
     }
   } else if (std::isfinite(max_score)) {
-    printf("≤%s", max_score_string.c_str());
+    line += "≤" + max_score_string;
   }
 
-  putchar('\n');
+  line.push_back('\n');
 
+  std::unique_lock<std::mutex> lk(output_mutex);
+  fwrite(line.data(), 1, line.size(), stdout);
   fflush(stdout);
 }
 
@@ -487,8 +499,12 @@ void ca_schema_query_correlate(Schema* schema, const Query* query_A,
 
   std::vector<ca_offset_score> offsets_A, offsets_B;
 
+  MemoryCharge memory_A, memory_B;
+
   ProcessQuery(offsets_A, query_A, schema, false, false);
+  memory_A.Set(offsets_A);
   ProcessQuery(offsets_B, query_B, schema, false, false);
+  memory_B.Set(offsets_B);
 
   offsets_B.resize(SubtractOffsets(&offsets_B[0], offsets_B.size(),
                                              &offsets_A[0], offsets_A.size()));
@@ -514,12 +530,19 @@ void ca_schema_query_correlate(Schema* schema, const Query* query_A,
 
   const auto now = time(nullptr) / 86400.0f;
 
+  // Mutex controlling access to stdout.
+  std::mutex output_mutex;
+
+  // Tasks still queued when the statement times out return immediately.
+  const auto deadline = Deadline::Current();
+
   ThreadPool thread_pool;
 
-  std::vector<ca_offset_score> key_offsets;
+  // The queued tasks refer to the variables above, so they must finish before
+  // those are destroyed, also if the statement fails.
+  KJ_DEFER(thread_pool.Wait());
 
-  // Mutex controlling access to stdout.
-  std::mutex output_mutex;
+  std::vector<ca_offset_score> key_offsets;
 
   for (auto& index_table : schema->IndexTables()) {
     index_table->SeekToFirst();
@@ -527,6 +550,8 @@ void ca_schema_query_correlate(Schema* schema, const Query* query_A,
     string_view key, data;
 
     while (index_table->ReadRow(key, data)) {
+      CheckDeadline();
+
       if (a_is_timestamped && keywords.IsEphemeral(key)) continue;
 
       key_offsets.clear();
@@ -548,8 +573,11 @@ void ca_schema_query_correlate(Schema* schema, const Query* query_A,
         a_is_timestamped,
         b_is_timestamped,
         now,
-        &output_mutex
+        &output_mutex,
+        deadline
       ]() mutable {
+        if (deadline && deadline->Expired()) return;
+
         if (a_is_timestamped && keywords.IsTimestamped(key)) {
           if (b_is_timestamped)
             FilterByTimestamp(key_offsets, offsets_A, offsets_B);
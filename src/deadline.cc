@@ -0,0 +1,57 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/deadline.h"
+
+#include <kj/debug.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+thread_local Deadline* current_deadline;
+
+}  // namespace
+
+Deadline::Scope::Scope(Deadline* deadline) : previous_(current_deadline) {
+  current_deadline = deadline;
+}
+
+Deadline::Scope::~Scope() { current_deadline = previous_; }
+
+Deadline::Deadline(Clock::duration timeout)
+    : timeout_(timeout),
+      end_(timeout.count() ? Clock::now() + timeout
+                           : Clock::time_point::max()) {}
+
+bool Deadline::Expired() {
+  if (expired_.load(std::memory_order_relaxed)) return true;
+
+  if (!timeout_.count() || Clock::now() < end_) return false;
+
+  expired_ = true;
+
+  return true;
+}
+
+void Deadline::Check() {
+  if (!Expired()) return;
+
+  if (timeout_.count() && Clock::now() >= end_) {
+    KJ_FAIL_REQUIRE(
+        "statement timed out",
+        std::chrono::duration_cast<std::chrono::milliseconds>(timeout_)
+            .count());
+  }
+
+  KJ_FAIL_REQUIRE("statement cancelled");
+}
+
+Deadline* Deadline::Current() { return current_deadline; }
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
@@ -0,0 +1,71 @@
+#ifndef CA_TABLE_DEADLINE_H_
+#define CA_TABLE_DEADLINE_H_ 1
+
+#include <atomic>
+#include <chrono>
+
+#include <kj/common.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// Bounds the running time of a statement.  Long-running loops call
+// CheckDeadline() between units of work, which throws once the statement has
+// run out of time or been cancelled, so that it unwinds and releases what it
+// holds.  Safe to use from several threads at once.
+class Deadline {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Makes `deadline' the one checked by CheckDeadline() in this thread, until
+  // destroyed.
+  class Scope {
+   public:
+    explicit Scope(Deadline* deadline);
+    ~Scope();
+
+    KJ_DISALLOW_COPY(Scope);
+
+   private:
+    Deadline* previous_;
+  };
+
+  // A timeout of zero means no timeout.
+  explicit Deadline(Clock::duration timeout);
+
+  KJ_DISALLOW_COPY(Deadline);
+
+  // Makes every later check fail.  May be called from any thread.
+  void Cancel() { expired_ = true; }
+
+  // Returns true if the statement has run out of time or been cancelled.
+  bool Expired();
+
+  // Throws if Expired() is true.
+  void Check();
+
+  // Becomes true once Expired() is, for ThreadPool::ParallelFor().
+  const std::atomic<bool>* expired_flag() const { return &expired_; }
+
+  // Returns the deadline of this thread, or nullptr.
+  static Deadline* Current();
+
+ private:
+  const Clock::duration timeout_;
+  const Clock::time_point end_;
+
+  std::atomic<bool> expired_{false};
+};
+
+// Throws if the statement running in this thread has run out of time.  Cheap
+// enough to call for every block of postings.
+inline void CheckDeadline() {
+  if (const auto deadline = Deadline::Current()) deadline->Check();
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !CA_TABLE_DEADLINE_H_
@@ -0,0 +1,71 @@
+#include <chrono>
+#include <thread>
+
+#include <kj/exception.h>
+
+#include "src/deadline.h"
+#include "src/thread-pool.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace cantera::table::internal;
+using namespace std::chrono_literals;
+
+struct DeadlineTest : testing::Test {};
+
+TEST_F(DeadlineTest, NoTimeout) {
+  Deadline deadline(Deadline::Clock::duration::zero());
+
+  EXPECT_FALSE(deadline.Expired());
+  deadline.Check();
+
+  deadline.Cancel();
+  EXPECT_TRUE(deadline.Expired());
+  EXPECT_THROW(deadline.Check(), kj::Exception);
+}
+
+TEST_F(DeadlineTest, Timeout) {
+  Deadline deadline(10ms);
+
+  deadline.Check();
+  EXPECT_FALSE(*deadline.expired_flag());
+
+  std::this_thread::sleep_for(20ms);
+
+  EXPECT_THROW(deadline.Check(), kj::Exception);
+  EXPECT_TRUE(*deadline.expired_flag());
+}
+
+TEST_F(DeadlineTest, Scope) {
+  Deadline deadline(Deadline::Clock::duration::zero());
+
+  // Without a deadline, checks never fail.
+  CheckDeadline();
+
+  {
+    Deadline::Scope scope(&deadline);
+    EXPECT_EQ(&deadline, Deadline::Current());
+
+    CheckDeadline();
+    deadline.Cancel();
+    EXPECT_THROW(CheckDeadline(), kj::Exception);
+  }
+
+  EXPECT_EQ(nullptr, Deadline::Current());
+  CheckDeadline();
+}
+
+TEST_F(DeadlineTest, CancelsParallelFor) {
+  ThreadPool thread_pool(4);
+  Deadline deadline(Deadline::Clock::duration::zero());
+
+  std::atomic<size_t> chunks{0};
+  thread_pool.ParallelFor(0, 1000, 1,
+                          [&deadline, &chunks](size_t, size_t) {
+                            if (++chunks == 10) deadline.Cancel();
+                          },
+                          deadline.expired_flag());
+
+  // Chunks that had started before the cancellation still finish.
+  EXPECT_LE(10U, chunks);
+  EXPECT_GT(1000U, chunks);
+}
@@ -2,12 +2,14 @@
 #include "config.h"
 #endif
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstdarg>
 #include <cstring>
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 #include <kj/debug.h>
 
@@ -21,6 +23,9 @@ namespace table {
 
 namespace {
 
+// Maximum size of an integer encoded by ca_format_integer().
+const size_t kMaxVarintSize = 10;
+
 template <typename T>
 T GCD(T a, T b) {
   while (b) {
@@ -318,5 +323,157 @@ size_t ca_format_offset_score(uint8_t* output, size_t output_size,
   return output - start;
 }
 
+size_t ca_offset_score_indexed_size(const struct ca_offset_score* values,
+                                    size_t count, size_t block_size) {
+  KJ_REQUIRE(block_size > 0);
+  const auto block_count = (count + block_size - 1) / block_size;
+
+  // Type, block count, and the offsets, size, count and summary of each
+  // block, followed by the blocks.
+  return 1 + kMaxVarintSize * (1 + 4 * block_count) +
+         block_count * (2 * sizeof(float) + sizeof(double)) +
+         block_count * ca_offset_score_size(values, 0) +
+         ca_offset_score_size(values, count);
+}
+
+size_t ca_format_offset_score_indexed(uint8_t* output, size_t output_size,
+                                      const struct ca_offset_score* values,
+                                      size_t count, size_t block_size) {
+  KJ_REQUIRE(block_size > 0);
+
+  const auto sorted = std::is_sorted(
+      values, values + count,
+      [](const auto& lhs, const auto& rhs) { return lhs.offset < rhs.offset; });
+
+  if (count <= block_size || !sorted)
+    return ca_format_offset_score(output, output_size, values, count);
+
+  const auto block_count = (count + block_size - 1) / block_size;
+
+  // The header size depends on the block sizes, so encode the blocks first.
+  std::vector<uint8_t> blocks(output_size);
+  std::vector<size_t> block_sizes;
+  size_t blocks_size = 0;
+
+  for (size_t i = 0; i < count; i += block_size) {
+    const auto n = std::min(block_size, count - i);
+    const auto size = ca_format_offset_score(
+        &blocks[blocks_size], blocks.size() - blocks_size, values + i, n);
+    block_sizes.push_back(size);
+    blocks_size += size;
+  }
+
+  uint8_t* o = output;
+  *o++ = CA_OFFSET_SCORE_SKIP_INDEX;
+  ca_format_integer(&o, block_count);
+
+  uint64_t prev_offset = 0;
+  for (size_t i = 0; i < block_count; ++i) {
+    const auto block = values + i * block_size;
+    const auto n = std::min(block_size, count - i * block_size);
+
+    double sum = 0.0;
+    float min = block[0].score, max = block[0].score;
+    for (size_t j = 0; j < n; ++j) {
+      sum += block[j].score;
+      min = std::min(min, block[j].score);
+      max = std::max(max, block[j].score);
+    }
+
+    ca_format_integer(&o, block[0].offset - prev_offset);
+    ca_format_integer(&o, block[n - 1].offset - block[0].offset);
+    ca_format_integer(&o, block_sizes[i]);
+    ca_format_integer(&o, n);
+    EncodeFloat(o, min);
+    EncodeFloat(o, max);
+    memcpy(o, &sum, sizeof(sum));
+    o += sizeof(sum);
+
+    prev_offset = block[0].offset;
+  }
+
+  KJ_REQUIRE(o + blocks_size <= output + output_size);
+  memcpy(o, blocks.data(), blocks_size);
+
+  return o + blocks_size - output;
+}
+
+size_t ca_offset_score_impact_size(const struct ca_offset_score* values,
+                                   size_t count, size_t bucket_size) {
+  KJ_REQUIRE(bucket_size > 0);
+  const auto bucket_count = (count + bucket_size - 1) / bucket_size;
+
+  // Type, value count, bucket count, and the score range and size of each
+  // bucket, followed by the buckets.
+  return 1 + kMaxVarintSize * (2 + bucket_count) +
+         bucket_count * 2 * sizeof(float) +
+         bucket_count * ca_offset_score_size(values, 0) +
+         ca_offset_score_size(values, count);
+}
+
+size_t ca_format_offset_score_impact(uint8_t* output, size_t output_size,
+                                     const struct ca_offset_score* values,
+                                     size_t count, size_t bucket_size) {
+  KJ_REQUIRE(bucket_size > 0);
+
+  bool eligible = count > bucket_size;
+  for (size_t i = 0; eligible && i < count; ++i) {
+    if (std::isnan(values[i].score) ||
+        (i > 0 && values[i].offset <= values[i - 1].offset))
+      eligible = false;
+  }
+
+  if (!eligible) return 0;
+
+  std::vector<ca_offset_score> by_score(values, values + count);
+  std::stable_sort(
+      by_score.begin(), by_score.end(),
+      [](const auto& lhs, const auto& rhs) { return lhs.score > rhs.score; });
+
+  const auto bucket_count = (count + bucket_size - 1) / bucket_size;
+
+  std::vector<uint8_t> buckets(output_size);
+  std::vector<size_t> bucket_sizes;
+  size_t buckets_size = 0;
+
+  for (size_t i = 0; i < count; i += bucket_size) {
+    const auto bucket_begin = by_score.begin() + i;
+    const auto bucket_end = bucket_begin + std::min(bucket_size, count - i);
+    std::sort(bucket_begin, bucket_end, [](const auto& lhs, const auto& rhs) {
+      return lhs.offset < rhs.offset;
+    });
+
+    const auto size = ca_format_offset_score(
+        &buckets[buckets_size], buckets.size() - buckets_size, &*bucket_begin,
+        bucket_end - bucket_begin);
+    bucket_sizes.push_back(size);
+    buckets_size += size;
+  }
+
+  uint8_t* o = output;
+  *o++ = CA_OFFSET_SCORE_IMPACT_INDEX;
+  ca_format_integer(&o, count);
+  ca_format_integer(&o, bucket_count);
+
+  for (size_t i = 0; i < bucket_count; ++i) {
+    const auto bucket_begin = by_score.begin() + i * bucket_size;
+    const auto bucket_end =
+        bucket_begin + std::min(bucket_size, count - i * bucket_size);
+    const auto minmax = std::minmax_element(
+        bucket_begin, bucket_end, [](const auto& lhs, const auto& rhs) {
+          return lhs.score < rhs.score;
+        });
+
+    EncodeFloat(o, minmax.first->score);
+    EncodeFloat(o, minmax.second->score);
+    ca_format_integer(&o, bucket_sizes[i]);
+  }
+
+  KJ_REQUIRE(o + buckets_size <= output + output_size);
+  memcpy(o, buckets.data(), buckets_size);
+
+  return o + buckets_size - output;
+}
+
 }  // namespace table
 }  // namespace cantera
@@ -218,3 +218,241 @@ TEST_F(FormatTest, SingleValue) {
 
   ValidateValues(&value, 1);
 }
+
+TEST_F(FormatTest, SkipIndex) {
+  static const size_t kValueCount = 5000;
+  static const size_t kBlockSize = 64;
+  std::vector<ca_offset_score> values;
+
+  // Duplicate offsets at block boundaries must not be lost.
+  for (size_t i = 0; i < kValueCount; ++i)
+    values.emplace_back(1000000 + (i / 2) * 60, static_cast<float>(i % 17));
+
+  std::vector<uint8_t> data(
+      ca_offset_score_indexed_size(values.data(), values.size(), kBlockSize));
+  data.resize(ca_format_offset_score_indexed(data.data(), data.size(),
+                                             values.data(), values.size(),
+                                             kBlockSize));
+  ASSERT_EQ(CA_OFFSET_SCORE_SKIP_INDEX, data[0]);
+
+  const cantera::string_view input{reinterpret_cast<const char*>(data.data()),
+                                   data.size()};
+
+  std::vector<ca_offset_score> parsed;
+  ca_offset_score_parse(input, &parsed);
+  ASSERT_EQ(values.size(), parsed.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(values[i].offset, parsed[i].offset);
+    EXPECT_EQ(values[i].score, parsed[i].score);
+  }
+
+  EXPECT_EQ(values.size(), ca_offset_score_count(&data[0], &data[data.size()]));
+  EXPECT_EQ(values.back().offset,
+            ca_offset_score_max_offset(&data[0], &data[data.size()]));
+
+  for (const auto& range :
+       {std::make_pair(0UL, 999999UL), std::make_pair(0UL, 1000000UL),
+        std::make_pair(1000060UL, 1000060UL + 60 * 32),
+        std::make_pair(1001920UL, 1003000UL),
+        std::make_pair(1100000UL, 9999999UL)}) {
+    std::vector<ca_offset_score> expected;
+    for (const auto& value : values) {
+      if (value.offset >= range.first && value.offset <= range.second)
+        expected.emplace_back(value);
+    }
+
+    parsed.clear();
+    ca_offset_score_parse_range(input, range.first, range.second, &parsed);
+    ASSERT_EQ(expected.size(), parsed.size()) << range.first;
+    for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(expected[i].offset, parsed[i].offset);
+      EXPECT_EQ(expected[i].score, parsed[i].score);
+    }
+  }
+}
+
+TEST_F(FormatTest, Aggregate) {
+  static const size_t kValueCount = 5000;
+  static const size_t kBlockSize = 64;
+  std::vector<ca_offset_score> values;
+
+  for (size_t i = 0; i < kValueCount; ++i)
+    values.emplace_back(1000000 + (i / 2) * 60, static_cast<float>(i % 17));
+
+  std::vector<uint8_t> indexed(
+      ca_offset_score_indexed_size(values.data(), values.size(), kBlockSize));
+  indexed.resize(ca_format_offset_score_indexed(indexed.data(), indexed.size(),
+                                                values.data(), values.size(),
+                                                kBlockSize));
+
+  std::vector<uint8_t> plain(
+      ca_offset_score_size(values.data(), values.size()));
+  plain.resize(ca_format_offset_score(plain.data(), plain.size(),
+                                      values.data(), values.size()));
+
+  for (const auto bucket_size : {1UL, 60UL, 3600UL, 86400UL}) {
+    for (const auto& range : {std::make_pair(0UL, 9999999UL),
+                              std::make_pair(1001000UL, 1100000UL)}) {
+      std::vector<ca_offset_score_bucket> expected;
+      for (const auto& value : values) {
+        if (value.offset < range.first || value.offset > range.second)
+          continue;
+        const auto offset = value.offset - value.offset % bucket_size;
+        if (expected.empty() || expected.back().offset != offset) {
+          expected.emplace_back();
+          expected.back().offset = offset;
+        }
+        auto& bucket = expected.back();
+        ++bucket.count;
+        bucket.sum += value.score;
+        bucket.min = std::min(bucket.min, value.score);
+        bucket.max = std::max(bucket.max, value.score);
+      }
+
+      for (const auto& data : {indexed, plain}) {
+        std::vector<ca_offset_score_bucket> buckets;
+        ca_offset_score_aggregate(
+            cantera::string_view{reinterpret_cast<const char*>(data.data()),
+                                 data.size()},
+            range.first, range.second, bucket_size, &buckets);
+
+        ASSERT_EQ(expected.size(), buckets.size()) << bucket_size;
+        for (size_t i = 0; i < expected.size(); ++i) {
+          EXPECT_EQ(expected[i].offset, buckets[i].offset);
+          EXPECT_EQ(expected[i].count, buckets[i].count);
+          EXPECT_EQ(expected[i].sum, buckets[i].sum);
+          EXPECT_EQ(expected[i].min, buckets[i].min);
+          EXPECT_EQ(expected[i].max, buckets[i].max);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(FormatTest, ImpactIndex) {
+  static const size_t kValueCount = 5000;
+  static const size_t kBucketSize = 100;
+  std::vector<ca_offset_score> values;
+
+  for (size_t i = 0; i < kValueCount; ++i)
+    values.emplace_back(i * 3 + 1, static_cast<float>((i * 7919) % 1000));
+
+  std::vector<uint8_t> data(
+      ca_offset_score_impact_size(values.data(), values.size(), kBucketSize) +
+      ca_offset_score_size(values.data(), values.size()));
+  auto size = ca_format_offset_score_impact(data.data(), data.size(),
+                                            values.data(), values.size(),
+                                            kBucketSize);
+  size += ca_format_offset_score(&data[size], data.size() - size,
+                                 values.data(), values.size());
+  data.resize(size);
+  ASSERT_EQ(CA_OFFSET_SCORE_IMPACT_INDEX, data[0]);
+
+  const cantera::string_view input{reinterpret_cast<const char*>(data.data()),
+                                   data.size()};
+
+  std::vector<ca_offset_score> parsed;
+  ca_offset_score_parse(input, &parsed);
+  ASSERT_EQ(values.size(), parsed.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(values[i].offset, parsed[i].offset);
+    EXPECT_EQ(values[i].score, parsed[i].score);
+  }
+
+  EXPECT_EQ(values.size(), ca_offset_score_count(&data[0], &data[data.size()]));
+  EXPECT_EQ(values.back().offset,
+            ca_offset_score_max_offset(&data[0], &data[data.size()]));
+
+  for (const auto& range :
+       {std::make_pair(0.0, 10.0), std::make_pair(500.0, 500.0),
+        std::make_pair(990.5, 2000.0), std::make_pair(-5.0, -1.0)}) {
+    std::vector<ca_offset_score> expected;
+    for (const auto& value : values) {
+      if (value.score >= range.first && value.score <= range.second)
+        expected.emplace_back(value);
+    }
+
+    parsed.clear();
+    ca_offset_score_parse_score_range(input, range.first, range.second,
+                                      &parsed);
+    ASSERT_EQ(expected.size(), parsed.size()) << range.first;
+    for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(expected[i].offset, parsed[i].offset);
+      EXPECT_EQ(expected[i].score, parsed[i].score);
+    }
+  }
+
+  std::vector<float> scores;
+  for (const auto& value : values) scores.emplace_back(value.score);
+  std::sort(scores.begin(), scores.end(), std::greater<float>());
+
+  for (const size_t count : {1, 50, 150, 1000}) {
+    parsed.clear();
+    EXPECT_EQ(values.size(), ca_offset_score_parse_top(input, count, &parsed));
+    ASSERT_LE(count, parsed.size());
+    EXPECT_GT(values.size(), parsed.size());
+
+    std::sort(parsed.begin(), parsed.end(),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs.score > rhs.score;
+              });
+    for (size_t i = 0; i < count; ++i) EXPECT_EQ(scores[i], parsed[i].score);
+  }
+}
+
+TEST_F(FormatTest, Lookup) {
+  static const size_t kValueCount = 5000;
+  static const size_t kBlockSize = 128;
+  std::vector<ca_offset_score> values;
+
+  for (size_t i = 0; i < kValueCount; ++i)
+    values.emplace_back(i * 3 + 1, static_cast<float>(i % 100));
+
+  std::vector<ca_offset_score> keys;
+  for (uint64_t offset = 0; offset < kValueCount * 3; offset += 1009)
+    keys.emplace_back(offset, 0.0f);
+
+  std::vector<ca_offset_score> expected;
+  for (const auto& value : values) {
+    if (value.offset % 1009 == 0) expected.emplace_back(value);
+  }
+
+  // With and without an impact index in front of the skip index.
+  for (const auto impact : {false, true}) {
+    std::vector<uint8_t> data(
+        ca_offset_score_impact_size(values.data(), values.size(), 1000) +
+        ca_offset_score_indexed_size(values.data(), values.size(),
+                                     kBlockSize));
+    size_t size = 0;
+    if (impact) {
+      size = ca_format_offset_score_impact(data.data(), data.size(),
+                                           values.data(), values.size(), 1000);
+    }
+    size += ca_format_offset_score_indexed(&data[size], data.size() - size,
+                                           values.data(), values.size(),
+                                           kBlockSize);
+    data.resize(size);
+
+    const cantera::string_view input{
+        reinterpret_cast<const char*>(data.data()), data.size()};
+
+    std::vector<ca_offset_score> parsed;
+    ca_offset_score_parse(input, &parsed);
+    EXPECT_EQ(values.size(), parsed.size());
+
+    ca_offset_score_bucket summary;
+    parsed.clear();
+    ca_offset_score_lookup(input, keys.data(), keys.size(), &parsed, &summary);
+
+    ASSERT_EQ(expected.size(), parsed.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(expected[i].offset, parsed[i].offset);
+      EXPECT_EQ(expected[i].score, parsed[i].score);
+    }
+
+    EXPECT_EQ(values.size(), summary.count);
+    EXPECT_EQ(0.0f, summary.min);
+    EXPECT_EQ(99.0f, summary.max);
+    EXPECT_EQ(50 * 4950.0, summary.sum);
+  }
+}
@@ -0,0 +1,174 @@
+// Measures how LevelDB table block parameters affect the size and lookup
+// speed of index tables.
+//
+// Usage: index_table_benchmark [INDEX-TABLE]
+//
+// If INDEX-TABLE is given, its first rows are used as the benchmark data set,
+// so that the sweep reflects a real posting size distribution.  Otherwise a
+// synthetic data set with a long-tailed posting size distribution is used.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "src/ca-table.h"
+
+namespace ca_table = cantera::table;
+
+namespace {
+
+const size_t kMaxRows = 50000;
+const size_t kLookupCount = 20000;
+
+double Now() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+}
+
+std::vector<std::pair<std::string, std::string>> LoadRows(const char* path) {
+  std::vector<std::pair<std::string, std::string>> result;
+
+  auto table = ca_table::TableFactory::Open(nullptr, path);
+  table->SeekToFirst();
+
+  cantera::string_view key, value;
+  while (result.size() < kMaxRows && table->ReadRow(key, value))
+    result.emplace_back(key.to_string(), value.to_string());
+
+  return result;
+}
+
+std::vector<std::pair<std::string, std::string>> MakeRows() {
+  std::vector<std::pair<std::string, std::string>> result;
+
+  std::mt19937_64 rng(1234);
+  std::lognormal_distribution<double> size_dist(3.0, 2.5);
+  std::uniform_int_distribution<uint64_t> step_dist(1, 5000);
+
+  std::vector<ca_table::ca_offset_score> values;
+  std::vector<uint8_t> buffer;
+
+  for (size_t i = 0; i < kMaxRows; ++i) {
+    char key[32];
+    snprintf(key, sizeof(key), "keyword:%08zu", i * 2);
+
+    const auto count =
+        std::min(static_cast<size_t>(size_dist(rng)) + 1, size_t(200000));
+
+    values.clear();
+    uint64_t offset = 0;
+    for (size_t j = 0; j < count; ++j) {
+      offset += step_dist(rng);
+      values.emplace_back(offset, static_cast<float>(rng() % 1000));
+    }
+
+    buffer.resize(ca_table::ca_offset_score_size(values.data(), count));
+    buffer.resize(ca_table::ca_format_offset_score(
+        buffer.data(), buffer.size(), values.data(), count));
+
+    result.emplace_back(
+        key, std::string(reinterpret_cast<const char*>(buffer.data()),
+                         buffer.size()));
+  }
+
+  return result;
+}
+
+void RunBenchmark(const std::vector<std::pair<std::string, std::string>>& rows,
+                  const std::string& path, size_t block_size,
+                  int restart_interval, int filter_bits) {
+  auto options = ca_table::TableOptions::Create()
+                     .SetNoFSync()
+                     .SetBlockSize(block_size)
+                     .SetBlockRestartInterval(restart_interval)
+                     .SetFilterBitsPerKey(filter_bits);
+
+  auto start = Now();
+  {
+    auto table =
+        ca_table::TableFactory::Create("leveldb-table", path.c_str(), options);
+    for (const auto& row : rows) table->InsertRow(row.first, row.second);
+    table->Sync();
+  }
+  const auto build_time = Now() - start;
+
+  struct stat st;
+  if (-1 == stat(path.c_str(), &st)) {
+    perror(path.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  auto table = ca_table::TableFactory::Open("leveldb-table", path.c_str());
+
+  std::mt19937_64 rng(5678);
+  std::uniform_int_distribution<size_t> row_dist(0, rows.size() - 1);
+
+  std::vector<ca_table::ca_offset_score> values;
+  size_t postings = 0;
+
+  start = Now();
+  for (size_t i = 0; i < kLookupCount; ++i) {
+    const auto& key = rows[row_dist(rng)].first;
+    if (!table->SeekToKey(key)) abort();
+    values.clear();
+    ca_table::ca_offset_score_parse(table->ReadValue(), &values);
+    postings += values.size();
+  }
+  const auto hit_time = Now() - start;
+
+  start = Now();
+  for (size_t i = 0; i < kLookupCount; ++i) {
+    auto key = rows[row_dist(rng)].first;
+    key.push_back('~');
+    if (table->SeekToKey(key)) abort();
+  }
+  const auto miss_time = Now() - start;
+
+  printf("%8zu %8d %6d %12lld %9.3f %10.2f %10.2f %10.2f\n", block_size,
+         restart_interval, filter_bits, static_cast<long long>(st.st_size),
+         build_time, 1.0e6 * hit_time / kLookupCount,
+         1.0e9 * hit_time / std::max(postings, size_t(1)),
+         1.0e6 * miss_time / kLookupCount);
+  fflush(stdout);
+
+  unlink(path.c_str());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) try {
+  const auto rows = (argc > 1) ? LoadRows(argv[1]) : MakeRows();
+  if (rows.empty()) {
+    fprintf(stderr, "No rows to benchmark\n");
+    return EXIT_FAILURE;
+  }
+
+  const char* tmpdir = getenv("TMPDIR");
+  if (!tmpdir) tmpdir = "/tmp";
+  const auto path = std::string(tmpdir) + "/index_table_benchmark." +
+                    std::to_string(getpid());
+
+  printf("%8s %8s %6s %12s %9s %10s %10s %10s\n", "block", "restart",
+         "bloom", "bytes", "build-s", "hit-us", "ns/post", "miss-us");
+
+  for (const size_t block_size : {4096, 16384, 65536, 262144}) {
+    for (const int restart_interval : {16, 128}) {
+      for (const int filter_bits : {0, 10}) {
+        RunBenchmark(rows, path, block_size, restart_interval, filter_bits);
+      }
+    }
+  }
+} catch (kj::Exception e) {
+  fprintf(stderr, "%s\n", e.getDescription().cStr());
+  return EXIT_FAILURE;
+}
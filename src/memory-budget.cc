@@ -0,0 +1,53 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/memory-budget.h"
+
+#include <kj/debug.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+thread_local MemoryBudget* current_budget;
+
+}  // namespace
+
+MemoryBudget::Scope::Scope(MemoryBudget* budget) : previous_(current_budget) {
+  current_budget = budget;
+}
+
+MemoryBudget::Scope::~Scope() { current_budget = previous_; }
+
+void MemoryBudget::Charge(size_t bytes) {
+  const auto used = used_ += bytes;
+
+  if (limit_ && used > limit_) {
+    used_ -= bytes;
+    KJ_FAIL_REQUIRE("statement exceeds memory limit", limit_, used);
+  }
+
+  auto peak = peak_.load();
+  while (used > peak && !peak_.compare_exchange_weak(peak, used)) {
+  }
+}
+
+MemoryBudget* MemoryBudget::Current() { return current_budget; }
+
+void MemoryCharge::Set(size_t bytes) {
+  if (!budget_) return;
+
+  if (bytes > bytes_)
+    budget_->Charge(bytes - bytes_);
+  else
+    budget_->Release(bytes_ - bytes);
+
+  bytes_ = bytes;
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
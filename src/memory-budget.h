@@ -0,0 +1,91 @@
+#ifndef CA_TABLE_MEMORY_BUDGET_H_
+#define CA_TABLE_MEMORY_BUDGET_H_ 1
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include <kj/common.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// Limits the memory held by the intermediate results of a statement, so that
+// a pathological query fails on its own instead of exhausting the memory of
+// the process.  Safe to use from several threads at once.
+class MemoryBudget {
+ public:
+  // Makes `budget' the one charged by MemoryCharge objects created by this
+  // thread, until destroyed.
+  class Scope {
+   public:
+    explicit Scope(MemoryBudget* budget);
+    ~Scope();
+
+    KJ_DISALLOW_COPY(Scope);
+
+   private:
+    MemoryBudget* previous_;
+  };
+
+  // A limit of zero means no limit.
+  explicit MemoryBudget(size_t limit) : limit_(limit) {}
+
+  KJ_DISALLOW_COPY(MemoryBudget);
+
+  // Adds `bytes' to the memory in use.  Throws, without adding anything, if
+  // this would exceed the limit.
+  void Charge(size_t bytes);
+
+  void Release(size_t bytes) { used_ -= bytes; }
+
+  size_t limit() const { return limit_; }
+  size_t used() const { return used_; }
+
+  // The largest amount of memory in use at any time.
+  size_t peak() const { return peak_; }
+
+  // Returns the budget of this thread, or nullptr.
+  static MemoryBudget* Current();
+
+ private:
+  const size_t limit_;
+  std::atomic<size_t> used_{0};
+  std::atomic<size_t> peak_{0};
+};
+
+// Charges an amount of memory, usually that of a vector, to the budget that
+// was current when it was created, until destroyed.  Does nothing if there
+// was none.
+class MemoryCharge {
+ public:
+  MemoryCharge() : budget_(MemoryBudget::Current()) {}
+
+  ~MemoryCharge() {
+    if (budget_) budget_->Release(bytes_);
+  }
+
+  KJ_DISALLOW_COPY(MemoryCharge);
+
+  // Changes the amount charged.  Throws if this would exceed the limit, in
+  // which case the previous amount remains charged.
+  void Set(size_t bytes);
+
+  template <typename T>
+  void Set(const std::vector<T>& data) {
+    Set(data.capacity() * sizeof(T));
+  }
+
+  size_t bytes() const { return bytes_; }
+
+ private:
+  MemoryBudget* const budget_;
+  size_t bytes_ = 0;
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !CA_TABLE_MEMORY_BUDGET_H_
@@ -0,0 +1,101 @@
+#include <thread>
+#include <vector>
+
+#include <kj/exception.h>
+
+#include "src/memory-budget.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace cantera::table::internal;
+
+struct MemoryBudgetTest : testing::Test {};
+
+TEST_F(MemoryBudgetTest, ChargeAndRelease) {
+  MemoryBudget budget(1000);
+
+  budget.Charge(600);
+  budget.Charge(300);
+  EXPECT_EQ(900U, budget.used());
+
+  budget.Release(500);
+  budget.Charge(100);
+  EXPECT_EQ(500U, budget.used());
+  EXPECT_EQ(900U, budget.peak());
+}
+
+TEST_F(MemoryBudgetTest, ExceedsLimit) {
+  MemoryBudget budget(1000);
+
+  budget.Charge(800);
+  EXPECT_THROW(budget.Charge(201), kj::Exception);
+
+  // A failed charge adds nothing.
+  EXPECT_EQ(800U, budget.used());
+  EXPECT_EQ(800U, budget.peak());
+
+  budget.Charge(200);
+  EXPECT_EQ(1000U, budget.used());
+}
+
+TEST_F(MemoryBudgetTest, NoLimit) {
+  MemoryBudget budget(0);
+
+  budget.Charge(size_t(1) << 50);
+  EXPECT_EQ(size_t(1) << 50, budget.peak());
+}
+
+TEST_F(MemoryBudgetTest, Charges) {
+  MemoryBudget budget(1500);
+
+  {
+    // No budget is current yet.
+    MemoryCharge charge;
+    charge.Set(2000);
+  }
+  EXPECT_EQ(0U, budget.used());
+
+  {
+    MemoryBudget::Scope scope(&budget);
+    EXPECT_EQ(&budget, MemoryBudget::Current());
+
+    MemoryCharge charge;
+    charge.Set(400);
+    charge.Set(700);
+    EXPECT_EQ(700U, budget.used());
+
+    std::vector<int> data;
+    data.reserve(100);
+    MemoryCharge vector_charge;
+    vector_charge.Set(data);
+    EXPECT_EQ(700U + 100 * sizeof(int), budget.used());
+
+    EXPECT_THROW(charge.Set(1200), kj::Exception);
+    EXPECT_EQ(700U + 100 * sizeof(int), budget.used());
+
+    charge.Set(100);
+    EXPECT_EQ(100U + 100 * sizeof(int), budget.used());
+  }
+
+  EXPECT_EQ(nullptr, MemoryBudget::Current());
+  EXPECT_EQ(0U, budget.used());
+  EXPECT_EQ(700U + 100 * sizeof(int), budget.peak());
+}
+
+TEST_F(MemoryBudgetTest, Threads) {
+  MemoryBudget budget(0);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    threads.emplace_back([&budget] {
+      MemoryBudget::Scope scope(&budget);
+      for (size_t j = 0; j < 10000; ++j) {
+        MemoryCharge charge;
+        charge.Set(j);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_EQ(0U, budget.used());
+  EXPECT_LE(9999U, budget.peak());
+}
@@ -22,6 +22,7 @@
 #include <kj/debug.h>
 
 #include "src/ca-table.h"
+#include "src/trace.h"
 
 namespace cantera {
 namespace table {
@@ -182,6 +183,8 @@ void ca_table_merge(
     std::vector<std::unique_ptr<Table>>& tables,
     std::function<void(const std::string& key,
                        std::vector<std::vector<char>>& data)> callback) {
+  CA_TRACE_SPAN("load", "merge");
+
   std::vector<std::vector<char>> data;
   std::string current_key;
 
@@ -0,0 +1,434 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/output-buffer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+
+#include <kj/debug.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+// Float to shortest decimal conversion, following Ulf Adams, "Ryū: Fast
+// Float-to-String Conversion", PLDI 2018.
+
+const int kFloatMantissaBits = 23;
+const int kFloatBias = 127;
+
+const int kPow5InvBitCount = 59;
+const int kPow5BitCount = 61;
+
+// floor(2^(Pow5Bits(i) - 1 + kPow5InvBitCount) / 5^i) + 1
+const uint64_t kPow5InvSplit[31] = {
+    UINT64_C(576460752303423489), UINT64_C(461168601842738791),
+    UINT64_C(368934881474191033), UINT64_C(295147905179352826),
+    UINT64_C(472236648286964522), UINT64_C(377789318629571618),
+    UINT64_C(302231454903657294), UINT64_C(483570327845851670),
+    UINT64_C(386856262276681336), UINT64_C(309485009821345069),
+    UINT64_C(495176015714152110), UINT64_C(396140812571321688),
+    UINT64_C(316912650057057351), UINT64_C(507060240091291761),
+    UINT64_C(405648192073033409), UINT64_C(324518553658426727),
+    UINT64_C(519229685853482763), UINT64_C(415383748682786211),
+    UINT64_C(332306998946228969), UINT64_C(531691198313966350),
+    UINT64_C(425352958651173080), UINT64_C(340282366920938464),
+    UINT64_C(544451787073501542), UINT64_C(435561429658801234),
+    UINT64_C(348449143727040987), UINT64_C(557518629963265579),
+    UINT64_C(446014903970612463), UINT64_C(356811923176489971),
+    UINT64_C(570899077082383953), UINT64_C(456719261665907162),
+    UINT64_C(365375409332725730)
+};
+
+// 5^i, scaled to kPow5BitCount bits.
+const uint64_t kPow5Split[47] = {
+    UINT64_C(1152921504606846976), UINT64_C(1441151880758558720),
+    UINT64_C(1801439850948198400), UINT64_C(2251799813685248000),
+    UINT64_C(1407374883553280000), UINT64_C(1759218604441600000),
+    UINT64_C(2199023255552000000), UINT64_C(1374389534720000000),
+    UINT64_C(1717986918400000000), UINT64_C(2147483648000000000),
+    UINT64_C(1342177280000000000), UINT64_C(1677721600000000000),
+    UINT64_C(2097152000000000000), UINT64_C(1310720000000000000),
+    UINT64_C(1638400000000000000), UINT64_C(2048000000000000000),
+    UINT64_C(1280000000000000000), UINT64_C(1600000000000000000),
+    UINT64_C(2000000000000000000), UINT64_C(1250000000000000000),
+    UINT64_C(1562500000000000000), UINT64_C(1953125000000000000),
+    UINT64_C(1220703125000000000), UINT64_C(1525878906250000000),
+    UINT64_C(1907348632812500000), UINT64_C(1192092895507812500),
+    UINT64_C(1490116119384765625), UINT64_C(1862645149230957031),
+    UINT64_C(1164153218269348144), UINT64_C(1455191522836685180),
+    UINT64_C(1818989403545856475), UINT64_C(2273736754432320594),
+    UINT64_C(1421085471520200371), UINT64_C(1776356839400250464),
+    UINT64_C(2220446049250313080), UINT64_C(1387778780781445675),
+    UINT64_C(1734723475976807094), UINT64_C(2168404344971008868),
+    UINT64_C(1355252715606880542), UINT64_C(1694065894508600678),
+    UINT64_C(2117582368135750847), UINT64_C(1323488980084844279),
+    UINT64_C(1654361225106055349), UINT64_C(2067951531382569187),
+    UINT64_C(1292469707114105741), UINT64_C(1615587133892632177),
+    UINT64_C(2019483917365790221)
+};
+
+const char kDigitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536"
+    "37383940414243444546474849505152535455565758596061626364656667686970717273"
+    "7475767778798081828384858687888990919293949596979899";
+
+// Returns ceil(log2(5^e)), for 0 < e <= 3528.
+int32_t Pow5Bits(int32_t e) {
+  return static_cast<int32_t>((static_cast<uint32_t>(e) * 1217359) >> 19) + 1;
+}
+
+// Returns floor(log10(2^e)), for 0 <= e <= 1650.
+uint32_t Log10Pow2(int32_t e) {
+  return (static_cast<uint32_t>(e) * 78913) >> 18;
+}
+
+// Returns floor(log10(5^e)), for 0 <= e <= 2620.
+uint32_t Log10Pow5(int32_t e) {
+  return (static_cast<uint32_t>(e) * 732923) >> 20;
+}
+
+bool MultipleOfPowerOf5(uint32_t value, uint32_t p) {
+  uint32_t count = 0;
+  while (value % 5 == 0) {
+    value /= 5;
+    ++count;
+  }
+  return count >= p;
+}
+
+bool MultipleOfPowerOf2(uint32_t value, uint32_t p) {
+  return (value & ((1U << p) - 1)) == 0;
+}
+
+uint32_t MulShift(uint32_t m, uint64_t factor, int32_t shift) {
+  const auto low = static_cast<uint64_t>(m) * static_cast<uint32_t>(factor);
+  const auto high = static_cast<uint64_t>(m) * (factor >> 32);
+  return static_cast<uint32_t>(((low >> 32) + high) >> (shift - 32));
+}
+
+uint32_t MulPow5InvDivPow2(uint32_t m, uint32_t q, int32_t j) {
+  return MulShift(m, kPow5InvSplit[q], j);
+}
+
+uint32_t MulPow5DivPow2(uint32_t m, uint32_t i, int32_t j) {
+  return MulShift(m, kPow5Split[i], j);
+}
+
+// Converts a finite, positive float, given as its IEEE mantissa and
+// exponent fields, to the shortest `digits' * 10^`exponent' that converts
+// back to the same float.
+void FloatToDecimal(uint32_t ieee_mantissa, uint32_t ieee_exponent,
+                    uint32_t& digits, int32_t& exponent) {
+  int32_t e2;
+  uint32_t m2;
+  if (ieee_exponent == 0) {
+    e2 = 1 - kFloatBias - kFloatMantissaBits - 2;
+    m2 = ieee_mantissa;
+  } else {
+    e2 = static_cast<int32_t>(ieee_exponent) - kFloatBias - kFloatMantissaBits -
+         2;
+    m2 = (1U << kFloatMantissaBits) | ieee_mantissa;
+  }
+
+  // Round half to even when the value is exactly between two candidates.
+  const bool accept_bounds = (m2 & 1) == 0;
+
+  // The interval of decimal values that convert back to this float, times
+  // four, is (mm, mp).
+  const uint32_t mv = 4 * m2;
+  const uint32_t mp = 4 * m2 + 2;
+  const uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+  const uint32_t mm = 4 * m2 - 1 - mm_shift;
+
+  uint32_t vr, vp, vm;
+  int32_t e10;
+  bool vm_is_trailing_zeros = false;
+  bool vr_is_trailing_zeros = false;
+  uint8_t last_removed_digit = 0;
+
+  if (e2 >= 0) {
+    const auto q = Log10Pow2(e2);
+    e10 = q;
+    const auto k = kPow5InvBitCount + Pow5Bits(q) - 1;
+    const auto i = -e2 + static_cast<int32_t>(q) + k;
+    vr = MulPow5InvDivPow2(mv, q, i);
+    vp = MulPow5InvDivPow2(mp, q, i);
+    vm = MulPow5InvDivPow2(mm, q, i);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      // The loop below removes at least one digit; compute the last one
+      // removed, which is needed for rounding.
+      const auto l = kPow5InvBitCount + Pow5Bits(q - 1) - 1;
+      last_removed_digit = static_cast<uint8_t>(
+          MulPow5InvDivPow2(mv, q - 1, -e2 + static_cast<int32_t>(q) - 1 + l) %
+          10);
+    }
+    if (q <= 9) {
+      // At most one of mp, mv and mm is a multiple of 5.
+      if (mv % 5 == 0) {
+        vr_is_trailing_zeros = MultipleOfPowerOf5(mv, q);
+      } else if (accept_bounds) {
+        vm_is_trailing_zeros = MultipleOfPowerOf5(mm, q);
+      } else {
+        vp -= MultipleOfPowerOf5(mp, q);
+      }
+    }
+  } else {
+    const auto q = Log10Pow5(-e2);
+    e10 = static_cast<int32_t>(q) + e2;
+    const auto i = -e2 - static_cast<int32_t>(q);
+    const auto k = Pow5Bits(i) - kPow5BitCount;
+    auto j = static_cast<int32_t>(q) - k;
+    vr = MulPow5DivPow2(mv, i, j);
+    vp = MulPow5DivPow2(mp, i, j);
+    vm = MulPow5DivPow2(mm, i, j);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      j = static_cast<int32_t>(q) - 1 - (Pow5Bits(i + 1) - kPow5BitCount);
+      last_removed_digit =
+          static_cast<uint8_t>(MulPow5DivPow2(mv, i + 1, j) % 10);
+    }
+    if (q <= 1) {
+      // mv has at least q trailing zero bits, so vr ends in zeros.
+      vr_is_trailing_zeros = true;
+      if (accept_bounds) {
+        vm_is_trailing_zeros = mm_shift == 1;
+      } else {
+        --vp;
+      }
+    } else if (q < 31) {
+      vr_is_trailing_zeros = MultipleOfPowerOf2(mv, q - 1);
+    }
+  }
+
+  // Remove digits while the interval still contains a shorter candidate.
+  int32_t removed = 0;
+  if (vm_is_trailing_zeros || vr_is_trailing_zeros) {
+    while (vp / 10 > vm / 10) {
+      vm_is_trailing_zeros &= vm % 10 == 0;
+      vr_is_trailing_zeros &= last_removed_digit == 0;
+      last_removed_digit = static_cast<uint8_t>(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    if (vm_is_trailing_zeros) {
+      while (vm % 10 == 0) {
+        vr_is_trailing_zeros &= last_removed_digit == 0;
+        last_removed_digit = static_cast<uint8_t>(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        ++removed;
+      }
+    }
+    // Round half to even.
+    if (vr_is_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0)
+      last_removed_digit = 4;
+    digits = vr + ((vr == vm && (!accept_bounds || !vm_is_trailing_zeros)) ||
+                   last_removed_digit >= 5);
+  } else {
+    while (vp / 10 > vm / 10) {
+      last_removed_digit = static_cast<uint8_t>(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    digits = vr + (vr == vm || last_removed_digit >= 5);
+  }
+
+  exponent = e10 + removed;
+}
+
+// Writes the `count' decimal digits of `value', right aligned, and returns
+// the end of the output.
+char* FormatDigits(char* output, uint64_t value, size_t count) {
+  const auto end = output + count;
+  auto o = end;
+  while (o - output >= 2) {
+    o -= 2;
+    memcpy(o, &kDigitPairs[(value % 100) * 2], 2);
+    value /= 100;
+  }
+  if (o != output) *--o = '0' + value % 10;
+  return end;
+}
+
+size_t DigitCount(uint64_t value) {
+  size_t result = 1;
+  while (value >= 10) {
+    value /= 10;
+    ++result;
+  }
+  return result;
+}
+
+// Lays out `digits' * 10^`exponent' like printf("%g") with the given
+// precision, omitting trailing zeros.
+char* LayoutDecimal(char* output, uint64_t digits, int32_t exponent,
+                    int32_t precision) {
+  char buffer[kMaxIntegerLength];
+  const auto length = DigitCount(digits);
+  FormatDigits(buffer, digits, length);
+
+  // The exponent of the first digit in scientific notation.
+  const auto x = exponent + static_cast<int32_t>(length) - 1;
+
+  if (x < -4 || x >= precision) {
+    *output++ = buffer[0];
+    if (length > 1) {
+      *output++ = '.';
+      memcpy(output, buffer + 1, length - 1);
+      output += length - 1;
+    }
+    *output++ = 'e';
+    *output++ = x < 0 ? '-' : '+';
+    const uint32_t abs_x = x < 0 ? -x : x;
+    if (abs_x >= 100) *output++ = '0' + abs_x / 100;
+    memcpy(output, &kDigitPairs[(abs_x % 100) * 2], 2);
+    return output + 2;
+  }
+
+  if (x < 0) {
+    *output++ = '0';
+    *output++ = '.';
+    for (auto i = x; ++i < 0;) *output++ = '0';
+    memcpy(output, buffer, length);
+    return output + length;
+  }
+
+  const auto integer_length = static_cast<size_t>(x) + 1;
+  if (length <= integer_length) {
+    memcpy(output, buffer, length);
+    output += length;
+    for (auto i = length; i < integer_length; ++i) *output++ = '0';
+    return output;
+  }
+
+  memcpy(output, buffer, integer_length);
+  output += integer_length;
+  *output++ = '.';
+  memcpy(output, buffer + integer_length, length - integer_length);
+  return output + length - integer_length;
+}
+
+// Handles the values that don't need digit conversion.  Returns nullptr for
+// other values.
+char* FormatSpecial(char* output, bool negative, bool is_nan, bool is_inf,
+                    bool is_zero) {
+  if (negative) *output++ = '-';
+  if (is_nan) {
+    memcpy(output, "nan", 3);
+    return output + 3;
+  }
+  if (is_inf) {
+    memcpy(output, "inf", 3);
+    return output + 3;
+  }
+  if (is_zero) {
+    *output++ = '0';
+    return output;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+char* FormatFloat(char* output, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  const bool negative = (bits >> 31) != 0;
+  const uint32_t ieee_mantissa = bits & ((1U << kFloatMantissaBits) - 1);
+  const uint32_t ieee_exponent = (bits >> kFloatMantissaBits) & 0xff;
+
+  if (ieee_exponent == 0xff || (!ieee_exponent && !ieee_mantissa)) {
+    const bool special = ieee_exponent == 0xff;
+    return FormatSpecial(output, negative, special && ieee_mantissa,
+                         special && !ieee_mantissa, !special);
+  }
+
+  uint32_t digits;
+  int32_t exponent;
+  FloatToDecimal(ieee_mantissa, ieee_exponent, digits, exponent);
+
+  if (negative) *output++ = '-';
+  return LayoutDecimal(output, digits, exponent, 9);
+}
+
+char* FormatDouble(char* output, double value) {
+  if (!std::isfinite(value) || value == 0) {
+    return FormatSpecial(output, std::signbit(value), std::isnan(value),
+                         std::isinf(value), value == 0);
+  }
+
+  char buffer[kMaxDoubleLength + 1];
+  for (int precision = 15;; ++precision) {
+    const auto length =
+        snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+    KJ_ASSERT(length > 0 && static_cast<size_t>(length) <= kMaxDoubleLength);
+    if (precision == 17 || strtod(buffer, nullptr) == value) {
+      memcpy(output, buffer, length);
+      return output + length;
+    }
+  }
+}
+
+char* FormatUInt64(char* output, uint64_t value) {
+  return FormatDigits(output, value, DigitCount(value));
+}
+
+TimeFormatter::TimeFormatter(const char* format)
+    : format_(format), cache_(new Entry[kCacheSize]) {
+  // No entry matches until written, since times are never this small.
+  for (size_t i = 0; i < kCacheSize; ++i) cache_[i].time = -1;
+}
+
+string_view TimeFormatter::Format(time_t time) {
+  const auto hash = static_cast<uint64_t>(time) * UINT64_C(0x9e3779b97f4a7c15);
+  auto& entry = cache_[hash >> 52];
+
+  if (entry.time != time || time == -1) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    gmtime_r(&time, &tm);
+
+    char buffer[kMaxLength + 1];
+    entry.length = strftime(buffer, sizeof(buffer), format_.c_str(), &tm);
+    memcpy(entry.text, buffer, entry.length);
+    entry.time = time;
+  }
+
+  return string_view(entry.text, entry.length);
+}
+
+OutputBuffer::OutputBuffer(FILE* file, size_t capacity)
+    : file_(file), capacity_(capacity), buffer_(new char[capacity]) {
+  KJ_REQUIRE(capacity_ >= kMaxDoubleLength);
+}
+
+OutputBuffer::~OutputBuffer() {
+  if (size_) fwrite(buffer_.get(), 1, size_, file_);
+}
+
+void OutputBuffer::Flush() {
+  if (!size_) return;
+  Write(buffer_.get(), size_);
+  size_ = 0;
+}
+
+void OutputBuffer::Write(const char* data, size_t size) {
+  if (size && 1 != fwrite(data, size, 1, file_))
+    KJ_FAIL_SYSCALL("fwrite", errno);
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
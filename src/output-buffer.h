@@ -0,0 +1,123 @@
+#ifndef CA_TABLE_OUTPUT_BUFFER_H_
+#define CA_TABLE_OUTPUT_BUFFER_H_ 1
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+
+#include <kj/common.h>
+
+#include "src/ca-table.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// Maximum number of bytes written by the Format*() functions below.
+enum : size_t {
+  kMaxFloatLength = 16,
+  kMaxDoubleLength = 25,
+  kMaxIntegerLength = 20,
+};
+
+// Writes the shortest decimal representation of `value' that converts back
+// to the same float, laid out like printf("%.9g").  Returns the end of the
+// output.
+char* FormatFloat(char* output, float value);
+
+// Like FormatFloat(), for doubles.  Uses printf("%g") with the lowest
+// precision that converts back to the same value, so it is much slower.
+char* FormatDouble(char* output, double value);
+
+char* FormatUInt64(char* output, uint64_t value);
+
+// Formats timestamps with strftime(), remembering recent results.  Time
+// series usually share timestamps across keys, so most lookups are hits.
+class TimeFormatter {
+ public:
+  explicit TimeFormatter(const char* format);
+
+  KJ_DISALLOW_COPY(TimeFormatter);
+
+  string_view Format(time_t time);
+
+ private:
+  // The cache is indexed by the top 12 bits of a 64 bit hash.
+  enum : size_t { kCacheSize = 4096, kMaxLength = 63 };
+
+  struct Entry {
+    time_t time;
+    uint8_t length;
+    char text[kMaxLength];
+  };
+
+  std::string format_;
+
+  std::unique_ptr<Entry[]> cache_;
+};
+
+// Collects formatted output in a large buffer, and writes it to a stdio
+// stream when full.  Remaining output is written on destruction, but errors
+// are only reported by Flush().
+class OutputBuffer {
+ public:
+  explicit OutputBuffer(FILE* file, size_t capacity = 1 << 20);
+
+  ~OutputBuffer();
+
+  KJ_DISALLOW_COPY(OutputBuffer);
+
+  void Append(char ch) { *Reserve(1) = ch; ++size_; }
+
+  void Append(const char* data, size_t size) {
+    if (size > capacity_) {
+      Flush();
+      Write(data, size);
+      return;
+    }
+    memcpy(Reserve(size), data, size);
+    size_ += size;
+  }
+
+  void Append(const string_view& data) { Append(data.data(), data.size()); }
+
+  void AppendFloat(float value) {
+    size_ = FormatFloat(Reserve(kMaxFloatLength), value) - buffer_.get();
+  }
+
+  void AppendDouble(double value) {
+    size_ = FormatDouble(Reserve(kMaxDoubleLength), value) - buffer_.get();
+  }
+
+  void AppendUInt64(uint64_t value) {
+    size_ = FormatUInt64(Reserve(kMaxIntegerLength), value) - buffer_.get();
+  }
+
+  // Writes all buffered output to the stream.
+  void Flush();
+
+ private:
+  // Returns a pointer to the end of the buffered output, with room for at
+  // least `size' more bytes.
+  char* Reserve(size_t size) {
+    if (capacity_ - size_ < size) Flush();
+    return buffer_.get() + size_;
+  }
+
+  void Write(const char* data, size_t size);
+
+  FILE* const file_;
+
+  const size_t capacity_;
+  std::unique_ptr<char[]> buffer_;
+  size_t size_ = 0;
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !CA_TABLE_OUTPUT_BUFFER_H_
@@ -0,0 +1,135 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+
+#include "src/output-buffer.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace cantera::table::internal;
+
+namespace {
+
+std::string FloatString(float value) {
+  char buffer[kMaxFloatLength];
+  return std::string(buffer, FormatFloat(buffer, value));
+}
+
+std::string DoubleString(double value) {
+  char buffer[kMaxDoubleLength];
+  return std::string(buffer, FormatDouble(buffer, value));
+}
+
+std::string UInt64String(uint64_t value) {
+  char buffer[kMaxIntegerLength];
+  return std::string(buffer, FormatUInt64(buffer, value));
+}
+
+}  // namespace
+
+struct OutputBufferTest : testing::Test {};
+
+TEST_F(OutputBufferTest, FloatLayout) {
+  EXPECT_EQ("0", FloatString(0.0f));
+  EXPECT_EQ("-0", FloatString(-0.0f));
+  EXPECT_EQ("0.1", FloatString(0.1f));
+  EXPECT_EQ("-2.5", FloatString(-2.5f));
+  EXPECT_EQ("100", FloatString(100.0f));
+  EXPECT_EQ("1234.5", FloatString(1234.5f));
+  EXPECT_EQ("0.0001", FloatString(1e-4f));
+  EXPECT_EQ("1e-05", FloatString(1e-5f));
+  EXPECT_EQ("123456790", FloatString(123456789.0f));
+  EXPECT_EQ("1e+09", FloatString(1e9f));
+  EXPECT_EQ("3.4028235e+38", FloatString(std::numeric_limits<float>::max()));
+  EXPECT_EQ("1e-45",
+            FloatString(std::numeric_limits<float>::denorm_min()));
+  EXPECT_EQ("inf", FloatString(std::numeric_limits<float>::infinity()));
+  EXPECT_EQ("-inf", FloatString(-std::numeric_limits<float>::infinity()));
+  EXPECT_EQ("nan", FloatString(std::numeric_limits<float>::quiet_NaN()));
+}
+
+TEST_F(OutputBufferTest, FloatRoundTrip) {
+  const size_t kIterations = 200000;
+
+  std::mt19937 rng;
+  for (size_t i = 0; i < kIterations; ++i) {
+    const uint32_t bits = rng();
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    if (std::isnan(value)) continue;
+
+    const auto string = FloatString(value);
+    ASSERT_EQ(value, strtof(string.c_str(), nullptr)) << string;
+
+    // No representation with fewer significant digits converts back.
+    char shorter[32];
+    for (int precision = 1;; ++precision) {
+      snprintf(shorter, sizeof(shorter), "%.*g", precision, value);
+      if (strtof(shorter, nullptr) == value) {
+        const auto digits = [](const std::string& s) {
+          const auto mantissa = s.substr(0, s.find('e'));
+          const auto first = mantissa.find_first_of("123456789");
+          const auto last = mantissa.find_last_of("123456789");
+          auto count = last - first + 1;
+          if (mantissa.find('.') > first && mantissa.find('.') < last) --count;
+          return count;
+        };
+        EXPECT_LE(digits(string), digits(shorter)) << string << " " << shorter;
+        break;
+      }
+    }
+  }
+}
+
+TEST_F(OutputBufferTest, Double) {
+  EXPECT_EQ("0.1", DoubleString(0.1));
+  EXPECT_EQ("0.3333333333333333", DoubleString(1.0 / 3));
+  EXPECT_EQ("1e+300", DoubleString(1e300));
+  EXPECT_EQ("-0", DoubleString(-0.0));
+}
+
+TEST_F(OutputBufferTest, UInt64) {
+  EXPECT_EQ("0", UInt64String(0));
+  EXPECT_EQ("9", UInt64String(9));
+  EXPECT_EQ("10", UInt64String(10));
+  EXPECT_EQ("12345", UInt64String(12345));
+  EXPECT_EQ("18446744073709551615",
+            UInt64String(std::numeric_limits<uint64_t>::max()));
+}
+
+TEST_F(OutputBufferTest, Time) {
+  TimeFormatter formatter("%Y-%m-%d %H:%M:%S");
+  EXPECT_EQ("1970-01-01 00:00:00", formatter.Format(0).to_string());
+  EXPECT_EQ("2001-09-09 01:46:40", formatter.Format(1000000000).to_string());
+  // Cached.
+  EXPECT_EQ("2001-09-09 01:46:40", formatter.Format(1000000000).to_string());
+}
+
+TEST_F(OutputBufferTest, Buffer) {
+  char* data = nullptr;
+  size_t size = 0;
+  auto file = open_memstream(&data, &size);
+  ASSERT_NE(nullptr, file);
+
+  {
+    OutputBuffer out(file, 32);
+    for (int i = 0; i < 100; ++i) {
+      out.AppendUInt64(i);
+      out.Append(',');
+    }
+    out.Append(std::string(100, 'x'));
+    out.AppendFloat(0.5f);
+    out.Flush();
+  }
+
+  fclose(file);
+
+  std::string expected;
+  for (int i = 0; i < 100; ++i) expected += std::to_string(i) + ",";
+  expected += std::string(100, 'x') + "0.5";
+  EXPECT_EQ(expected, std::string(data, size));
+
+  free(data);
+}
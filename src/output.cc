@@ -16,6 +16,10 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
@@ -23,104 +27,102 @@
 #include <vector>
 
 #include "src/ca-table.h"
+#include "src/output-buffer.h"
 #include "src/query.h"
 
+#if !HAVE_FWRITE_UNLOCKED
+# define fwrite_unlocked fwrite
+#endif
+
 namespace cantera {
 namespace table {
 
 char CA_time_format[64];
 enum RuntimeParameterValue CA_output_format = CA_PARAM_VALUE_CSV;
 
-void CA_output_char(int ch) { putchar(ch); }
+void CA_output_char(int ch) { putchar_unlocked(ch); }
 
 void CA_output_string(const char* string) {
-  fwrite(string, 1, strlen(string), stdout);
+  fwrite_unlocked(string, 1, strlen(string), stdout);
 }
 
 void CA_output_json_string(const char* string, size_t length) {
+  // Escape sequences are written to `buffer', and characters that need no
+  // escaping are written in runs directly from `string'.
+  char buffer[8];
+  const auto end = string + length;
+
   putchar_unlocked('"');
 
-  while (length--) {
-    auto ch = static_cast<uint8_t>(*string++);
+  while (string != end) {
+    auto run_end = string;
+    for (; run_end != end; ++run_end) {
+      const auto ch = static_cast<uint8_t>(*run_end);
+      if (ch < ' ' || ch == '"' || ch == '\\') break;
+    }
+
+    fwrite_unlocked(string, 1, run_end - string, stdout);
+    if (run_end == end) break;
+
+    const auto ch = static_cast<uint8_t>(*run_end);
+    string = run_end + 1;
 
+    buffer[0] = '\\';
     switch (ch) {
       case '\\':
-        break;
       case '"':
-        ch = '"';
+        buffer[1] = ch;
         break;
       case '\a':
-        ch = 'a';
+        buffer[1] = 'a';
         break;
       case '\b':
-        ch = 'b';
+        buffer[1] = 'b';
         break;
       case '\t':
-        ch = 't';
+        buffer[1] = 't';
         break;
       case '\n':
-        ch = 'n';
+        buffer[1] = 'n';
         break;
       case '\v':
-        ch = 'v';
+        buffer[1] = 'v';
         break;
       case '\f':
-        ch = 'f';
+        buffer[1] = 'f';
         break;
       case '\r':
-        ch = 'r';
+        buffer[1] = 'r';
         break;
 
       default:
-
-        if (ch < ' ')
-          printf("\\u%04x", ch);
-        else
-          putchar_unlocked(ch);
-
+        snprintf(buffer, sizeof(buffer), "\\u%04x", ch);
+        fwrite_unlocked(buffer, 1, 6, stdout);
         continue;
     }
 
-    putchar_unlocked('\\');
-    putchar_unlocked(ch);
+    fwrite_unlocked(buffer, 1, 2, stdout);
   }
 
   putchar_unlocked('"');
 }
 
-void CA_output_float4(float number) { printf("%.9g", number); }
+void CA_output_float4(float number) {
+  char buffer[internal::kMaxFloatLength];
+  fwrite_unlocked(buffer, 1, internal::FormatFloat(buffer, number) - buffer,
+                  stdout);
+}
 
-void CA_output_float8(double number) { printf("%.17g", number); }
+void CA_output_float8(double number) {
+  char buffer[internal::kMaxDoubleLength];
+  fwrite_unlocked(buffer, 1, internal::FormatDouble(buffer, number) - buffer,
+                  stdout);
+}
 
 void CA_output_uint64(uint64_t number) {
-  char buffer[20];
-  char* begin, *o;
-
-  begin = o = buffer;
-
-  while (number > 0) {
-    *o++ = '0' + (number % 10);
-    number /= 10;
-  }
-
-  if (o == begin)
-    putchar('0');
-  else {
-    size_t length = o-- - begin;
-
-    while (begin < o) {
-      char tmp;
-
-      tmp = *o;
-      *o = *begin;
-      *begin = tmp;
-
-      --o;
-      ++begin;
-    }
-
-    fwrite(buffer, 1, length, stdout);
-  }
+  char buffer[internal::kMaxIntegerLength];
+  fwrite_unlocked(buffer, 1, internal::FormatUInt64(buffer, number) - buffer,
+                  stdout);
 }
 
 }  // namespace table
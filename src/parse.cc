@@ -24,19 +24,27 @@
 #include <assert.h>
 #include <string.h>
 
+#include <algorithm>
+#include <limits>
+#include <vector>
+
 #include <err.h>
 #include <sysexits.h>
 
 #include <kj/debug.h>
 
 #include "src/ca-table.h"
+#include "src/deadline.h"
 #include "src/rle.h"
+#include "src/stats.h"
 
 #include "third_party/oroch/oroch/integer_codec.h"
 
 namespace cantera {
 namespace table {
 
+using namespace internal;
+
 namespace {
 
 void InitRLE(struct CA_rle_context* ctx, const uint8_t* input) {
@@ -535,9 +543,148 @@ uint64_t GetMaxOffsetWithPrediction(const uint8_t*& begin, const uint8_t* end) {
   return result;
 }
 
+namespace {
+
+struct SkipIndexBlock {
+  uint64_t first_offset;
+  uint64_t last_offset;
+  uint64_t size;
+  uint64_t count;
+  float min, max;
+  double sum;
+};
+
+// Parses a skip index, after the type byte.  The blocks themselves follow
+// the index.
+std::vector<SkipIndexBlock> ParseSkipIndex(const uint8_t*& begin,
+                                           const uint8_t* end) {
+  const auto count = ca_parse_integer(&begin);
+  KJ_REQUIRE(count <= static_cast<size_t>(end - begin), count);
+
+  std::vector<SkipIndexBlock> result;
+  result.reserve(count);
+
+  uint64_t offset = 0;
+  for (size_t i = 0; i < count; ++i) {
+    SkipIndexBlock block;
+    offset += ca_parse_integer(&begin);
+    block.first_offset = offset;
+    block.last_offset = offset + ca_parse_integer(&begin);
+    block.size = ca_parse_integer(&begin);
+    block.count = ca_parse_integer(&begin);
+
+    KJ_REQUIRE(static_cast<size_t>(end - begin) >=
+               2 * sizeof(float) + sizeof(double));
+    memcpy(&block.min, begin, sizeof(float));
+    begin += sizeof(float);
+    memcpy(&block.max, begin, sizeof(float));
+    begin += sizeof(float);
+    memcpy(&block.sum, begin, sizeof(double));
+    begin += sizeof(double);
+
+    result.emplace_back(block);
+  }
+
+  KJ_REQUIRE(begin <= end);
+
+  return result;
+}
+
+// Returns the total encoded size of the blocks in a skip index.
+uint64_t SkipIndexDataSize(const std::vector<SkipIndexBlock>& blocks) {
+  uint64_t result = 0;
+  for (const auto& block : blocks) result += block.size;
+  return result;
+}
+
+// Adds a value to the last bucket in `output', or a new one if it belongs to
+// a later bucket.
+void AddToBucket(std::vector<ca_offset_score_bucket>* output,
+                 size_t output_size, uint64_t bucket_offset, uint64_t count,
+                 double sum, float min, float max) {
+  if (output->size() == output_size || output->back().offset != bucket_offset) {
+    output->emplace_back();
+    output->back().offset = bucket_offset;
+  }
+
+  auto& bucket = output->back();
+  bucket.count += count;
+  bucket.sum += sum;
+  bucket.min = std::min(bucket.min, min);
+  bucket.max = std::max(bucket.max, max);
+}
+
+struct ImpactBucket {
+  float min_score, max_score;
+  uint64_t size;
+};
+
+// Parses an impact index, after the type byte, and returns its buckets in
+// descending score order.  The buckets themselves follow the index.
+std::vector<ImpactBucket> ParseImpactIndex(const uint8_t*& begin,
+                                           const uint8_t* end,
+                                           uint64_t* value_count) {
+  *value_count = ca_parse_integer(&begin);
+  const auto count = ca_parse_integer(&begin);
+  KJ_REQUIRE(count <= static_cast<size_t>(end - begin), count);
+
+  std::vector<ImpactBucket> result;
+  result.reserve(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    ImpactBucket bucket;
+    KJ_REQUIRE(static_cast<size_t>(end - begin) >= 2 * sizeof(float));
+    memcpy(&bucket.min_score, begin, sizeof(float));
+    begin += sizeof(float);
+    memcpy(&bucket.max_score, begin, sizeof(float));
+    begin += sizeof(float);
+    bucket.size = ca_parse_integer(&begin);
+    result.emplace_back(bucket);
+  }
+
+  KJ_REQUIRE(begin <= end);
+
+  return result;
+}
+
+// Skips a sketch, after the type byte.
+void SkipSketch(const uint8_t*& begin, const uint8_t* end) {
+  const auto size = ca_parse_integer(&begin);
+  KJ_REQUIRE(size <= static_cast<uint64_t>(end - begin), size);
+  begin += size;
+}
+
+// Removes the sketch at the start of `input', if any.
+void SkipSketch(string_view& input) {
+  auto begin = reinterpret_cast<const uint8_t*>(input.begin());
+  const auto end = reinterpret_cast<const uint8_t*>(input.end());
+  if (begin == end || *begin != CA_OFFSET_SCORE_SKETCH) return;
+
+  ++begin;
+  SkipSketch(begin, end);
+  input = string_view(reinterpret_cast<const char*>(begin), end - begin);
+}
+
+// Skips an impact index and its buckets, leaving `begin' at the values in
+// offset order.
+void SkipImpactIndex(const uint8_t*& begin, const uint8_t* end) {
+  uint64_t value_count;
+  uint64_t size = 0;
+  for (const auto& bucket : ParseImpactIndex(begin, end, &value_count))
+    size += bucket.size;
+  KJ_REQUIRE(size <= static_cast<uint64_t>(end - begin));
+  begin += size;
+}
+
+}  // namespace
+
 void ca_offset_score_parse(string_view input,
                            std::vector<ca_offset_score>* output) {
+  auto& decode_stats = GetDecodeStats();
+
   while (!input.empty()) {
+    CheckDeadline();
+
     auto begin = reinterpret_cast<const uint8_t*>(input.begin());
     auto end = reinterpret_cast<const uint8_t*>(input.end());
     auto begin_save = begin;
@@ -546,24 +693,30 @@ void ca_offset_score_parse(string_view input,
     uint32_t uscore;
     uint32_t* pscore;
 
+    const auto output_size = output->size();
+
     auto type = static_cast<ca_offset_score_type>(*begin++);
 
     switch (type) {
-      case CA_OFFSET_SCORE_WITH_PREDICTION:
+      case CA_OFFSET_SCORE_WITH_PREDICTION: {
+        ScopedStatTimer timer(decode_stats.decode_ns);
         ParseOffsetScoreWithPrediction(begin, end, output);
-        break;
+      } break;
 
-      case CA_OFFSET_SCORE_FLEXI:
+      case CA_OFFSET_SCORE_FLEXI: {
+        ScopedStatTimer timer(decode_stats.decode_ns);
         ParseOffsetScoreFlexi(begin, end, output);
-        break;
+      } break;
 
-      case CA_OFFSET_SCORE_DELTA_OROCH_FLOAT:
+      case CA_OFFSET_SCORE_DELTA_OROCH_FLOAT: {
+        ScopedStatTimer timer(decode_stats.decode_ns);
         ParseOffsetScoreOroch(begin, end, output, false);
-        break;
+      } break;
 
-      case CA_OFFSET_SCORE_DELTA_OROCH_OROCH:
+      case CA_OFFSET_SCORE_DELTA_OROCH_OROCH: {
+        ScopedStatTimer timer(decode_stats.decode_ns);
         ParseOffsetScoreOroch(begin, end, output, true);
-        break;
+      } break;
 
       case CA_OFFSET_SCORE_SINGLE_FLOAT:
         oroch::varint_codec<uint64_t>::value_decode(offset, begin);
@@ -618,10 +771,25 @@ void ca_offset_score_parse(string_view input,
       case CA_OFFSET_SCORE_EMPTY:
         break;
 
+      case CA_OFFSET_SCORE_SKIP_INDEX:
+        // The blocks are decoded in the following iterations.
+        ParseSkipIndex(begin, end);
+        break;
+
+      case CA_OFFSET_SCORE_IMPACT_INDEX:
+        SkipImpactIndex(begin, end);
+        break;
+
+      case CA_OFFSET_SCORE_SKETCH:
+        SkipSketch(begin, end);
+        break;
+
       default:
         KJ_FAIL_REQUIRE("unknown offset score format", type);
     }
 
+    AddStat(decode_stats.postings[type], output->size() - output_size);
+
     input.remove_prefix(begin - begin_save);
   }
 }
@@ -681,6 +849,23 @@ size_t ca_offset_score_count(const uint8_t* begin, const uint8_t* end) {
       case CA_OFFSET_SCORE_EMPTY:
         break;
 
+      case CA_OFFSET_SCORE_SKIP_INDEX: {
+        // The index has the count of each block, so skip the blocks too.
+        const auto blocks = ParseSkipIndex(begin, end);
+        const auto size = SkipIndexDataSize(blocks);
+        KJ_REQUIRE(size <= static_cast<uint64_t>(end - begin));
+        for (const auto& block : blocks) result += block.count;
+        begin += size;
+      } break;
+
+      case CA_OFFSET_SCORE_IMPACT_INDEX:
+        SkipImpactIndex(begin, end);
+        break;
+
+      case CA_OFFSET_SCORE_SKETCH:
+        SkipSketch(begin, end);
+        break;
+
       default:
         KJ_FAIL_REQUIRE("unknown offset score format", type);
     }
@@ -807,6 +992,22 @@ uint64_t ca_offset_score_max_offset(const uint8_t* begin, const uint8_t* end) {
       case CA_OFFSET_SCORE_EMPTY:
         break;
 
+      case CA_OFFSET_SCORE_SKIP_INDEX: {
+        const auto blocks = ParseSkipIndex(begin, end);
+        const auto size = SkipIndexDataSize(blocks);
+        KJ_REQUIRE(size <= static_cast<uint64_t>(end - begin));
+        if (!blocks.empty()) offset = blocks.back().last_offset;
+        begin += size;
+      } break;
+
+      case CA_OFFSET_SCORE_IMPACT_INDEX:
+        SkipImpactIndex(begin, end);
+        break;
+
+      case CA_OFFSET_SCORE_SKETCH:
+        SkipSketch(begin, end);
+        break;
+
       default:
         KJ_FAIL_REQUIRE("unknown offset score format", type);
     }
@@ -817,5 +1018,260 @@ uint64_t ca_offset_score_max_offset(const uint8_t* begin, const uint8_t* end) {
   return result;
 }
 
+void ca_offset_score_parse_range(string_view input, uint64_t min_offset,
+                                 uint64_t max_offset,
+                                 std::vector<ca_offset_score>* output) {
+  SkipSketch(input);
+
+  const auto output_size = output->size();
+
+  auto begin = reinterpret_cast<const uint8_t*>(input.begin());
+  const auto end = reinterpret_cast<const uint8_t*>(input.end());
+
+  if (begin != end && *begin == CA_OFFSET_SCORE_SKIP_INDEX) {
+    ++begin;
+    const auto blocks = ParseSkipIndex(begin, end);
+
+    size_t skip = 0, i = 0;
+    for (; i < blocks.size() && blocks[i].last_offset < min_offset; ++i)
+      skip += blocks[i].size;
+
+    size_t size = 0;
+    for (; i < blocks.size() && blocks[i].first_offset <= max_offset; ++i)
+      size += blocks[i].size;
+
+    KJ_REQUIRE(skip + size <= static_cast<uint64_t>(end - begin));
+
+    input = string_view(reinterpret_cast<const char*>(begin + skip), size);
+  }
+
+  ca_offset_score_parse(input, output);
+
+  output->erase(std::remove_if(output->begin() + output_size, output->end(),
+                               [min_offset, max_offset](const auto& value) {
+                                 return value.offset < min_offset ||
+                                        value.offset > max_offset;
+                               }),
+                output->end());
+}
+
+void ca_offset_score_aggregate(string_view input, uint64_t min_offset,
+                               uint64_t max_offset, uint64_t bucket_size,
+                               std::vector<ca_offset_score_bucket>* output) {
+  KJ_REQUIRE(bucket_size > 0);
+
+  SkipSketch(input);
+
+  const auto output_size = output->size();
+
+  std::vector<ca_offset_score> values;
+  const auto add_values = [&] {
+    std::stable_sort(values.begin(), values.end(),
+                     [](const auto& lhs, const auto& rhs) {
+                       return lhs.offset < rhs.offset;
+                     });
+    for (const auto& value : values) {
+      if (value.offset < min_offset || value.offset > max_offset) continue;
+      AddToBucket(output, output_size,
+                  value.offset - value.offset % bucket_size, 1, value.score,
+                  value.score, value.score);
+    }
+    values.clear();
+  };
+
+  auto begin = reinterpret_cast<const uint8_t*>(input.begin());
+  const auto end = reinterpret_cast<const uint8_t*>(input.end());
+
+  if (begin == end || *begin != CA_OFFSET_SCORE_SKIP_INDEX) {
+    ca_offset_score_parse(input, &values);
+    add_values();
+    return;
+  }
+
+  ++begin;
+  const auto blocks = ParseSkipIndex(begin, end);
+  KJ_REQUIRE(SkipIndexDataSize(blocks) <= static_cast<uint64_t>(end - begin));
+
+  for (const auto& block : blocks) {
+    const auto block_begin = begin;
+    begin += block.size;
+
+    if (block.last_offset < min_offset || block.first_offset > max_offset)
+      continue;
+
+    const auto bucket_offset =
+        block.first_offset - block.first_offset % bucket_size;
+
+    if (block.first_offset >= min_offset && block.last_offset <= max_offset &&
+        block.last_offset - bucket_offset < bucket_size) {
+      AddToBucket(output, output_size, bucket_offset, block.count, block.sum,
+                  block.min, block.max);
+      continue;
+    }
+
+    ca_offset_score_parse(
+        string_view(reinterpret_cast<const char*>(block_begin), block.size),
+        &values);
+    add_values();
+  }
+}
+
+void ca_offset_score_parse_score_range(string_view input, double min_score,
+                                       double max_score,
+                                       std::vector<ca_offset_score>* output) {
+  SkipSketch(input);
+
+  const auto output_size = output->size();
+
+  auto begin = reinterpret_cast<const uint8_t*>(input.begin());
+  const auto end = reinterpret_cast<const uint8_t*>(input.end());
+
+  if (begin != end && *begin == CA_OFFSET_SCORE_IMPACT_INDEX) {
+    ++begin;
+    uint64_t value_count;
+    const auto buckets = ParseImpactIndex(begin, end, &value_count);
+
+    for (const auto& bucket : buckets) {
+      KJ_REQUIRE(bucket.size <= static_cast<uint64_t>(end - begin));
+      if (bucket.max_score >= min_score && bucket.min_score <= max_score) {
+        ca_offset_score_parse(
+            string_view(reinterpret_cast<const char*>(begin), bucket.size),
+            output);
+      }
+      begin += bucket.size;
+    }
+  } else {
+    ca_offset_score_parse(input, output);
+  }
+
+  output->erase(std::remove_if(output->begin() + output_size, output->end(),
+                               [min_score, max_score](const auto& value) {
+                                 return !(value.score >= min_score &&
+                                          value.score <= max_score);
+                               }),
+                output->end());
+
+  std::sort(
+      output->begin() + output_size, output->end(),
+      [](const auto& lhs, const auto& rhs) { return lhs.offset < rhs.offset; });
+}
+
+size_t ca_offset_score_parse_top(string_view input, size_t count,
+                                 std::vector<ca_offset_score>* output) {
+  SkipSketch(input);
+
+  const auto output_size = output->size();
+
+  auto begin = reinterpret_cast<const uint8_t*>(input.begin());
+  const auto end = reinterpret_cast<const uint8_t*>(input.end());
+
+  if (begin == end || *begin != CA_OFFSET_SCORE_IMPACT_INDEX) {
+    ca_offset_score_parse(input, output);
+    return output->size() - output_size;
+  }
+
+  ++begin;
+  uint64_t value_count;
+  const auto buckets = ParseImpactIndex(begin, end, &value_count);
+
+  // Values with the same score as the last value needed may be in the next
+  // bucket too, so stop at the first bucket with strictly lower scores.
+  auto min_score = std::numeric_limits<float>::infinity();
+  for (const auto& bucket : buckets) {
+    const auto decoded = output->size() - output_size;
+    if (decoded >= count && bucket.max_score < min_score) break;
+
+    KJ_REQUIRE(bucket.size <= static_cast<uint64_t>(end - begin));
+    ca_offset_score_parse(
+        string_view(reinterpret_cast<const char*>(begin), bucket.size),
+        output);
+    begin += bucket.size;
+    min_score = bucket.min_score;
+  }
+
+  return value_count;
+}
+
+void ca_offset_score_lookup(string_view input, const ca_offset_score* keys,
+                            size_t key_count,
+                            std::vector<ca_offset_score>* output,
+                            ca_offset_score_bucket* summary) {
+  SkipSketch(input);
+
+  const auto keys_end = keys + key_count;
+
+  std::vector<ca_offset_score> values;
+
+  // Moves the values whose offsets are in `keys' from `values' to `output'.
+  const auto add_values = [&output, &values, keys, keys_end] {
+    if (values.empty()) return;
+    auto key = std::lower_bound(
+        keys, keys_end, values.front().offset,
+        [](const auto& lhs, uint64_t rhs) { return lhs.offset < rhs; });
+    for (const auto& value : values) {
+      while (key != keys_end && key->offset < value.offset) ++key;
+      if (key == keys_end) break;
+      if (key->offset == value.offset) output->emplace_back(value);
+    }
+    values.clear();
+  };
+
+  auto begin = reinterpret_cast<const uint8_t*>(input.begin());
+  const auto end = reinterpret_cast<const uint8_t*>(input.end());
+
+  if (begin != end && *begin == CA_OFFSET_SCORE_IMPACT_INDEX) {
+    ++begin;
+    SkipImpactIndex(begin, end);
+  }
+
+  if (begin == end || *begin != CA_OFFSET_SCORE_SKIP_INDEX) {
+    ca_offset_score_parse(
+        string_view(reinterpret_cast<const char*>(begin), end - begin),
+        &values);
+
+    if (summary) {
+      *summary = ca_offset_score_bucket();
+      for (const auto& value : values) {
+        ++summary->count;
+        summary->sum += value.score;
+        summary->min = std::min(summary->min, value.score);
+        summary->max = std::max(summary->max, value.score);
+      }
+    }
+
+    add_values();
+    return;
+  }
+
+  ++begin;
+  const auto blocks = ParseSkipIndex(begin, end);
+  KJ_REQUIRE(SkipIndexDataSize(blocks) <= static_cast<uint64_t>(end - begin));
+
+  if (summary) {
+    *summary = ca_offset_score_bucket();
+    for (const auto& block : blocks) {
+      summary->count += block.count;
+      summary->sum += block.sum;
+      summary->min = std::min(summary->min, block.min);
+      summary->max = std::max(summary->max, block.max);
+    }
+  }
+
+  auto key = keys;
+  for (const auto& block : blocks) {
+    const auto block_begin = begin;
+    begin += block.size;
+
+    while (key != keys_end && key->offset < block.first_offset) ++key;
+    if (key == keys_end) break;
+    if (key->offset > block.last_offset) continue;
+
+    ca_offset_score_parse(
+        string_view(reinterpret_cast<const char*>(block_begin), block.size),
+        &values);
+    add_values();
+  }
+}
+
 }  // namespace table
 }  // namespace cantera
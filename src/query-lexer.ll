@@ -63,6 +63,7 @@ Z [zZ]
 {A}{N}{D}\ {N}{O}{T}               { character += yyleng; return AND_NOT; }
 {C}{O}{R}{R}{E}{L}{A}{T}{E}        { character += yyleng; return CORRELATE; }
 {C}{S}{V}                          { character += yyleng; return CSV; }
+{E}{S}{T}{I}{M}{A}{T}{E}\ {C}{O}{U}{N}{T} { character += yyleng; return ESTIMATE_COUNT; }
 {F}{A}{L}{S}{E}                    { character += yyleng; return FALSE; }
 {F}{E}{T}{C}{H}                    { character += yyleng; return FETCH; }
 {F}{I}{R}{S}{T}                    { character += yyleng; return FIRST; }
@@ -74,6 +75,7 @@ Z [zZ]
 {K}{E}{Y}{S}                       { character += yyleng; return KEYS; }
 {L}{I}{M}{I}{T}                    { character += yyleng; return LIMIT; }
 {M}{A}{X}                          { character += yyleng; return MAX; }
+{M}{E}{M}{O}{R}{Y}                 { character += yyleng; return MEMORY; }
 {M}{I}{N}                          { character += yyleng; return MIN; }
 {N}{E}{X}{T}                       { character += yyleng; return NEXT; }
 {N}{O}{T}                          { character += yyleng; return NOT; }
@@ -85,15 +87,21 @@ Z [zZ]
 {P}{A}{R}{S}{E}                    { character += yyleng; return PARSE; }
 {Q}{U}{E}{R}{Y}                    { character += yyleng; return QUERY; }
 {R}{A}{N}{D}{O}{M}_{S}{A}{M}{P}{L}{E} { character += yyleng; return RANDOM_SAMPLE; }
+{R}{E}{L}{O}{A}{D}                 { character += yyleng; return RELOAD; }
 {R}{O}{W}                          { character += yyleng; return ROW; }
 {R}{O}{W}{S}                       { character += yyleng; return ROWS; }
+{S}{C}{H}{E}{M}{A}                 { character += yyleng; return SCHEMA; }
 {S}{E}{L}{E}{C}{T}                 { character += yyleng; return SELECT; }
 {S}{E}{T}                          { character += yyleng; return SET; }
 {S}{H}{O}{W}                       { character += yyleng; return SHOW; }
+{S}{T}{A}{T}{E}{M}{E}{N}{T}        { character += yyleng; return STATEMENT; }
+{S}{T}{A}{T}{S}                    { character += yyleng; return STATS; }
 {S}{U}{M}{M}{A}{R}{I}{E}{S}        { character += yyleng; return SUMMARIES; }
 {T}{E}{X}{T}                       { character += yyleng; return TEXT; }
 {T}{H}{R}{E}{S}{H}{O}{L}{D}{S}     { character += yyleng; return THRESHOLDS; }
 {T}{I}{M}{E}                       { character += yyleng; return TIME; }
+{T}{I}{M}{E}{O}{U}{T}              { character += yyleng; return TIMEOUT; }
+{T}{R}{A}{C}{E}                    { character += yyleng; return TRACE; }
 {V}{A}{L}{U}{E}{S}                 { character += yyleng; return VALUES; }
 {W}{I}{T}{H}                       { character += yyleng; return WITH; }
 
@@ -170,6 +178,10 @@ namespace table {
 void CA_parse_script(QueryParseContext* context, FILE* input) {
   YY_BUFFER_STATE buf;
 
+  // Drop statements queued by a script that failed to parse.
+  context->batch = nullptr;
+  context->batch_tail = &context->batch;
+
   yylex_init(&context->scanner);
 
   if (NULL != (buf = yy_create_buffer(input, YY_BUF_SIZE, context->scanner))) {
@@ -185,6 +197,8 @@ void CA_parse_script(QueryParseContext* context, FILE* input) {
   }
 
   yylex_destroy(context->scanner);
+
+  if (context->batch_mode) CA_process_batch(context);
 }
 
 }  // namespace table
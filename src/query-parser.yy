@@ -56,14 +56,16 @@ yyerror (YYLTYPE *loc, QueryParseContext *context, const char *message);
 %}
 
 %token AND CREATE FROM INDEX KEY LIMIT NOT OFFSET_SCORE OR PATH PRIMARY QUERY
-%token AND_NOT SHOW TABLES TEXT TIME UTF8BOM KEYS
+%token AND_NOT SHOW STATS TABLES TEXT TIME UTF8BOM KEYS
 %token WHERE WITH SUMMARIES
 %token OFFSET FETCH FIRST NEXT ROW ROWS ONLY
 %token TRUE FALSE
 %token INTO VALUES ORDER_BY
 %token SELECT MAX MIN RANDOM_SAMPLE
 %token SET OUTPUT FORMAT CSV JSON
-%token CORRELATE PARSE
+%token CORRELATE PARSE ESTIMATE_COUNT
+%token RELOAD SCHEMA TRACE
+%token MEMORY STATEMENT TIMEOUT
 %token THRESHOLDS FOR
 
 %token Date
@@ -100,13 +102,11 @@ document
 topStatements
     : topStatements statement ';'
       {
-        CA_process_statement (context, $2);
-        fflush (stdout);
+        CA_submit_statement (context, $2);
       }
     | statement ';'
       {
-        CA_process_statement (context, $1);
-        fflush (stdout);
+        CA_submit_statement (context, $1);
       }
     ;
 
@@ -142,6 +142,15 @@ statement
         query->query_A = $3;
         query->query_B = $5;
 
+        $$ = stmt;
+      }
+    | ESTIMATE_COUNT QUERY query
+      {
+        Statement* stmt;
+        ALLOC(stmt);
+        stmt->type = kStatementEstimateCount;
+        stmt->u.estimate_count.query = $3;
+
         $$ = stmt;
       }
     | PARSE subQueryList
@@ -151,6 +160,14 @@ statement
         stmt->type = kStatementParse;
         stmt->u.parse.query = $2;
 
+        $$ = stmt;
+      }
+    | RELOAD SCHEMA
+      {
+        Statement* stmt;
+        ALLOC(stmt);
+        stmt->type = kStatementReloadSchema;
+
         $$ = stmt;
       }
     | SELECT queryList FROM query optionalWithSummaries
@@ -178,6 +195,14 @@ statement
         set->parameter = $2;
         set->v.enum_value = $3;
 
+        $$ = stmt;
+      }
+    | SHOW STATS
+      {
+        Statement* stmt;
+        ALLOC(stmt);
+        stmt->type = kStatementShowStats;
+
         $$ = stmt;
       }
     | SET TIME FORMAT StringLiteral
@@ -191,6 +216,58 @@ statement
         set->parameter = CA_PARAM_TIME_FORMAT;
         set->v.string_value = $4;
 
+        $$ = stmt;
+      }
+    | SET TRACE StringLiteral
+      {
+        Statement *stmt;
+        struct set_statement *set;
+
+        ALLOC (stmt);
+        stmt->type = kStatementSet;
+        set = &stmt->u.set;
+        set->parameter = CA_PARAM_TRACE;
+        set->v.string_value = $3;
+
+        $$ = stmt;
+      }
+    | SET TRACE FALSE
+      {
+        Statement *stmt;
+        struct set_statement *set;
+
+        ALLOC (stmt);
+        stmt->type = kStatementSet;
+        set = &stmt->u.set;
+        set->parameter = CA_PARAM_TRACE;
+        set->v.string_value = nullptr;
+
+        $$ = stmt;
+      }
+    | SET MEMORY LIMIT Integer
+      {
+        Statement *stmt;
+        struct set_statement *set;
+
+        ALLOC (stmt);
+        stmt->type = kStatementSet;
+        set = &stmt->u.set;
+        set->parameter = CA_PARAM_MEMORY_LIMIT;
+        set->v.int_value = $4;
+
+        $$ = stmt;
+      }
+    | SET STATEMENT TIMEOUT Integer
+      {
+        Statement *stmt;
+        struct set_statement *set;
+
+        ALLOC (stmt);
+        stmt->type = kStatementSet;
+        set = &stmt->u.set;
+        set->parameter = CA_PARAM_STATEMENT_TIMEOUT;
+        set->v.int_value = $4;
+
         $$ = stmt;
       }
     ;
@@ -27,9 +27,11 @@
 #include <ctime>
 #include <iostream>
 #include <limits>
+#include <map>
 #include <memory>
 #include <random>
 #include <set>
+#include <tuple>
 #include <unordered_map>
 
 #include <ca-cas/client.h>
@@ -39,8 +41,14 @@
 #include <kj/debug.h>
 
 #include "src/ca-table.h"
+#include "src/cas-cache.h"
+#include "src/deadline.h"
 #include "src/keywords.h"
+#include "src/memory-budget.h"
 #include "src/query.h"
+#include "src/sketch.h"
+#include "src/thread-pool.h"
+#include "src/trace.h"
 #include "src/util.h"
 
 #if !HAVE_FWRITE_UNLOCKED
@@ -54,10 +62,27 @@ using namespace internal;
 
 namespace {
 
-std::unordered_map<uint64_t, Json::Value> extra_data;
+// The approximate memory used by each element of an std::set<uint64_t>,
+// for charging it to the statement's memory budget.
+constexpr size_t kSetNodeSize = 48;
 
-std::unique_ptr<kj::AsyncIoContext> aio_context;
-std::unique_ptr<cantera::CASClient> cas_client;
+// An intersection with a large key on the left is evaluated right side first
+// if the key is estimated to have this many times more values.
+constexpr double kReorderRatio = 8;
+
+// Keys with fewer values are cheap enough to decode in full.
+constexpr double kMinReorderCount = 4096;
+
+// Extra JSON members for the results of the current query, set by
+// "FIELD-in:KEY" keywords.  Thread local, since shards are queried in
+// parallel, as are the CAS client and its event loop.
+thread_local std::unordered_map<uint64_t, Json::Value> extra_data;
+
+// The innermost IndexKeyPrefetch of this thread.
+thread_local IndexKeyPrefetch* current_prefetch;
+
+thread_local std::unique_ptr<kj::AsyncIoContext> aio_context;
+thread_local std::unique_ptr<cantera::CASClient> cas_client;
 
 void CreateCASClient() {
   // TODO(mortehu): Create this in `main()` instead.
@@ -65,6 +90,37 @@ void CreateCASClient() {
   cas_client = std::make_unique<cantera::CASClient>(*aio_context);
 }
 
+size_t cas_cache_memory_limit = 64 << 20;
+std::string cas_cache_directory;
+
+CASCache& GetCASCache() {
+  static CASCache result(
+      [](const std::string& key) {
+        if (!cas_client) CreateCASClient();
+        return cas_client->Get(key);
+      },
+      cas_cache_memory_limit, cas_cache_directory);
+  return result;
+}
+
+bool IsCASKeyword(const char* token) {
+  const char* delimiter = strchr(token, ':');
+  return delimiter > token + 3 && !memcmp(delimiter - 3, "-in", 3);
+}
+
+// Adds the CAS keys of the "FIELD-in:KEY" keywords in `query' to `keys'.
+void CollectCASKeys(const Query* query, std::vector<std::string>& keys) {
+  if (!query) return;
+
+  if (query->type == kQueryLeaf && IsCASKeyword(query->identifier)) {
+    keys.emplace_back(strchr(query->identifier, ':') + 1);
+    return;
+  }
+
+  CollectCASKeys(query->lhs, keys);
+  CollectCASKeys(query->rhs, keys);
+}
+
 std::vector<ca_offset_score> UnionOffsets(
     const std::vector<ca_offset_score>& lhs,
     const std::vector<ca_offset_score>& rhs) {
@@ -124,15 +180,6 @@ size_t IntersectOffsets(struct ca_offset_score* lhs, size_t lhs_count,
   return o - output;
 }
 
-// Checks whether a string may be a valid domain name.
-bool IsValidDomainName(const std::string& name) {
-  if (name.size() < 3) return false;
-
-  if (name[0] == '.' || name.back() == '.') return false;
-
-  return true;
-}
-
 // Removes duplicate offsets, keeping either the maximum or minimum score.
 void RemoveDuplicates(std::vector<ca_offset_score>& data, const bool use_max) {
   auto in = data.begin();
@@ -168,6 +215,108 @@ std::string TimeToDateString(double time) {
   return result;
 }
 
+const char* QueryTraceName(const Query* query) {
+  switch (query->type) {
+    case kQueryKey:
+      return "key";
+    case kQueryLeaf:
+      return "leaf";
+    default:
+      break;
+  }
+
+  switch (query->operator_type) {
+    case kOperatorOr:
+      return "or";
+    case kOperatorAnd:
+      return "and";
+    case kOperatorSubtract:
+      return "subtract";
+    case kOperatorEQ:
+    case kOperatorGT:
+    case kOperatorGE:
+    case kOperatorLT:
+    case kOperatorLE:
+    case kOperatorInRange:
+      return "filter";
+    case kOperatorOrderBy:
+      return "order-by";
+    case kOperatorRandomSample:
+      return "random-sample";
+    case kOperatorMax:
+      return "max";
+    case kOperatorMin:
+      return "min";
+    case kOperatorNegate:
+      return "negate";
+  }
+
+  return "operator";
+}
+
+// Returns the number of values in the posting list `data', without decoding
+// them.
+size_t CountPostings(const string_view& data) {
+  return ca_offset_score_count(reinterpret_cast<const uint8_t*>(data.begin()),
+                               reinterpret_cast<const uint8_t*>(data.end()));
+}
+
+// Returns true if `query' is a plain index key, rather than one of the
+// special keywords handled by LookupIndexKey().
+bool IsPlainIndexKey(const Query* query) {
+  if (query->type != kQueryLeaf) return false;
+
+  const auto token = query->identifier;
+
+  if (IsCASKeyword(token)) return false;
+  if (!strncmp(token, "in-", 3)) return false;
+
+  return true;
+}
+
+// Returns the inclusive score range of a filter operator with a scalar
+// operand, for use with ca_offset_score_parse_score_range().  The filter must
+// still be applied to the result, since its bounds may be exclusive.
+bool GetFilterScoreRange(const Query* query, double* min_score,
+                         double* max_score) {
+  if (query->type != kQueryBinaryOperator) return false;
+
+  *min_score = -HUGE_VAL;
+  *max_score = HUGE_VAL;
+
+  switch (query->operator_type) {
+    case kOperatorEQ:
+      *min_score = *max_score = query->value;
+      return true;
+
+    case kOperatorGT:
+      if (query->rhs) return false;
+      *min_score = query->value;
+      return true;
+
+    case kOperatorGE:
+      *min_score = query->value;
+      return true;
+
+    case kOperatorLT:
+      if (query->rhs) return false;
+      *max_score = query->value;
+      return true;
+
+    case kOperatorLE:
+      *max_score = query->value;
+      return true;
+
+    case kOperatorInRange:
+      *min_score = std::min(query->value, query->value2);
+      *max_score = std::max(query->value, query->value2);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
 template <typename Filter>
 void Join(std::vector<ca_offset_score>& lhs,
           const std::vector<ca_offset_score>& rhs, Filter filter) {
@@ -195,19 +344,138 @@ void Join(std::vector<ca_offset_score>& lhs,
   lhs.erase(out, lhs.end());
 }
 
+// Evaluates each distinct subtree of a query once.  Generated queries often
+// repeat a subtree, such as a keyword used both as a filter and in ORDER BY.
+// Subtrees are identified by structure, and results of those that occur more
+// than once are kept until their last use, which takes the result instead of
+// copying it.
+class SubQueryCache {
+ public:
+  explicit SubQueryCache(const Query* query) {
+    Canonicalize(query);
+    CountUses(query);
+  }
+
+  KJ_DISALLOW_COPY(SubQueryCache);
+
+  // Returns true if the result of `query' is, or will be, kept for another
+  // use.  Such subtrees must be evaluated in full by ProcessSubQuery(), not
+  // read partially, so that later uses can take the result.
+  bool IsShared(const Query* query) const {
+    const auto entry = entries_.find(canonical_.at(query));
+    return entry != entries_.end() &&
+           (entry->second.evaluated || entry->second.uses > 1);
+  }
+
+  // Stores the result of an earlier evaluation of `query' in `offsets', and
+  // returns true if there is one.
+  bool Take(const Query* query, std::vector<ca_offset_score>& offsets) {
+    auto entry = entries_.find(canonical_.at(query));
+    if (entry == entries_.end() || !entry->second.evaluated) return false;
+
+    if (--entry->second.uses) {
+      offsets = entry->second.offsets;
+    } else {
+      offsets = std::move(entry->second.offsets);
+      entries_.erase(entry);
+    }
+
+    return true;
+  }
+
+  // Keeps the result of `query' if it will be used again.
+  void Store(const Query* query, const std::vector<ca_offset_score>& offsets) {
+    auto entry = entries_.find(canonical_.at(query));
+    if (entry == entries_.end() || !--entry->second.uses) return;
+
+    entry->second.offsets = offsets;
+    entry->second.memory.Set(entry->second.offsets);
+    entry->second.evaluated = true;
+  }
+
+ private:
+  struct Entry {
+    // The number of evaluations of the subtree left in the query.
+    size_t uses = 0;
+
+    bool evaluated = false;
+    std::vector<ca_offset_score> offsets;
+    MemoryCharge memory;
+  };
+
+  // A node's own fields, and the canonical nodes of its children.  Scores are
+  // compared by bit pattern.
+  using NodeKey = std::tuple<int, std::string, int, uint64_t, uint64_t,
+                             const Query*, const Query*>;
+
+  static uint64_t Bits(double value) {
+    uint64_t result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+  }
+
+  // Maps `query' and its descendants to the first node with the same
+  // structure, and returns the node for `query'.
+  const Query* Canonicalize(const Query* query) {
+    if (!query) return nullptr;
+
+    const auto lhs = Canonicalize(query->lhs);
+    const auto rhs = Canonicalize(query->rhs);
+
+    NodeKey key{query->type, "", 0, 0, 0, lhs, rhs};
+    if (query->type == kQueryKey || query->type == kQueryLeaf) {
+      std::get<1>(key) = query->identifier;
+    } else {
+      std::get<2>(key) = query->operator_type;
+      std::get<3>(key) = Bits(query->value);
+      std::get<4>(key) = Bits(query->value2);
+    }
+
+    const auto result = nodes_.emplace(std::move(key), query).first->second;
+    canonical_[query] = result;
+    return result;
+  }
+
+  // Counts the evaluations of every distinct subtree.  The descendants of a
+  // repeated subtree are only evaluated the first time.
+  void CountUses(const Query* query) {
+    if (!query) return;
+
+    auto& entry = entries_[canonical_.at(query)];
+    if (entry.uses++) return;
+
+    CountUses(query->lhs);
+    CountUses(query->rhs);
+  }
+
+  std::map<NodeKey, const Query*> nodes_;
+  std::unordered_map<const Query*, const Query*> canonical_;
+  std::unordered_map<const Query*, Entry> entries_;
+};
+
 }  // namespace
 
 void LookupIndexKey(
-    const std::vector<std::unique_ptr<Table>>& index_tables,
-    const char* key,
+    Schema* schema, const char* key,
     std::function<void(std::vector<ca_offset_score>)>&& callback) {
+  CA_TRACE_SPAN("query", "LookupIndexKey", key);
+
+  if (const auto lists = IndexKeyPrefetch::Find(schema, key)) {
+    for (const auto& list : *lists) callback(list);
+    return;
+  }
+
   const auto unescaped_key = DecodeURIComponent(key);
 
-  for (size_t i = 0; i < index_tables.size(); ++i) {
-    if (!index_tables[i]->SeekToKey(unescaped_key)) continue;
+  for (auto index_table : schema->IndexTablesForKey(unescaped_key)) {
+    if (!index_table->SeekToKey(unescaped_key)) continue;
 
     string_view key, data;
-    KJ_REQUIRE(index_tables[i]->ReadRow(key, data));
+    KJ_REQUIRE(index_table->ReadRow(key, data));
+
+    // Fails before decoding a list that would not fit.
+    MemoryCharge memory;
+    memory.Set(CountPostings(data) * sizeof(ca_offset_score));
 
     std::vector<ca_offset_score> new_offsets;
     ca_offset_score_parse(data, &new_offsets);
@@ -217,12 +485,11 @@ void LookupIndexKey(
 }
 
 void LookupIndexKey(
-    const std::vector<std::unique_ptr<Table>>& index_tables,
-    const char* token, bool make_headers,
+    Schema* schema, const char* token, bool make_headers,
     std::function<void(std::vector<ca_offset_score>)>&& callback) {
   const char *delimiter = strchr(token, ':');
 
-  if (delimiter > token + 3 && !memcmp(delimiter - 3, "-in", 3)) {
+  if (IsCASKeyword(token)) {
     // The "FIELD-in:KEY" keyword retrieves an object from CAS using the
     // provided key, and extracts DNS names from that object.  Each of these
     // names are looked up with the "FIELD" prefix, and added to the results.
@@ -236,68 +503,38 @@ void LookupIndexKey(
     if (field == "links:") field = "name:";
     // TODO(mortehu): Actually make this work with more than one data type.
 
-    std::string key = delimiter + 1;
-    if (!cas_client) CreateCASClient();
-    auto data = cas_client->Get(key);
-
-    std::unordered_map<std::string, std::pair<std::string, std::string>> names;
-    auto add_name = [&names](std::string name, const std::string& header,
-                             const std::string& header_key) {
-      if (HasPrefix(name, "www.")) name.erase(0, 4);
-      if (IsValidDomainName(name))
-        names.emplace(std::move(name), std::make_pair(header, header_key));
-    };
-
-    std::string name, header, header_key;
-    bool in_header = false;
-    size_t header_idx = 0;
-    for (auto ch : data) {
-      if (in_header) {
-        if (std::isalnum(ch) || strchr(" .,_&-", ch)) {
-          header.push_back(ch);
-        } else if (ch == '}') {
-          header_key = StringPrintf("%06zu", header_idx++);
-          in_header = false;
-        } else {
-          header.clear();
-          in_header = false;
-        }
-      } else if (ch == '{') {
-        in_header = true;
-        header.clear();
-      } else if (std::isalnum(ch) || ch == '.' || ch == '-') {
-        name.push_back(std::tolower(ch));
-      } else if (!name.empty()) {
-        add_name(std::move(name), header, header_key);
-        assert(name.empty());
-      }
-    }
-    if (!name.empty()) add_name(std::move(name), header, header_key);
+    const auto names = GetCASCache().Get(std::string(delimiter + 1));
 
     // The UnionOffsets function is expensive if one of the arrays is big, so
     // we use an std::set to get unique sorted elements instead.
     std::set<uint64_t> offset_buffer;
+    MemoryCharge buffer_memory;
 
     // Look up one "name:X" token per potential hostname found.
-    for (const auto& name : names) {
+    for (const auto& name : *names) {
+      CheckDeadline();
       LookupIndexKey(
-          index_tables, (field + name.first).c_str(),
-          [&name, &header_key, &offset_buffer, make_headers](auto new_offsets) {
+          schema, (field + name.name).c_str(),
+          [&name, &offset_buffer, make_headers](auto new_offsets) {
             for (const auto& offset : new_offsets) {
               offset_buffer.emplace(offset.offset);
 
               // Record headers.
-              if (!name.second.first.empty() && !make_headers) {
+              if (!name.header.empty() && !make_headers) {
                 extra_data[offset.offset]["_header"] =
-                    Json::Value(name.second.first);
+                    Json::Value(name.header);
                 extra_data[offset.offset]["_header_key"] =
-                    Json::Value(name.second.second);
+                    Json::Value(name.header_key);
               }
             }
           });
+      buffer_memory.Set(offset_buffer.size() * kSetNodeSize);
     }
 
     std::vector<ca_offset_score> tmp;
+    MemoryCharge tmp_memory;
+    tmp_memory.Set(offset_buffer.size() * sizeof(ca_offset_score));
+    tmp.reserve(offset_buffer.size());
     for (auto offset : offset_buffer) tmp.emplace_back(offset, 0.0f);
     callback(std::move(tmp));
   } else if (!strncmp(token, "in-", 3)) {
@@ -311,7 +548,9 @@ void LookupIndexKey(
     // The UnionOffsets function is expensive if one of the arrays is big, so
     // we use an std::set to get unique sorted elements instead.
     std::set<uint64_t> offset_buffer;
+    MemoryCharge buffer_memory;
 
+    auto& index_tables = schema->IndexTables();
     for (size_t i = 0; i < index_tables.size(); ++i) {
       index_tables[i]->SeekToFirst();
 
@@ -320,6 +559,8 @@ void LookupIndexKey(
 
       string_view row_key, data;
       while (index_tables[i]->ReadRow(row_key, data)) {
+        CheckDeadline();
+
         std::vector<ca_offset_score> new_offsets;
 
         if (!HasPrefix(row_key, key)) {
@@ -339,14 +580,129 @@ void LookupIndexKey(
 
         for (const auto& offset : new_offsets)
           offset_buffer.emplace(offset.offset);
+        buffer_memory.Set(offset_buffer.size() * kSetNodeSize);
       }
     }
 
     std::vector<ca_offset_score> tmp;
+    MemoryCharge tmp_memory;
+    tmp_memory.Set(offset_buffer.size() * sizeof(ca_offset_score));
+    tmp.reserve(offset_buffer.size());
     for (auto offset : offset_buffer) tmp.emplace_back(offset, 0.0f);
     callback(std::move(tmp));
   } else {
-    LookupIndexKey(index_tables, token, std::move(callback));
+    LookupIndexKey(schema, token, std::move(callback));
+  }
+}
+
+void LookupIndexKeyScoreRange(
+    Schema* schema, const char* key, double min_score, double max_score,
+    std::function<void(std::vector<ca_offset_score>)>&& callback) {
+  CA_TRACE_SPAN("query", "LookupIndexKeyScoreRange", key);
+
+  // Callers filter the values anyway, so a prefetched list is used as is.
+  if (const auto lists = IndexKeyPrefetch::Find(schema, key)) {
+    for (const auto& list : *lists) callback(list);
+    return;
+  }
+
+  const auto unescaped_key = DecodeURIComponent(key);
+
+  for (auto index_table : schema->IndexTablesForKey(unescaped_key)) {
+    if (!index_table->SeekToKey(unescaped_key)) continue;
+
+    string_view key, data;
+    KJ_REQUIRE(index_table->ReadRow(key, data));
+
+    // Fails before decoding a list that would not fit, in case every value
+    // is in range.
+    MemoryCharge memory;
+    memory.Set(CountPostings(data) * sizeof(ca_offset_score));
+
+    std::vector<ca_offset_score> new_offsets;
+    ca_offset_score_parse_score_range(data, min_score, max_score,
+                                      &new_offsets);
+
+    callback(std::move(new_offsets));
+  }
+}
+
+// Like LookupIndexKey(), but may leave out values not among the `count'
+// highest scoring.  The callback also receives the total number of values.
+void LookupIndexKeyTop(
+    Schema* schema, const char* key, size_t count,
+    std::function<void(std::vector<ca_offset_score>, size_t)>&& callback) {
+  CA_TRACE_SPAN("query", "LookupIndexKeyTop", key);
+
+  if (const auto lists = IndexKeyPrefetch::Find(schema, key)) {
+    for (const auto& list : *lists) callback(list, list.size());
+    return;
+  }
+
+  const auto unescaped_key = DecodeURIComponent(key);
+
+  for (auto index_table : schema->IndexTablesForKey(unescaped_key)) {
+    if (!index_table->SeekToKey(unescaped_key)) continue;
+
+    string_view key, data;
+    KJ_REQUIRE(index_table->ReadRow(key, data));
+
+    // Fails before decoding a list that would not fit.  Lists without an
+    // impact index are decoded in full.
+    MemoryCharge memory;
+    memory.Set(CountPostings(data) * sizeof(ca_offset_score));
+
+    std::vector<ca_offset_score> new_offsets;
+    const auto total = ca_offset_score_parse_top(data, count, &new_offsets);
+
+    callback(std::move(new_offsets), total);
+  }
+}
+
+// Like LookupIndexKey(), but only returns values whose offsets are in
+// `keys', which must be sorted by offset.  The callback also receives a
+// summary of all values of the key.
+void LookupIndexKeyOffsets(
+    Schema* schema, const char* key,
+    const std::vector<ca_offset_score>& keys,
+    std::function<void(std::vector<ca_offset_score>,
+                       const ca_offset_score_bucket&)>&& callback) {
+  CA_TRACE_SPAN("query", "LookupIndexKeyOffsets", key);
+
+  // Callers ignore values outside `keys', so a prefetched list is used as is.
+  if (const auto lists = IndexKeyPrefetch::Find(schema, key)) {
+    for (const auto& list : *lists) {
+      ca_offset_score_bucket summary;
+      for (const auto& v : list) {
+        ++summary.count;
+        summary.sum += v.score;
+        summary.min = std::min(summary.min, v.score);
+        summary.max = std::max(summary.max, v.score);
+      }
+      callback(list, summary);
+    }
+    return;
+  }
+
+  const auto unescaped_key = DecodeURIComponent(key);
+
+  for (auto index_table : schema->IndexTablesForKey(unescaped_key)) {
+    if (!index_table->SeekToKey(unescaped_key)) continue;
+
+    string_view key, data;
+    KJ_REQUIRE(index_table->ReadRow(key, data));
+
+    // Fails before decoding a list that would not fit.  Lists without a skip
+    // index are decoded in full.
+    MemoryCharge memory;
+    memory.Set(CountPostings(data) * sizeof(ca_offset_score));
+
+    std::vector<ca_offset_score> new_offsets;
+    ca_offset_score_bucket summary;
+    ca_offset_score_lookup(data, keys.data(), keys.size(), &new_offsets,
+                           &summary);
+
+    callback(std::move(new_offsets), summary);
   }
 }
 
@@ -386,8 +742,122 @@ size_t SubtractOffsets(struct ca_offset_score* lhs, size_t lhs_count,
   return o - output;
 }
 
+// Returns the estimated number of distinct offsets of `key', from its sketch if
+// it has one, or else the number of its values.  Neither requires decoding
+// the values.
+double EstimateIndexKeyCount(Schema* schema, const char* key) {
+  if (const auto lists = IndexKeyPrefetch::Find(schema, key)) {
+    double result = 0;
+    for (const auto& list : *lists) result += list.size();
+    return result;
+  }
+
+  const auto unescaped_key = DecodeURIComponent(key);
+
+  double result = 0;
+
+  for (auto index_table : schema->IndexTablesForKey(unescaped_key)) {
+    if (!index_table->SeekToKey(unescaped_key)) continue;
+
+    string_view key, data;
+    KJ_REQUIRE(index_table->ReadRow(key, data));
+
+    ThetaSketch sketch;
+    if (ThetaSketch::Parse(data, &sketch)) {
+      result += sketch.Estimate();
+    } else {
+      result += ca_offset_score_count(
+          reinterpret_cast<const uint8_t*>(data.begin()),
+          reinterpret_cast<const uint8_t*>(data.end()));
+    }
+  }
+
+  return result;
+}
+
+// Returns a rough upper bound on the number of results of `query', for
+// choosing the order of operands, or HUGE_VAL if it has subtrees whose size
+// can't be estimated without evaluating them.
+double EstimateResultCount(const Query* query, Schema* schema) {
+  if (IsPlainIndexKey(query))
+    return EstimateIndexKeyCount(schema, query->identifier);
+
+  switch (query->type) {
+    case kQueryBinaryOperator:
+      switch (query->operator_type) {
+        case kOperatorOr:
+          return EstimateResultCount(query->lhs, schema) +
+                 EstimateResultCount(query->rhs, schema);
+
+        case kOperatorAnd:
+          return std::min(EstimateResultCount(query->lhs, schema),
+                          EstimateResultCount(query->rhs, schema));
+
+        case kOperatorSubtract:
+        case kOperatorEQ:
+        case kOperatorGE:
+        case kOperatorLE:
+        case kOperatorInRange:
+        case kOperatorOrderBy:
+          return EstimateResultCount(query->lhs, schema);
+
+        case kOperatorGT:
+        case kOperatorLT:
+          if (query->rhs) break;
+          return EstimateResultCount(query->lhs, schema);
+
+        case kOperatorRandomSample:
+          return std::min(query->value,
+                          EstimateResultCount(query->lhs, schema));
+
+        default:
+          break;
+      }
+      break;
+
+    case kQueryUnaryOperator:
+      return EstimateResultCount(query->lhs, schema);
+
+    default:
+      break;
+  }
+
+  return HUGE_VAL;
+}
+
+// Returns true if the intersection `query' should evaluate its right operand
+// first, and then look up only the matching values of its left operand,
+// which is a large index key.  With a skip index, most blocks of the key are
+// then never decoded.
+bool ShouldEvaluateRhsFirst(const Query* query, Schema* schema,
+                            const SubQueryCache& cache) {
+  if (!IsPlainIndexKey(query->lhs) || cache.IsShared(query->lhs)) return false;
+
+  const auto lhs_count = EstimateIndexKeyCount(schema, query->lhs->identifier);
+  if (lhs_count < kMinReorderCount) return false;
+
+  return EstimateResultCount(query->rhs, schema) * kReorderRatio < lhs_count;
+}
+
 void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
-                     Schema* schema, bool make_headers) {
+                     Schema* schema, bool make_headers, SubQueryCache& cache);
+
+void EvaluateSubQuery(std::vector<ca_offset_score>& offsets,
+                      const Query* query, Schema* schema, bool make_headers,
+                      SubQueryCache& cache) {
+  CA_TRACE_SPAN("query", QueryTraceName(query),
+                (query->type == kQueryKey || query->type == kQueryLeaf)
+                    ? query->identifier
+                    : nullptr);
+
+  CheckDeadline();
+
+  double min_score, max_score;
+
+  // Charges the operands held here to the statement's memory budget.  The
+  // caller charges `offsets' once it is returned.
+  MemoryCharge offsets_memory, rhs_memory;
+
   switch (query->type) {
     case kQueryKey: {
       string_view key(query->identifier);
@@ -402,20 +872,58 @@ void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
 
     case kQueryLeaf:
       LookupIndexKey(
-          schema->IndexTables(), query->identifier, make_headers,
+          schema, query->identifier, make_headers,
           [&offsets](auto new_offsets) { offsets = std::move(new_offsets); });
+      offsets_memory.Set(offsets);
       break;
 
     case kQueryBinaryOperator:
-      ProcessSubQuery(offsets, query->lhs, schema, make_headers);
+      if (query->operator_type == kOperatorAnd &&
+          ShouldEvaluateRhsFirst(query, schema, cache)) {
+        std::vector<ca_offset_score> rhs;
+        ProcessSubQuery(rhs, query->rhs, schema, make_headers, cache);
+        rhs_memory.Set(rhs);
+
+        if (rhs.empty()) return;
+
+        LookupIndexKeyOffsets(schema, query->lhs->identifier, rhs,
+                              [&offsets](auto new_offsets, const auto&) {
+                                offsets = std::move(new_offsets);
+                              });
+        offsets_memory.Set(offsets);
+
+        // Prefetched lists are returned in full.
+        const auto new_size = IntersectOffsets(offsets.data(), offsets.size(),
+                                               rhs.data(), rhs.size());
+        offsets.resize(new_size);
+        break;
+      }
+
+      // Score filters on a single key only need the values in range, which
+      // can be read without decoding the whole list if it has an impact index.
+      if (IsPlainIndexKey(query->lhs) && !cache.IsShared(query->lhs) &&
+          GetFilterScoreRange(query, &min_score, &max_score)) {
+        LookupIndexKeyScoreRange(
+            schema, query->lhs->identifier, min_score, max_score,
+            [&offsets](auto new_offsets) { offsets = std::move(new_offsets); });
+      } else {
+        ProcessSubQuery(offsets, query->lhs, schema, make_headers, cache);
+      }
+      offsets_memory.Set(offsets);
 
       switch (query->operator_type) {
         case kOperatorOr: {
           if (offsets.empty()) {
-            ProcessSubQuery(offsets, query->rhs, schema, make_headers);
+            ProcessSubQuery(offsets, query->rhs, schema, make_headers, cache);
           } else {
             std::vector<ca_offset_score> rhs;
-            ProcessSubQuery(rhs, query->rhs, schema, make_headers);
+            ProcessSubQuery(rhs, query->rhs, schema, make_headers, cache);
+            rhs_memory.Set(rhs);
+
+            // Fails before allocating the union if it might not fit.
+            MemoryCharge union_memory;
+            union_memory.Set((offsets.size() + rhs.size()) *
+                             sizeof(ca_offset_score));
 
             offsets = UnionOffsets(offsets, rhs);
           }
@@ -425,7 +933,8 @@ void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
           if (offsets.empty()) return;
 
           std::vector<ca_offset_score> rhs;
-          ProcessSubQuery(rhs, query->rhs, schema, make_headers);
+          ProcessSubQuery(rhs, query->rhs, schema, make_headers, cache);
+          rhs_memory.Set(rhs);
 
           const auto new_size = IntersectOffsets(offsets.data(), offsets.size(),
                                                  rhs.data(), rhs.size());
@@ -436,7 +945,8 @@ void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
           if (offsets.empty()) return;
 
           std::vector<ca_offset_score> rhs;
-          ProcessSubQuery(rhs, query->rhs, schema, make_headers);
+          ProcessSubQuery(rhs, query->rhs, schema, make_headers, cache);
+          rhs_memory.Set(rhs);
 
           const auto new_size = SubtractOffsets(
               offsets.data(), offsets.size(), rhs.data(), rhs.size());
@@ -454,7 +964,8 @@ void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
         case kOperatorGT:
           if (query->rhs) {
             std::vector<ca_offset_score> rhs;
-            ProcessSubQuery(rhs, query->rhs, schema, make_headers);
+            ProcessSubQuery(rhs, query->rhs, schema, make_headers, cache);
+            rhs_memory.Set(rhs);
 
             Join(offsets, rhs,
                  [](const auto lhs, const auto rhs) { return lhs > rhs; });
@@ -478,7 +989,8 @@ void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
         case kOperatorLT:
           if (query->rhs) {
             std::vector<ca_offset_score> rhs;
-            ProcessSubQuery(rhs, query->rhs, schema, make_headers);
+            ProcessSubQuery(rhs, query->rhs, schema, make_headers, cache);
+            rhs_memory.Set(rhs);
 
             Join(offsets, rhs,
                  [](const auto lhs, const auto rhs) { return lhs < rhs; });
@@ -512,7 +1024,19 @@ void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
 
         case kOperatorOrderBy: {
           std::vector<ca_offset_score> rhs;
-          ProcessSubQuery(rhs, query->rhs, schema, make_headers);
+
+          // Only the scores of `offsets' are needed, which can be read
+          // without decoding the whole list if the key has doc values.
+          if (IsPlainIndexKey(query->rhs) && !cache.IsShared(query->rhs)) {
+            LookupIndexKeyOffsets(
+                schema, query->rhs->identifier, offsets,
+                [&rhs](auto new_offsets, const auto&) {
+                  rhs = std::move(new_offsets);
+                });
+          } else {
+            ProcessSubQuery(rhs, query->rhs, schema, make_headers, cache);
+          }
+          rhs_memory.Set(rhs);
 
           auto l = offsets.begin();
           auto r = rhs.begin();
@@ -566,7 +1090,8 @@ void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
       break;
 
     case kQueryUnaryOperator:
-      ProcessSubQuery(offsets, query->lhs, schema, make_headers);
+      ProcessSubQuery(offsets, query->lhs, schema, make_headers, cache);
+      offsets_memory.Set(offsets);
 
       switch (query->operator_type) {
         case kOperatorMax:
@@ -614,12 +1139,138 @@ void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
   }
 }
 
+void ProcessSubQuery(std::vector<ca_offset_score>& offsets, const Query* query,
+                     Schema* schema, bool make_headers, SubQueryCache& cache) {
+  if (cache.Take(query, offsets)) return;
+
+  EvaluateSubQuery(offsets, query, schema, make_headers, cache);
+
+  // Merging the result with its sibling may take a while too.
+  CheckDeadline();
+
+  cache.Store(query, offsets);
+}
+
 void ProcessQuery(std::vector<ca_offset_score>& offsets, const Query* query,
                   Schema* schema, bool make_headers, bool use_max) {
-  ProcessSubQuery(offsets, query, schema, make_headers);
+  // Fetch all CAS objects in parallel up front, rather than one at a time
+  // as they are reached.
+  std::vector<std::string> cas_keys;
+  CollectCASKeys(query, cas_keys);
+  if (cas_keys.size() > 1) GetCASCache().Get(cas_keys);
+
+  SubQueryCache cache(query);
+  ProcessSubQuery(offsets, query, schema, make_headers, cache);
   RemoveDuplicates(offsets, use_max);
 }
 
+void ProcessQueryForOffsets(std::vector<ca_offset_score>& offsets,
+                            const Query* query, Schema* schema,
+                            const std::vector<ca_offset_score>& selection,
+                            bool use_max, bool* all_zero) {
+  if (!IsPlainIndexKey(query)) {
+    ProcessQuery(offsets, query, schema, false, use_max);
+
+    *all_zero = std::none_of(offsets.begin(), offsets.end(),
+                             [](const auto& v) { return v.score != 0; });
+    return;
+  }
+
+  ca_offset_score_bucket summary;
+  LookupIndexKeyOffsets(schema, query->identifier, selection,
+                        [&offsets, &summary](auto new_offsets,
+                                             const auto& new_summary) {
+                          offsets = std::move(new_offsets);
+                          summary = new_summary;
+                        });
+  RemoveDuplicates(offsets, use_max);
+
+  // A NaN score makes the sum NaN.
+  *all_zero = !summary.count || (summary.min == 0 && summary.max == 0 &&
+                                 summary.sum == 0);
+}
+
+void CollectIndexKeys(const Query* query, std::vector<std::string>& keys) {
+  if (!query) return;
+
+  if (IsPlainIndexKey(query)) {
+    keys.emplace_back(query->identifier);
+    return;
+  }
+
+  CollectIndexKeys(query->lhs, keys);
+  CollectIndexKeys(query->rhs, keys);
+}
+
+IndexKeyPrefetch::IndexKeyPrefetch(Schema* schema,
+                                   std::vector<std::string> keys)
+    : schema_(schema), memory_(std::make_unique<MemoryCharge>()) {
+  CA_TRACE_SPAN("query", "IndexKeyPrefetch");
+
+  using PostingLists = std::vector<std::vector<ca_offset_score>>;
+
+  std::vector<std::pair<std::string, PostingLists*>> unescaped_keys;
+  for (auto& key : keys) {
+    auto i = postings_.emplace(std::move(key), PostingLists());
+    if (i.second)
+      unescaped_keys.emplace_back(DecodeURIComponent(i.first->first),
+                                  &i.first->second);
+  }
+
+  // Visiting keys in order makes each index table's reads move forward only.
+  std::sort(unescaped_keys.begin(), unescaped_keys.end());
+
+  size_t memory = 0;
+
+  for (const auto& key : unescaped_keys) {
+    CheckDeadline();
+
+    auto& lists = *key.second;
+
+    for (auto index_table : schema->IndexTablesForKey(key.first)) {
+      if (!index_table->SeekToKey(key.first)) continue;
+
+      string_view row_key, data;
+      KJ_REQUIRE(index_table->ReadRow(row_key, data));
+
+      // Fails before decoding a list that would not fit.
+      memory_->Set(memory + CountPostings(data) * sizeof(ca_offset_score));
+
+      lists.emplace_back();
+      ca_offset_score_parse(data, &lists.back());
+
+      memory += lists.back().capacity() * sizeof(ca_offset_score);
+      memory_->Set(memory);
+    }
+  }
+
+  previous_ = current_prefetch;
+  current_prefetch = this;
+}
+
+IndexKeyPrefetch::~IndexKeyPrefetch() { current_prefetch = previous_; }
+
+const std::vector<std::vector<ca_offset_score>>* IndexKeyPrefetch::Find(
+    Schema* schema, const char* key) {
+  for (auto prefetch = current_prefetch; prefetch;
+       prefetch = prefetch->previous_) {
+    if (prefetch->schema_ != schema) continue;
+
+    auto i = prefetch->postings_.find(key);
+    if (i != prefetch->postings_.end()) return &i->second;
+  }
+
+  return nullptr;
+}
+
+size_t IndexKeyPrefetch::MemoryUsed() {
+  size_t result = 0;
+  for (auto prefetch = current_prefetch; prefetch;
+       prefetch = prefetch->previous_)
+    result += prefetch->memory_->bytes();
+  return result;
+}
+
 void PrintQuery(const Query* query) {
   switch (query->type) {
     case kQueryKey:
@@ -716,223 +1367,521 @@ void PrintQuery(const Query* query) {
   }
 }
 
-void ca_schema_query(Schema* schema,
-                     const struct query_statement& stmt) {
-  try {
-    schema->Load();
+namespace {
 
-    std::vector<ca_offset_score> offsets;
+// The score thresholds of a query statement, for grouping its results under
+// headers.
+struct ResultThresholds {
+  explicit ResultThresholds(const ThresholdClause* clause) {
+    if (!clause) return;
 
-    std::string key_buffer;
+    for (auto th = clause->values; th; th = th->next)
+      values.emplace_back(th->value);
+    std::sort(values.begin(), values.end());
 
-    auto& summary_tables = schema->summary_tables;
-    auto& index_tables = schema->IndexTables();
-    auto& summary_override_tables = schema->summary_override_tables;
+    key = clause->key;
+    if (*key == '~') {
+      ++key;
+      reverse = true;
+    }
+
+    // If the threshold key is an event list, the section heads should be date
+    // ranges rather than number ranges.
+    use_date_headers = Keywords::GetInstance().IsTimestamped(key);
+  }
+
+  const char* key = nullptr;
+  std::vector<double> values;
+  bool reverse = false;
+  bool use_date_headers = false;
+};
+
+// The highest scoring results of a query statement on one schema, before
+// their summaries are read.
+struct QueryResults {
+  // At most `stmt.offset + stmt.limit' results, by descending score.
+  std::vector<ca_offset_score> offsets;
+
+  // The number of results before threshold filtering and truncation.
+  size_t result_count = 0;
+
+  // Extra JSON members of the results in `offsets', if any.
+  std::unordered_map<uint64_t, Json::Value> extra_data;
+};
+
+QueryResults FindResults(Schema* schema, const struct query_statement& stmt,
+                         const ResultThresholds& thresholds) {
+  schema->Load();
+
+  KJ_REQUIRE(!schema->summary_tables.empty());
+
+  extra_data.clear();
+
+  QueryResults results;
+  auto& offsets = results.offsets;
+
+  if (!stmt.thresholds && stmt.limit >= 0 && IsPlainIndexKey(stmt.query)) {
+    // Only the highest scoring values of a single key are needed, and they
+    // can be read without decoding the whole list if it has an impact
+    // index.
+    LookupIndexKeyTop(
+        schema, stmt.query->identifier, stmt.offset + stmt.limit,
+        [&results](auto new_offsets, size_t count) {
+          results.offsets = std::move(new_offsets);
+          results.result_count = count;
+        });
+
+    // Impact indexes are only written for lists with unique offsets, so
+    // duplicates can only exist if the whole list was read.
+    if (offsets.size() == results.result_count) {
+      RemoveDuplicates(offsets, true);
+      results.result_count = offsets.size();
+    }
+  } else {
+    ProcessQuery(offsets, stmt.query, schema, stmt.thresholds != nullptr);
+    results.result_count = offsets.size();
+  }
 
-    KJ_REQUIRE(!summary_tables.empty());
+  MemoryCharge offsets_memory;
+  offsets_memory.Set(offsets);
 
-    ProcessQuery(offsets, stmt.query, schema,
-                           stmt.thresholds != nullptr);
+  if (stmt.thresholds) {
+    const auto& values = thresholds.values;
 
-    std::vector<double> thresholds;
-    bool reverse_thresholds = false;
+    // Filter `offsets' array by offsets within range.
+    LookupIndexKey(schema, thresholds.key, [&offsets, &values](auto scores) {
+      auto output = offsets.begin();
 
-    // Set to true if the threshold key is an event list, so that the section
-    // heads should be date ranges rather than number ranges.
-    bool use_date_headers = false;
+      auto thr_iter = scores.begin();
+      auto off_iter = offsets.begin();
+      auto thr_end = scores.end();
+      auto off_end = offsets.end();
 
-    if (stmt.thresholds) {
-      // The caller has provided a group of score thresholds for grouping the
-      // search results.
-      for (auto th = stmt.thresholds->values; th; th = th->next)
-        thresholds.emplace_back(th->value);
-      std::sort(thresholds.begin(), thresholds.end());
+      while (thr_iter != thr_end && off_iter != off_end) {
+        if (thr_iter->offset == off_iter->offset) {
+          if (thr_iter->score >= values.front() &&
+              thr_iter->score < values.back()) {
+            output->offset = thr_iter->offset;
+            output->score = thr_iter->score;
+            ++output;
+          }
+          ++thr_iter;
+          continue;
+        }
 
-      auto key = stmt.thresholds->key;
-      if (*key == '~') {
-        ++key;
-        reverse_thresholds = true;
+        if (thr_iter->offset < off_iter->offset)
+          ++thr_iter;
+        else
+          ++off_iter;
       }
 
-      if (Keywords::GetInstance().IsTimestamped(key))
-        use_date_headers = true;
-
-      // Filter `offsets' array by offsets within range.
-      LookupIndexKey(index_tables, key, [&offsets, &thresholds](auto values) {
-        auto output = offsets.begin();
-
-        auto thr_iter = values.begin();
-        auto off_iter = offsets.begin();
-        auto thr_end = values.end();
-        auto off_end = offsets.end();
-
-        while (thr_iter != thr_end && off_iter != off_end) {
-          if (thr_iter->offset == off_iter->offset) {
-            if (thr_iter->score >= thresholds.front() &&
-                thr_iter->score < thresholds.back()) {
-              output->offset = thr_iter->offset;
-              output->score = thr_iter->score;
-              ++output;
-            }
-            ++thr_iter;
-            continue;
-          }
+      offsets.erase(output, offsets.end());
+    });
+  }
 
-          if (thr_iter->offset < off_iter->offset)
-            ++thr_iter;
-          else
-            ++off_iter;
-        }
+  auto count = offsets.size();
+  if (stmt.limit >= 0)
+    count = std::min(count, stmt.offset + static_cast<size_t>(stmt.limit));
+
+  std::partial_sort(
+      offsets.begin(), offsets.begin() + count, offsets.end(),
+      [](const auto& lhs, const auto& rhs) { return lhs.score > rhs.score; });
+  offsets.resize(count);
+
+  for (const auto& v : offsets) {
+    auto ed = extra_data.find(v.offset);
+    if (ed != extra_data.end())
+      results.extra_data.emplace(v.offset, std::move(ed->second));
+  }
+  extra_data.clear();
+
+  return results;
+}
+
+void ReadSummary(Schema* schema, uint64_t offset, string_view& key,
+                 string_view& data) {
+  auto& summary_tables = schema->summary_tables;
+
+  auto summary_table_idx = summary_tables.size();
+
+  while (--summary_table_idx &&
+         std::get<uint64_t>(summary_tables[summary_table_idx]) > offset)
+    ;
+
+  summary_tables[summary_table_idx].second->Seek(
+      offset - std::get<uint64_t>(summary_tables[summary_table_idx]),
+      SEEK_SET);
+
+  KJ_REQUIRE(summary_tables[summary_table_idx].second->ReadRow(key, data));
+}
+
+std::string FormatResult(
+    Schema* schema, const ca_offset_score& v,
+    const std::unordered_map<uint64_t, Json::Value>& extra_data,
+    const ResultThresholds& thresholds) {
+  string_view row_key, data;
+  ReadSummary(schema, v.offset, row_key, data);
+  KJ_REQUIRE(row_key.size() < 100'000'000, row_key.size());
+  KJ_REQUIRE(data.size() < 100'000'000, data.size());
+
+  std::string result;
+  result.append("\"_key\":");
+  ToJSON(row_key, result);
+
+  result.push_back(',');
+  string_view json(data);
+  // TODO(mortehu): Remove this logic when we're no longer producing
+  // summaries with curly braces in them.
+  if (json[0] == '{') {
+    KJ_ASSERT(json.size() > 2);
+    result.append(json.data() + 1, json.size() - 2);
+  } else {
+    result.append(json.data(), json.size());
+  }
 
-        offsets.erase(output, offsets.end());
-      });
+  for (auto& summary_override_table : schema->summary_override_tables) {
+    if (!summary_override_table->SeekToKey(row_key)) break;
+
+    string_view tmp_key, json_extra;
+    KJ_REQUIRE(summary_override_table->ReadRow(tmp_key, json_extra));
+
+    result.push_back(',');
+    // TODO(mortehu): Remove this logic when we're no longer producing
+    // summaries with curly braces in them.
+    if (json_extra[0] == '{')
+      result.append(json_extra.data() + 1, json_extra.size() - 2);
+    else
+      result.append(json_extra.data(), json_extra.size());
+  }
+
+  auto ed = extra_data.find(v.offset);
+  if (ed != extra_data.end()) {
+    result.push_back(',');
+    auto extra_json = Json::FastWriter().write(ed->second);
+    if (std::isspace(extra_json.back())) extra_json.pop_back();
+    result.append(extra_json.data() + 1, extra_json.size() - 2);
+  }
+
+  if (thresholds.key) {
+    const auto& values = thresholds.values;
+
+    // The score is known to be within range from earlier tests.
+    auto i = std::lower_bound(values.begin() + 1, values.end(), v.score);
+    if (*i == v.score && i + 1 < values.end()) ++i;
+    const auto min_value = *(i - 1);
+    const auto max_value = *i;
+    std::string header;
+    if (!thresholds.use_date_headers) {
+      header = DoubleToString(min_value) + "–" + DoubleToString(max_value);
+    } else if (min_value + 1 != max_value) {
+      header = TimeToDateString(min_value) + "–" + TimeToDateString(max_value);
+    } else {
+      header = TimeToDateString(min_value);
     }
+    auto key = i - values.begin();
+    if (thresholds.reverse) key = values.size() - key;
+    result.append(",\"_header\":");
+    ToJSON(header, result);
+
+    // Make a key on the form "AAAAA".."ZZZZZ", so that a client can sort
+    // the headers easily, without parsing them.
+    result.append(",\"_header_key\":\"");
+    for (auto j = 26*26*26*26; j > 0; j /= 26)
+      result.push_back('A' + (key / j) % 26);
+    result.push_back('\"');
+  }
 
-    if (stmt.offset >= offsets.size()) {
-      printf("[]\n");
-      return;
+  return result;
+}
+
+// Reads the document key, or the JSON members, of every result in `page'
+// from the summary tables of `schema'.  The second member of each element is
+// the result's position in `output'.
+void FetchSummaries(
+    Schema* schema, std::vector<std::pair<ca_offset_score, size_t>> page,
+    const std::unordered_map<uint64_t, Json::Value>& extra_data,
+    const ResultThresholds& thresholds, bool keys_only,
+    std::vector<std::string>& output) {
+  // First, order the results by their physical location in the `summaries`
+  // table, to minimize the total seek distance in rotational storage.
+  std::sort(page.begin(), page.end(), [](const auto& lhs, const auto& rhs) {
+    return lhs.first.offset < rhs.first.offset;
+  });
+
+  for (const auto& o : page) {
+    CheckDeadline();
+
+    if (keys_only) {
+      string_view row_key, data;
+      ReadSummary(schema, o.first.offset, row_key, data);
+      output[o.second] = row_key.to_string();
+    } else {
+      output[o.second] =
+          FormatResult(schema, o.first, extra_data, thresholds);
+    }
+  }
+}
+
+// Returns the sketch of the offsets of `key'.  Posting lists stored without a
+// sketch are decoded.
+ThetaSketch LookupIndexKeySketch(Schema* schema, const char* key) {
+  CA_TRACE_SPAN("query", "LookupIndexKeySketch", key);
+
+  ThetaSketch result;
+
+  if (const auto lists = IndexKeyPrefetch::Find(schema, key)) {
+    for (const auto& list : *lists) {
+      result = ThetaSketch::Union(
+          result, ThetaSketch::FromOffsets(list.data(), list.size()));
+    }
+    return result;
+  }
+
+  const auto unescaped_key = DecodeURIComponent(key);
+
+  for (auto index_table : schema->IndexTablesForKey(unescaped_key)) {
+    if (!index_table->SeekToKey(unescaped_key)) continue;
+
+    string_view key, data;
+    KJ_REQUIRE(index_table->ReadRow(key, data));
+
+    ThetaSketch sketch;
+    if (!ThetaSketch::Parse(data, &sketch)) {
+      std::vector<ca_offset_score> values;
+      ca_offset_score_parse(data, &values);
+      MemoryCharge values_memory;
+      values_memory.Set(values);
+
+      sketch = ThetaSketch::FromOffsets(values.data(), values.size());
     }
 
-    size_t limit = stmt.limit;
+    result = ThetaSketch::Union(result, sketch);
+  }
 
-    if (stmt.limit < 0 || stmt.offset + limit > offsets.size())
-      limit = offsets.size() - stmt.offset;
+  return result;
+}
 
-    std::partial_sort(
-        offsets.begin(), offsets.begin() + stmt.offset + limit, offsets.end(),
-        [](const auto& lhs, const auto& rhs) { return lhs.score > rhs.score; });
+// Returns the sketch of the results of `query'.  Unions, intersections and
+// differences of keys are estimated from the sketches of the keys, and other
+// subtrees are evaluated.
+ThetaSketch EstimateQuery(const Query* query, Schema* schema) {
+  CheckDeadline();
 
-    if (stmt.keys_only) {
-      for (auto i = stmt.offset; i < stmt.offset + limit; ++i) {
-        const auto& v = offsets[i];
+  if (IsPlainIndexKey(query))
+    return LookupIndexKeySketch(schema, query->identifier);
 
-        auto summary_table_idx = summary_tables.size();
+  switch (query->type) {
+    case kQueryBinaryOperator:
+      switch (query->operator_type) {
+        case kOperatorOr:
+          return ThetaSketch::Union(EstimateQuery(query->lhs, schema),
+                                    EstimateQuery(query->rhs, schema));
 
-        while (--summary_table_idx &&
-               std::get<uint64_t>(summary_tables[summary_table_idx]) > v.offset)
-          ;
+        case kOperatorAnd:
+          return ThetaSketch::Intersection(EstimateQuery(query->lhs, schema),
+                                           EstimateQuery(query->rhs, schema));
 
-        summary_tables[summary_table_idx].second->Seek(
-            v.offset - std::get<uint64_t>(summary_tables[summary_table_idx]),
-            SEEK_SET);
+        case kOperatorSubtract:
+          return ThetaSketch::Difference(EstimateQuery(query->lhs, schema),
+                                         EstimateQuery(query->rhs, schema));
 
-        string_view row_key, data;
-        KJ_REQUIRE(summary_tables[summary_table_idx].second->ReadRow(
-            row_key, data));
+        case kOperatorOrderBy:
+          // Only changes the scores.
+          return EstimateQuery(query->lhs, schema);
 
-        printf("%.*s\n", static_cast<int>(row_key.size()), row_key.data());
+        default:
+          break;
       }
-    } else {
-      // First, order the results by their physical location in the `summaries`
-      // table, to minimize the total seek distance in rotational storage.
-      std::vector<std::pair<ca_offset_score, size_t>> sorted_offsets;
-      for (auto i = stmt.offset; i < stmt.offset + limit; ++i)
-        sorted_offsets.emplace_back(offsets[i], i - stmt.offset);
-      std::sort(sorted_offsets.begin(), sorted_offsets.end(),
-                [](const auto& lhs, const auto& rhs) {
-        return lhs.first.offset < rhs.first.offset;
-      });
-
-      std::vector<std::string> results;
-      results.resize(sorted_offsets.size());
-
-      for (const auto& o : sorted_offsets) {
-        const auto& v = o.first;
-
-        auto summary_table_idx = summary_tables.size();
-
-        while (--summary_table_idx &&
-               std::get<uint64_t>(summary_tables[summary_table_idx]) > v.offset)
-          ;
-
-        summary_tables[summary_table_idx].second->Seek(
-            v.offset - std::get<uint64_t>(summary_tables[summary_table_idx]),
-            SEEK_SET);
-
-        string_view row_key, data;
-        KJ_REQUIRE(summary_tables[summary_table_idx].second->ReadRow(row_key, data));
-        KJ_REQUIRE(row_key.size() < 100'000'000, row_key.size());
-        KJ_REQUIRE(data.size() < 100'000'000, data.size());
-
-        std::string result;
-        result.append("\"_key\":");
-        ToJSON(row_key, result);
-
-        result.push_back(',');
-        string_view json(data);
-        // TODO(mortehu): Remove this logic when we're no longer producing
-        // summaries with curly braces in them.
-        if (json[0] == '{') {
-          KJ_ASSERT(json.size() > 2);
-          result.append(json.data() + 1, json.size() - 2);
-        } else {
-          result.append(json.data(), json.size());
-        }
+      break;
+
+    case kQueryUnaryOperator:
+      // Only changes the scores.
+      return EstimateQuery(query->lhs, schema);
 
-        for (auto& summary_override_table : summary_override_tables) {
-          if (!summary_override_table->SeekToKey(row_key)) break;
+    default:
+      break;
+  }
 
-          string_view tmp_key, json_extra;
-          KJ_REQUIRE(summary_override_table->ReadRow(tmp_key, json_extra));
+  std::vector<ca_offset_score> offsets;
+  ProcessQuery(offsets, query, schema, false, true);
+  MemoryCharge offsets_memory;
+  offsets_memory.Set(offsets);
 
-          result.push_back(',');
-          // TODO(mortehu): Remove this logic when we're no longer producing
-          // summaries with curly braces in them.
-          if (json_extra[0] == '{')
-            result.append(json_extra.data() + 1, json_extra.size() - 2);
-          else
-            result.append(json_extra.data(), json_extra.size());
-        }
+  return ThetaSketch::FromOffsets(offsets.data(), offsets.size());
+}
 
-        auto ed = extra_data.find(v.offset);
-        if (ed != extra_data.end()) {
-          result.push_back(',');
-          auto extra_json = Json::FastWriter().write(ed->second);
-          if (std::isspace(extra_json.back())) extra_json.pop_back();
-          result.append(extra_json.data() + 1, extra_json.size() - 2);
-        }
+void PrintResults(const struct query_statement& stmt, size_t result_count,
+                  const std::vector<std::string>& results) {
+  if (stmt.keys_only) {
+    for (const auto& key : results)
+      printf("%.*s\n", static_cast<int>(key.size()), key.data());
+    return;
+  }
 
-        if (stmt.thresholds) {
-          // The score is known to be within range from earlier tests.
-          auto i = std::lower_bound(thresholds.begin() + 1, thresholds.end(),
-                                    v.score);
-          if (*i == v.score && i + 1 < thresholds.end()) ++i;
-          const auto min_value = *(i - 1);
-          const auto max_value = *i;
-          std::string header;
-          if (!use_date_headers) {
-            header = DoubleToString(min_value) + "–" + DoubleToString(max_value);
-          } else if (min_value + 1 != max_value) {
-            header = TimeToDateString(min_value) + "–" + TimeToDateString(max_value);
-          } else {
-            header = TimeToDateString(min_value);
+  printf("{\"result-count\":%zu,", result_count);
+  if (const auto budget = MemoryBudget::Current())
+    printf("\"peak-memory\":%zu,", budget->peak());
+  printf("\"result\":[{");
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (i > 0) fwrite_unlocked("},\n{", 1, 4, stdout);
+
+    fwrite_unlocked(results[i].data(), 1, results[i].size(), stdout);
+  }
+
+  printf("}]}\n");
+}
+
+}  // namespace
+
+void ca_schema_query(Schema* schema,
+                     const struct query_statement& stmt) {
+  CA_TRACE_SPAN("query", "ca_schema_query");
+
+  try {
+    const ResultThresholds thresholds(stmt.thresholds);
+
+    const auto results = FindResults(schema, stmt, thresholds);
+
+    if (stmt.offset >= results.offsets.size()) {
+      printf("[]\n");
+      return;
+    }
+
+    CA_TRACE_SPAN("query", "fetch-summaries");
+
+    std::vector<std::pair<ca_offset_score, size_t>> page;
+    for (auto i = stmt.offset; i < results.offsets.size(); ++i)
+      page.emplace_back(results.offsets[i], i - stmt.offset);
+
+    std::vector<std::string> output(page.size());
+    FetchSummaries(schema, std::move(page), results.extra_data, thresholds,
+                   stmt.keys_only, output);
+
+    PrintResults(stmt, results.result_count, output);
+  } catch (kj::Exception e) {
+    Json::Value error;
+    error["error"] = e.getDescription().cStr();
+    std::cout << Json::FastWriter().write(error);
+  }
+}
+
+void ca_sharded_query(const std::vector<Schema*>& shards,
+                      const struct query_statement& stmt) {
+  CA_TRACE_SPAN("query", "ca_sharded_query");
+
+  try {
+    KJ_REQUIRE(!shards.empty());
+
+    const ResultThresholds thresholds(stmt.thresholds);
+
+    // Each shard is evaluated by one thread, since its tables have a single
+    // cursor.
+    ThreadPool thread_pool(shards.size() - 1);
+
+    // Every shard returns its own first `stmt.offset + stmt.limit' results,
+    // which include all of its results on the requested page.
+    std::vector<QueryResults> shard_results(shards.size());
+
+    // All shards share the statement's memory budget and deadline.
+    const auto budget = MemoryBudget::Current();
+    const auto deadline = Deadline::Current();
+    const auto expired = deadline ? deadline->expired_flag() : nullptr;
+
+    thread_pool.ParallelFor(
+        0, shards.size(), 1,
+        [&shards, &stmt, &thresholds, &shard_results, budget, deadline](
+            size_t begin, size_t end) {
+          MemoryBudget::Scope memory_scope(budget);
+          Deadline::Scope deadline_scope(deadline);
+          for (auto i = begin; i != end; ++i)
+            shard_results[i] = FindResults(shards[i], stmt, thresholds);
+        },
+        expired);
+
+    // Shards skipped after the deadline expired have no results.
+    CheckDeadline();
+
+    size_t result_count = 0;
+    std::vector<std::pair<ca_offset_score, size_t>> merged;
+    for (size_t i = 0; i < shard_results.size(); ++i) {
+      result_count += shard_results[i].result_count;
+      for (const auto& v : shard_results[i].offsets) merged.emplace_back(v, i);
+    }
+
+    if (stmt.offset >= merged.size()) {
+      printf("[]\n");
+      return;
+    }
+
+    auto count = merged.size();
+    if (stmt.limit >= 0)
+      count = std::min(count, stmt.offset + static_cast<size_t>(stmt.limit));
+
+    std::partial_sort(merged.begin(), merged.begin() + count, merged.end(),
+                      [](const auto& lhs, const auto& rhs) {
+                        if (lhs.first.score != rhs.first.score)
+                          return lhs.first.score > rhs.first.score;
+                        return lhs.second < rhs.second;
+                      });
+
+    CA_TRACE_SPAN("query", "fetch-summaries");
+
+    // Summaries are only read for the requested page, from the shard that
+    // found each result.
+    std::vector<std::vector<std::pair<ca_offset_score, size_t>>> pages(
+        shards.size());
+    for (auto i = stmt.offset; i < count; ++i)
+      pages[merged[i].second].emplace_back(merged[i].first, i - stmt.offset);
+
+    std::vector<std::string> output(count - stmt.offset);
+    thread_pool.ParallelFor(
+        0, shards.size(), 1,
+        [&shards, &stmt, &thresholds, &shard_results, &pages, &output,
+         deadline](size_t begin, size_t end) {
+          Deadline::Scope deadline_scope(deadline);
+          for (auto i = begin; i != end; ++i) {
+            FetchSummaries(shards[i], std::move(pages[i]),
+                           shard_results[i].extra_data, thresholds,
+                           stmt.keys_only, output);
           }
-          auto key = i - thresholds.begin();
-          if (reverse_thresholds) key = thresholds.size() - key;
-          result.append(",\"_header\":");
-          ToJSON(header, result);
-
-          // Make a key on the form "AAAAA".."ZZZZZ", so that a client can sort
-          // the headers easily, without parsing them.
-          result.append(",\"_header_key\":\"");
-          for (auto j = 26*26*26*26; j > 0; j /= 26)
-            result.push_back('A' + (key / j) % 26);
-          result.push_back('\"');
-        }
+        },
+        expired);
 
-        results[o.second] = std::move(result);
-      }
+    CheckDeadline();
+
+    PrintResults(stmt, result_count, output);
+  } catch (kj::Exception e) {
+    Json::Value error;
+    error["error"] = e.getDescription().cStr();
+    std::cout << Json::FastWriter().write(error);
+  }
+}
+
+void ca_schema_estimate_count(const std::vector<Schema*>& shards,
+                              const Query* query) {
+  CA_TRACE_SPAN("query", "ca_schema_estimate_count");
 
-      printf("{\"result-count\":%zu,\"result\":[{", offsets.size());
+  try {
+    KJ_REQUIRE(!shards.empty());
 
-      for (size_t i = 0; i < results.size(); ++i) {
-        if (i > 0) fwrite_unlocked("},\n{", 1, 4, stdout);
+    double count = 0;
+    bool exact = true;
 
-        fwrite_unlocked(results[i].data(), 1, results[i].size(), stdout);
-      }
+    // Shards are estimated one at a time, since sketches make this cheap
+    // unless the query has operators that must be evaluated.
+    for (const auto schema : shards) {
+      schema->Load();
+
+      const auto sketch = EstimateQuery(query, schema);
+      count += sketch.Estimate();
+      exact = exact && sketch.exact();
 
-      printf("}]}\n");
+      extra_data.clear();
     }
+
+    printf("{\"estimated-count\":%.0f,\"exact\":%s}\n", count,
+           exact ? "true" : "false");
   } catch (kj::Exception e) {
     Json::Value error;
     error["error"] = e.getDescription().cStr();
@@ -940,5 +1889,10 @@ void ca_schema_query(Schema* schema,
   }
 }
 
+void CA_set_cas_cache(size_t memory_limit, const char* directory) {
+  cas_cache_memory_limit = memory_limit;
+  cas_cache_directory = directory ? directory : "";
+}
+
 }  // namespace table
 }  // namespace cantera
@@ -2,7 +2,9 @@
 #define CA_STORAGE_CA_TABLE_QUERY_H_ 1
 
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include <sys/uio.h>
 
@@ -13,20 +15,41 @@
 namespace cantera {
 namespace table {
 
+struct Statement;
+
 struct QueryParseContext {
   void* scanner = nullptr;
 
   kj::Arena arena;
 
-  std::unique_ptr<Schema> schema;
+  std::shared_ptr<SchemaManager> schemas;
+
+  // If not empty, query statements are evaluated on all of these schemas,
+  // which hold disjoint shards of the documents, as built by `ca-load
+  // --shard-by=document', and the results are merged.  `schemas' should be
+  // the first shard.
+  std::vector<std::shared_ptr<SchemaManager>> shards;
+
+  // If set, called by RELOAD SCHEMA instead of reloading `schemas' directly.
+  std::function<void()> reload_schema;
+
+  // If true, CA_parse_script() parses the whole script before running any
+  // statement, so that index keys used by several statements are only read
+  // once.  Statements are queued in `batch' until then.
+  bool batch_mode = false;
+  Statement* batch = nullptr;
+  Statement** batch_tail = &batch;
 };
 
 enum StatementType {
   kStatementCorrelate,
+  kStatementEstimateCount,
   kStatementQuery,
   kStatementParse,
+  kStatementReloadSchema,
   kStatementSelect,
-  kStatementSet
+  kStatementSet,
+  kStatementShowStats
 };
 
 enum QueryType {
@@ -102,7 +125,19 @@ struct query_correlate_statement {
   const struct Query* query_B;
 };
 
-enum RuntimeParameter { CA_PARAM_OUTPUT_FORMAT, CA_PARAM_TIME_FORMAT };
+enum RuntimeParameter {
+  CA_PARAM_OUTPUT_FORMAT,
+  CA_PARAM_TIME_FORMAT,
+  // Starts tracing to the file in `string_value', or stops tracing if it is
+  // null.
+  CA_PARAM_TRACE,
+  // Sets the memory limit of each statement to `int_value' bytes, or removes
+  // it if zero.
+  CA_PARAM_MEMORY_LIMIT,
+  // Sets the timeout of each statement to `int_value' milliseconds, or
+  // removes it if zero.
+  CA_PARAM_STATEMENT_TIMEOUT
+};
 
 enum RuntimeParameterValue {
   /* OUTPUT FORMAT */
@@ -110,6 +145,10 @@ enum RuntimeParameterValue {
   CA_PARAM_VALUE_JSON
 };
 
+struct estimate_count_statement {
+  const struct Query* query;
+};
+
 struct parse_statement {
   const struct Query* query;
 };
@@ -125,6 +164,7 @@ struct set_statement {
   union {
     RuntimeParameterValue enum_value;
     const char* string_value;
+    int64_t int_value;
   } v;
 };
 
@@ -133,6 +173,7 @@ struct Statement {
 
   union {
     struct query_correlate_statement query_correlate;
+    struct estimate_count_statement estimate_count;
     struct query_statement query;
     struct parse_statement parse;
     struct select_statement select;
@@ -147,12 +188,33 @@ struct Statement {
 extern char CA_time_format[64];
 extern enum RuntimeParameterValue CA_output_format;
 
+// The most memory the intermediate results of a statement may use, or zero
+// for no limit.
+extern size_t CA_memory_limit;
+
+// The most time a statement may run for, in milliseconds, or zero for no
+// limit.
+extern uint64_t CA_statement_timeout;
+
 /*****************************************************************************/
 
 void CA_parse_script(QueryParseContext* context, FILE* input);
 
 void CA_process_statement(QueryParseContext* context, struct Statement* stmt);
 
+// Runs a statement, or queues it if `context' is in batch mode.
+void CA_submit_statement(QueryParseContext* context, struct Statement* stmt);
+
+// Runs the statements queued in batch mode, in order, after looking up the
+// index keys they use.
+void CA_process_batch(QueryParseContext* context);
+
+// Configures the cache of CAS objects used by "FIELD-in:KEY" keywords.  Up to
+// `memory_limit' bytes of parsed objects are kept in memory, and if
+// `directory' is not null, fetched objects are also stored there.  Must be
+// called before the first query.
+void CA_set_cas_cache(size_t memory_limit, const char* directory);
+
 /*****************************************************************************/
 
 void CA_output_char(int ch);
@@ -37,6 +37,8 @@
 
 #include "src/ca-table.h"
 #include "src/query.h"
+#include "src/stats.h"
+#include "src/util.h"
 
 namespace cantera {
 namespace table {
@@ -58,6 +60,11 @@ Schema::~Schema() {}
 Schema::Schema(std::string path) : path_(std::move(path)) {}
 
 void Schema::Load() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  LoadLocked();
+}
+
+void Schema::LoadLocked() {
   if (loaded_) return;
 
   KJ_CONTEXT(path_);
@@ -93,12 +100,23 @@ void Schema::Load() {
     auto offset_string = strchr(table_path, '\t');
 
     uint64_t offset = 0;
+    IndexTableRoute route;
 
     if (offset_string) {
       *offset_string++ = 0;
       char* endptr;
-      offset = static_cast<uint64_t>(strtoll(offset_string, &endptr, 0));
-      KJ_REQUIRE(*endptr == 0);
+      if (!strcmp(line, "index")) {
+        KJ_REQUIRE(!strncmp(offset_string, "shard=", 6),
+                   "Expected shard=INDEX/COUNT", lineno);
+        route.shard_index = strtoull(offset_string + 6, &endptr, 0);
+        KJ_REQUIRE(*endptr == '/', "Expected shard=INDEX/COUNT", lineno);
+        route.shard_count = strtoull(endptr + 1, &endptr, 0);
+        KJ_REQUIRE(*endptr == 0, "Expected shard=INDEX/COUNT", lineno);
+        KJ_REQUIRE(route.shard_index < route.shard_count, lineno);
+      } else {
+        offset = static_cast<uint64_t>(strtoll(offset_string, &endptr, 0));
+        KJ_REQUIRE(*endptr == 0);
+      }
     }
 
     if (!strcmp(line, "summary")) {
@@ -109,6 +127,7 @@ void Schema::Load() {
           TableFactory::Open(nullptr, table_path));
     } else if (!strcmp(line, "index")) {
       index_table_paths_.emplace_back(table_path);
+      index_table_routes_.emplace_back(std::move(route));
     } else {
       KJ_FAIL_REQUIRE("Unknown table type", line, lineno);
     }
@@ -118,17 +137,80 @@ void Schema::Load() {
 }
 
 std::vector<std::unique_ptr<Table>>& Schema::IndexTables() {
-  Load();
+  std::lock_guard<std::mutex> lock(mutex_);
+  LoadLocked();
 
   if (index_table_paths_.size() != index_tables_.size()) {
     for (const auto& path : index_table_paths_) {
       index_tables_.emplace_back(
           TableFactory::Open(nullptr, path.c_str()));
     }
+
+    for (size_t i = 0; i < index_tables_.size(); ++i) {
+      auto& route = index_table_routes_[i];
+      route.has_key_range =
+          index_tables_[i]->GetKeyRange(&route.first_key, &route.last_key);
+    }
   }
 
   return index_tables_;
 }
 
+std::vector<Table*> Schema::IndexTablesForKey(const string_view& key) {
+  auto& index_tables = IndexTables();
+
+  auto& stats = internal::GetLookupStats();
+  internal::AddStat(stats.keys);
+
+  std::vector<Table*> result;
+  uint64_t hash = 0;
+  bool has_hash = false;
+
+  for (size_t i = 0; i < index_tables.size(); ++i) {
+    const auto& route = index_table_routes_[i];
+
+    bool skip = route.has_key_range &&
+                (key < route.first_key || key > route.last_key);
+
+    if (!skip && route.shard_count > 1) {
+      if (!has_hash) {
+        hash = internal::Hash(key);
+        has_hash = true;
+      }
+      skip = hash % route.shard_count != route.shard_index;
+    }
+
+    if (skip) {
+      internal::AddStat(stats.tables_skipped);
+      continue;
+    }
+
+    internal::AddStat(stats.tables_searched);
+    result.emplace_back(index_tables[i].get());
+  }
+
+  return result;
+}
+
+SchemaManager::SchemaManager(std::string path)
+    : path_(std::move(path)), current_(std::make_shared<Schema>(path_)) {}
+
+std::shared_ptr<Schema> SchemaManager::Current() const {
+  return std::atomic_load(&current_);
+}
+
+void SchemaManager::Reload() {
+  std::lock_guard<std::mutex> lock(reload_mutex_);
+
+  auto schema = std::make_shared<Schema>(path_);
+  schema->Load();
+  schema->IndexTables();
+
+  std::atomic_store(&current_, std::move(schema));
+  ++generation_;
+}
+
+uint64_t SchemaManager::Generation() const { return generation_; }
+
 }  // namespace table
 }  // namespace cantera
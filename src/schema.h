@@ -1,17 +1,18 @@
 #ifndef STORAGE_CA_TABLE_SCHEMA_H_
 #define STORAGE_CA_TABLE_SCHEMA_H_ 1
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "src/ca-table.h"
+
 namespace cantera {
 namespace table {
 
-class Table;
-class SeekableTable;
-
 class Schema {
  public:
   Schema(std::string path);
@@ -27,13 +28,69 @@ class Schema {
   // Lazy-loads the index tables.
   std::vector<std::unique_ptr<Table>>& IndexTables();
 
+  // Returns the index tables that may contain `key', skipping those whose
+  // key range doesn't include it, and those whose shard doesn't match its
+  // hash.  Updates the lookup counters.
+  std::vector<Table*> IndexTablesForKey(const string_view& key);
+
  private:
+  // Restricts the keys stored in one index table.  Shards are declared in the
+  // schema, as `shard=INDEX/COUNT' after the table path, and must have been
+  // created with the same `--shard-index' and `--shard-count' options to
+  // ca-load, without a key prefix.  Key ranges are read from the tables.
+  struct IndexTableRoute {
+    uint64_t shard_index = 0;
+    uint64_t shard_count = 1;
+
+    bool has_key_range = false;
+    std::string first_key;
+    std::string last_key;
+  };
+
+  void LoadLocked();
+
   std::string path_;
 
+  // Serializes lazy loading.
+  std::mutex mutex_;
+
   bool loaded_ = false;
 
   std::vector<std::string> index_table_paths_;
   std::vector<std::unique_ptr<Table>> index_tables_;
+  std::vector<IndexTableRoute> index_table_routes_;
+};
+
+// Holds the current generation of a schema, and replaces it atomically when
+// the schema is reloaded.  Callers keep the generation returned by Current()
+// for the duration of a statement, so statements that started before a reload
+// finish on the tables they started with, which are closed when the last
+// reference goes away.
+class SchemaManager {
+ public:
+  SchemaManager(std::string path);
+
+  // Returns the current schema generation.  Safe to call from any thread.
+  std::shared_ptr<Schema> Current() const;
+
+  // Opens a new generation of the schema from the same path, in the calling
+  // thread, and makes it current once all its tables are open.  If loading
+  // fails, the current generation is kept and the exception is propagated.
+  void Reload();
+
+  // Returns the number of times the schema has been reloaded.
+  uint64_t Generation() const;
+
+ private:
+  std::string path_;
+
+  // Serializes Reload() calls.
+  std::mutex reload_mutex_;
+
+  // Accessed with std::atomic_load() and std::atomic_store().
+  std::shared_ptr<Schema> current_;
+
+  std::atomic<uint64_t> generation_{0};
 };
 
 }  // namespace table
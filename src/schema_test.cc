@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <kj/debug.h>
+
+#include "src/ca-table.h"
+#include "src/schema.h"
+#include "src/stats.h"
+#include "src/util.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace cantera::table;
+
+namespace {
+
+void WriteTable(const std::string& path, const std::vector<std::string>& keys) {
+  auto table = TableFactory::Create("write-once", path.c_str(),
+                                    TableOptions::Create().SetNoFSync(true));
+  for (const auto& key : keys) table->InsertRow(key, "xxx");
+  table->Sync();
+}
+
+// Returns every two-character key from `first' to `last', in order.
+std::vector<std::string> KeysInRange(char first, char last) {
+  std::vector<std::string> result;
+  for (char a = first; a <= last; ++a) {
+    for (char b = 'a'; b <= 'z'; ++b) result.emplace_back(std::string{a, b});
+  }
+  return result;
+}
+
+}  // namespace
+
+struct SchemaTest : testing::Test {
+  void SetUp() override {
+    char directory[] = "/tmp/schema-test-XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(directory));
+    directory_ = directory;
+  }
+
+  void TearDown() override {
+    for (const auto& path : paths_) unlink(path.c_str());
+    EXPECT_EQ(0, rmdir(directory_.c_str()));
+  }
+
+  std::string Path(const std::string& name) {
+    paths_.emplace_back(directory_ + "/" + name);
+    return paths_.back();
+  }
+
+  std::string WriteSchema(const std::string& text) {
+    const auto path = Path("schema");
+    std::ofstream(path) << text;
+    return path;
+  }
+
+  // Returns the positions in `schema.IndexTables()' of the tables that may
+  // contain `key'.
+  static std::vector<size_t> Route(Schema& schema, const std::string& key) {
+    const auto& index_tables = schema.IndexTables();
+    std::vector<size_t> result;
+    for (const auto table : schema.IndexTablesForKey(key)) {
+      for (size_t i = 0; i < index_tables.size(); ++i) {
+        if (index_tables[i].get() == table) result.emplace_back(i);
+      }
+    }
+    return result;
+  }
+
+  std::string directory_;
+  std::vector<std::string> paths_;
+};
+
+TEST_F(SchemaTest, KeyRange) {
+  const auto path = Path("table");
+  WriteTable(path, KeysInRange('b', 'y'));
+
+  auto table = TableFactory::Open("write-once", path.c_str());
+  EXPECT_TRUE(table->SeekToKey("mm"));
+
+  std::string first_key, last_key;
+  ASSERT_TRUE(table->GetKeyRange(&first_key, &last_key));
+  EXPECT_EQ("ba", first_key);
+  EXPECT_EQ("yz", last_key);
+
+  // The cursor is unchanged.
+  cantera::string_view key, value;
+  ASSERT_TRUE(table->ReadRow(key, value));
+  EXPECT_EQ("mm", key.to_string());
+}
+
+TEST_F(SchemaTest, SkipsTablesOutsideKeyRange) {
+  const auto a = Path("a");
+  const auto b = Path("b");
+  WriteTable(a, KeysInRange('b', 'm'));
+  WriteTable(b, KeysInRange('n', 'y'));
+
+  Schema schema(WriteSchema("index\t" + a + "\nindex\t" + b + "\n"));
+  ASSERT_EQ(2U, schema.IndexTables().size());
+
+  auto& stats = internal::GetLookupStats();
+  const uint64_t searched = stats.tables_searched;
+  const uint64_t skipped = stats.tables_skipped;
+
+  EXPECT_EQ(std::vector<size_t>{0}, Route(schema, "cc"));
+  EXPECT_EQ(std::vector<size_t>{1}, Route(schema, "xx"));
+  EXPECT_EQ(std::vector<size_t>{}, Route(schema, "aa"));
+  EXPECT_EQ(std::vector<size_t>{}, Route(schema, "zz"));
+  EXPECT_EQ(std::vector<size_t>{}, Route(schema, "mzz"));
+
+  // The first and last keys are inside the range.
+  EXPECT_EQ(std::vector<size_t>{0}, Route(schema, "ba"));
+  EXPECT_EQ(std::vector<size_t>{0}, Route(schema, "mz"));
+  EXPECT_EQ(std::vector<size_t>{1}, Route(schema, "na"));
+  EXPECT_EQ(std::vector<size_t>{1}, Route(schema, "yz"));
+
+  EXPECT_EQ(6U, stats.tables_searched - searched);
+  EXPECT_EQ(12U, stats.tables_skipped - skipped);
+}
+
+TEST_F(SchemaTest, SkipsTablesInOtherShards) {
+  std::vector<std::string> keys[2];
+  for (int i = 0; i < 100; ++i) {
+    char key[8];
+    snprintf(key, sizeof(key), "k%03d", i);
+    keys[internal::Hash(key) % 2].emplace_back(key);
+  }
+  ASSERT_FALSE(keys[0].empty());
+  ASSERT_FALSE(keys[1].empty());
+
+  const auto shard_0 = Path("shard_0");
+  const auto shard_1 = Path("shard_1");
+  WriteTable(shard_0, keys[0]);
+  WriteTable(shard_1, keys[1]);
+
+  // The key ranges of the shards overlap, so only the hash tells them apart.
+  Schema schema(WriteSchema("index\t" + shard_0 + "\tshard=0/2\nindex\t" +
+                            shard_1 + "\tshard=1/2\n"));
+
+  for (size_t shard = 0; shard < 2; ++shard) {
+    for (const auto& key : keys[shard])
+      EXPECT_EQ(std::vector<size_t>{shard}, Route(schema, key)) << key;
+  }
+}
+
+TEST_F(SchemaTest, MalformedShard) {
+  const auto table = Path("table");
+  WriteTable(table, KeysInRange('a', 'a'));
+
+  for (const auto shard : {"shard=1", "shard=2/2", "shard=x/2", "shard=0/2x",
+                           "offset=0/2"}) {
+    Schema schema(WriteSchema("index\t" + table + "\t" + shard + "\n"));
+    EXPECT_THROW(schema.Load(), kj::Exception) << shard;
+  }
+}
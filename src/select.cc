@@ -1,19 +1,31 @@
 #include <algorithm>
+#include <thread>
 
 #include "src/ca-table.h"
+#include "src/deadline.h"
+#include "src/output-buffer.h"
 #include "src/query.h"
 #include "src/schema.h"
 #include "src/select.h"
+#include "src/thread-pool.h"
+#include "src/trace.h"
 #include "src/util.h"
 
-#if !HAVE_FPUTS_UNLOCKED
-# define fputs_unlocked fputs
-#endif
-
 namespace cantera {
 namespace table {
 
+using namespace internal;
+
+namespace {
+
+// Number of selected rows merged with field values per task.
+const size_t kMergeGrainSize = 16384;
+
+}  // namespace
+
 void Select(Schema* schema, const struct select_statement& select) {
+  CA_TRACE_SPAN("query", "Select");
+
   schema->Load();
 
   const auto& summary_tables = schema->summary_tables;
@@ -25,10 +37,23 @@ void Select(Schema* schema, const struct select_statement& select) {
   std::vector<std::vector<float>> values;
   values.resize(selection.size());
 
+  // The calling thread merges chunks too, so threads are only started for
+  // the other chunks, with at most one thread per core in total.  Selections
+  // of a single chunk are merged without starting any.
+  const auto chunk_count =
+      (selection.size() + kMergeGrainSize - 1) / kMergeGrainSize;
+  const auto threads =
+      std::min<size_t>(chunk_count, std::thread::hardware_concurrency());
+  ThreadPool thread_pool(threads > 1 ? threads - 1 : 0);
+
   for (auto field = select.fields; field; field = field->next) {
+    CheckDeadline();
+
     std::vector<ca_offset_score> field_offsets;
+    bool all_zero;
 
-    ProcessQuery(field_offsets, field->query, schema, false, false);
+    ProcessQueryForOffsets(field_offsets, field->query, schema, selection,
+                           false, &all_zero);
 
     std::sort(field_offsets.begin(), field_offsets.end(),
               [](const auto& lhs, const auto& rhs) {
@@ -36,30 +61,32 @@ void Select(Schema* schema, const struct select_statement& select) {
       return lhs.score < rhs.score;
     });
 
-    bool all_zero = true;
-    for (const auto& v : field_offsets) {
-      if (v.score) {
-        all_zero = false;
-        break;
-      }
-    }
+    // Both `selection' and `field_offsets' are sorted by offset, so each chunk
+    // of the selection is merged with the matching range of field values.
+    thread_pool.ParallelFor(0, selection.size(), kMergeGrainSize, [
+      &selection, &field_offsets, &values, all_zero
+    ](size_t begin, size_t end) {
+      auto vi = std::lower_bound(
+          field_offsets.begin(), field_offsets.end(), selection[begin].offset,
+          [](const auto& lhs, uint64_t rhs) { return lhs.offset < rhs; });
 
-    auto vi = field_offsets.begin();
+      for (size_t i = begin; i != end; ++i) {
+        const auto offset = selection[i].offset;
 
-    for (size_t i = 0; i < selection.size(); ++i) {
-      const auto offset = selection[i].offset;
+        while (vi != field_offsets.end() && vi->offset < offset) ++vi;
 
-      while (vi != field_offsets.end() && vi->offset < offset) ++vi;
+        if (vi == field_offsets.end() || vi->offset > offset) {
+          values[i].push_back(std::numeric_limits<float>::quiet_NaN());
+          continue;
+        }
 
-      if (vi == field_offsets.end() || vi->offset > offset) {
-        values[i].push_back(std::numeric_limits<float>::quiet_NaN());
-        continue;
+        values[i].push_back(all_zero ? 1.0f : vi->score);
       }
-
-      values[i].push_back(all_zero ? 1.0f : vi->score);
-    }
+    });
   }
 
+  OutputBuffer out(stdout);
+
   for (size_t i = 0; i < selection.size(); ++i) {
     const auto offset = selection[i].offset;
 
@@ -77,28 +104,30 @@ void Select(Schema* schema, const struct select_statement& select) {
     KJ_REQUIRE(
         summary_tables[summary_table_idx].second->ReadRow(key, data));
 
-    printf("%.*s", static_cast<int>(key.size()), key.data());
+    out.Append(key);
 
     for (const auto v : values[i]) {
-      if (std::isnan(v)) {
-        fputs_unlocked(",nan", stdout);
-      } else {
-        printf(",%.9g", v);
-      }
+      out.Append(',');
+      out.AppendFloat(v);
     }
 
     if (select.with_summaries) {
-      printf(",\"");
-      for (const auto ch : data) {
-        if (ch == '"')
-          putchar('"');
-        putchar(ch);
+      out.Append(',');
+      out.Append('"');
+      for (auto quote = data.find('"'); quote != string_view::npos;
+           quote = data.find('"')) {
+        out.Append(data.substr(0, quote + 1));
+        out.Append('"');
+        data.remove_prefix(quote + 1);
       }
-      putchar('"');
+      out.Append(data);
+      out.Append('"');
     }
 
-    putchar_unlocked('\n');
+    out.Append('\n');
   }
+
+  out.Flush();
 }
 
 }  // namespace table
@@ -0,0 +1,235 @@
+// Measures throughput and latency of a `ca-shell --listen' server.
+//
+// Usage: shell_server_benchmark [OPTION]... SOCKET [QUERY-FILE]
+//
+// Every line of QUERY-FILE (or standard input) is a request, typically a
+// single statement such as `QUERY ("keyword:foo" AND "keyword:bar");'.  Each
+// client thread keeps one connection open, and sends the requests in order,
+// starting at a different position in the list, until the duration has
+// elapsed.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <err.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+enum Option {
+  kClientsOption = 1,
+  kDurationOption,
+};
+
+int print_help;
+
+struct option kLongOptions[] = {
+    {"clients", required_argument, nullptr, kClientsOption},
+    {"duration", required_argument, nullptr, kDurationOption},
+    {"help", no_argument, &print_help, 1},
+    {nullptr, 0, nullptr, 0}};
+
+double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+struct ClientResult {
+  std::vector<double> latencies;
+  size_t errors = 0;
+  size_t response_bytes = 0;
+};
+
+int Connect(const char* path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    errx(EX_USAGE, "Socket path too long: %s", path);
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) err(EXIT_FAILURE, "socket");
+
+  if (-1 ==
+      connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)))
+    err(EXIT_FAILURE, "connect: %s", path);
+
+  return fd;
+}
+
+// Sends `request', and reads the response up to and including the
+// terminating NUL byte.  Returns false if the connection was closed.
+bool RoundTrip(int fd, const std::string& request, std::string& response) {
+  for (size_t offset = 0; offset < request.size();) {
+    auto ret = write(fd, request.data() + offset, request.size() - offset);
+    if (ret <= 0) {
+      if (ret == -1 && errno == EINTR) continue;
+      return false;
+    }
+    offset += ret;
+  }
+
+  response.clear();
+
+  char buffer[65536];
+  for (;;) {
+    auto ret = read(fd, buffer, sizeof(buffer));
+    if (ret <= 0) {
+      if (ret == -1 && errno == EINTR) continue;
+      return false;
+    }
+
+    response.append(buffer, ret);
+
+    // The server sends one response per request, so the NUL byte is always
+    // the last byte read.
+    if (!buffer[ret - 1]) {
+      response.pop_back();
+      return true;
+    }
+  }
+}
+
+void RunClient(const char* path, const std::vector<std::string>& requests,
+               size_t start, double deadline, ClientResult& result) {
+  int fd = Connect(path);
+
+  std::string response;
+
+  for (size_t i = start; Now() < deadline; ++i) {
+    const auto& request = requests[i % requests.size()];
+
+    const auto begin = Now();
+    if (!RoundTrip(fd, request, response))
+      errx(EXIT_FAILURE, "Connection closed by server");
+    result.latencies.emplace_back(Now() - begin);
+
+    result.response_bytes += response.size();
+    if (!response.compare(0, 9, "{\"error\":")) ++result.errors;
+  }
+
+  close(fd);
+}
+
+double Percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  auto idx = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t client_count = 4;
+  double duration = 10.0;
+  int i;
+
+  while (-1 != (i = getopt_long(argc, argv, "", kLongOptions, 0))) {
+    if (!i) continue;
+
+    switch (i) {
+      case kClientsOption:
+        client_count = strtoul(optarg, nullptr, 0);
+        if (!client_count) errx(EX_USAGE, "Invalid client count: %s", optarg);
+        break;
+
+      case kDurationOption:
+        duration = strtod(optarg, nullptr);
+        if (!(duration > 0.0)) errx(EX_USAGE, "Invalid duration: %s", optarg);
+        break;
+
+      case '?':
+        errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
+    }
+  }
+
+  if (print_help) {
+    printf(
+        "Usage: %s [OPTION]... SOCKET [QUERY-FILE]\n"
+        "\n"
+        "      --clients=N            number of concurrent connections [4]\n"
+        "      --duration=SECONDS     how long to run [10]\n"
+        "      --help     display this help and exit\n"
+        "\n"
+        "Requests are read from QUERY-FILE, one per line.  If QUERY-FILE is\n"
+        "not specified, they are read from standard input.\n",
+        argv[0]);
+
+    return EXIT_SUCCESS;
+  }
+
+  if (optind + 1 != argc && optind + 2 != argc)
+    errx(EX_USAGE, "Usage: %s [OPTION]... SOCKET [QUERY-FILE]", argv[0]);
+
+  const char* socket_path = argv[optind++];
+
+  FILE* input = stdin;
+  if (optind < argc && !(input = fopen(argv[optind], "r")))
+    err(EXIT_FAILURE, "%s", argv[optind]);
+
+  std::vector<std::string> requests;
+
+  char* line = nullptr;
+  size_t line_size = 0;
+  ssize_t line_length;
+  while (-1 != (line_length = getline(&line, &line_size, input))) {
+    if (line_length <= 1) continue;
+    requests.emplace_back(line, line_length);
+    if (requests.back().back() != '\n') requests.back().push_back('\n');
+  }
+  free(line);
+
+  if (requests.empty()) errx(EXIT_FAILURE, "No requests");
+
+  std::vector<ClientResult> results(client_count);
+  std::vector<std::thread> clients;
+
+  const auto start = Now();
+  const auto deadline = start + duration;
+
+  for (size_t j = 0; j < client_count; ++j) {
+    clients.emplace_back(RunClient, socket_path, std::cref(requests),
+                         j * requests.size() / client_count, deadline,
+                         std::ref(results[j]));
+  }
+
+  for (auto& client : clients) client.join();
+
+  const auto elapsed = Now() - start;
+
+  std::vector<double> latencies;
+  size_t errors = 0, response_bytes = 0;
+  for (const auto& result : results) {
+    latencies.insert(latencies.end(), result.latencies.begin(),
+                     result.latencies.end());
+    errors += result.errors;
+    response_bytes += result.response_bytes;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+
+  printf(
+      "{\"clients\":%zu,\"requests\":%zu,\"errors\":%zu,"
+      "\"response_bytes\":%zu,\"seconds\":%.3f,\"qps\":%.1f,"
+      "\"latency_ms\":{\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,"
+      "\"max\":%.3f}}\n",
+      client_count, latencies.size(), errors, response_bytes, elapsed,
+      latencies.size() / elapsed, 1.0e3 * Percentile(latencies, 0.50),
+      1.0e3 * Percentile(latencies, 0.95), 1.0e3 * Percentile(latencies, 0.99),
+      latencies.empty() ? 0.0 : 1.0e3 * latencies.back());
+}
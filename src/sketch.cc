@@ -0,0 +1,182 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/sketch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include <kj/debug.h>
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+const size_t kMaxVarintSize = 10;
+
+}  // namespace
+
+const size_t ThetaSketch::kDefaultSize;
+const uint64_t ThetaSketch::kMaxTheta;
+
+ThetaSketch ThetaSketch::FromOffsets(const ca_offset_score* values,
+                                     size_t count, size_t size) {
+  KJ_REQUIRE(size > 0);
+
+  ThetaSketch result;
+  result.hashes_.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    result.hashes_.emplace_back(Hash(values[i].offset));
+
+  std::sort(result.hashes_.begin(), result.hashes_.end());
+  result.hashes_.erase(
+      std::unique(result.hashes_.begin(), result.hashes_.end()),
+      result.hashes_.end());
+  result.Truncate(size);
+  result.hashes_.shrink_to_fit();
+
+  return result;
+}
+
+ThetaSketch ThetaSketch::Union(const ThetaSketch& lhs, const ThetaSketch& rhs,
+                               size_t size) {
+  KJ_REQUIRE(size > 0);
+
+  ThetaSketch result;
+  result.theta_ = std::min(lhs.theta_, rhs.theta_);
+
+  const auto lhs_end =
+      std::lower_bound(lhs.hashes_.begin(), lhs.hashes_.end(), result.theta_);
+  const auto rhs_end =
+      std::lower_bound(rhs.hashes_.begin(), rhs.hashes_.end(), result.theta_);
+  std::set_union(lhs.hashes_.begin(), lhs_end, rhs.hashes_.begin(), rhs_end,
+                 std::back_inserter(result.hashes_));
+  result.Truncate(size);
+
+  return result;
+}
+
+ThetaSketch ThetaSketch::Intersection(const ThetaSketch& lhs,
+                                      const ThetaSketch& rhs) {
+  ThetaSketch result;
+  result.theta_ = std::min(lhs.theta_, rhs.theta_);
+
+  // Hashes below both thresholds are kept by both sketches if they are in
+  // both sets.
+  const auto lhs_end =
+      std::lower_bound(lhs.hashes_.begin(), lhs.hashes_.end(), result.theta_);
+  std::set_intersection(lhs.hashes_.begin(), lhs_end, rhs.hashes_.begin(),
+                        rhs.hashes_.end(),
+                        std::back_inserter(result.hashes_));
+
+  return result;
+}
+
+ThetaSketch ThetaSketch::Difference(const ThetaSketch& lhs,
+                                    const ThetaSketch& rhs) {
+  ThetaSketch result;
+  result.theta_ = std::min(lhs.theta_, rhs.theta_);
+
+  const auto lhs_end =
+      std::lower_bound(lhs.hashes_.begin(), lhs.hashes_.end(), result.theta_);
+  std::set_difference(lhs.hashes_.begin(), lhs_end, rhs.hashes_.begin(),
+                      rhs.hashes_.end(), std::back_inserter(result.hashes_));
+
+  return result;
+}
+
+double ThetaSketch::Estimate() const {
+  if (exact()) return hashes_.size();
+
+  return hashes_.size() * (static_cast<double>(kMaxTheta) / theta_);
+}
+
+size_t ThetaSketch::FormattedSize() const {
+  // Type, payload size, theta and hash count, followed by the hashes.
+  return 1 + kMaxVarintSize * (3 + hashes_.size());
+}
+
+size_t ThetaSketch::Format(uint8_t* output, size_t output_size) const {
+  std::vector<uint8_t> payload(kMaxVarintSize * (2 + hashes_.size()));
+  auto p = payload.data();
+
+  ca_format_integer(&p, theta_);
+  ca_format_integer(&p, hashes_.size());
+
+  uint64_t previous = 0;
+  for (const auto hash : hashes_) {
+    ca_format_integer(&p, hash - previous);
+    previous = hash;
+  }
+
+  const auto payload_size = static_cast<size_t>(p - payload.data());
+
+  uint8_t* o = output;
+  *o++ = CA_OFFSET_SCORE_SKETCH;
+  ca_format_integer(&o, payload_size);
+
+  KJ_REQUIRE(o + payload_size <= output + output_size);
+  memcpy(o, payload.data(), payload_size);
+
+  return o + payload_size - output;
+}
+
+bool ThetaSketch::Parse(string_view input, ThetaSketch* sketch) {
+  auto begin = reinterpret_cast<const uint8_t*>(input.begin());
+  const auto end = reinterpret_cast<const uint8_t*>(input.end());
+
+  if (begin == end || *begin != CA_OFFSET_SCORE_SKETCH) return false;
+  ++begin;
+
+  const auto payload_size = ca_parse_integer(&begin);
+  KJ_REQUIRE(payload_size <= static_cast<uint64_t>(end - begin),
+             payload_size);
+  const auto payload_end = begin + payload_size;
+
+  ThetaSketch result;
+  result.theta_ = ca_parse_integer(&begin);
+  KJ_REQUIRE(result.theta_ > 0 && result.theta_ <= kMaxTheta, result.theta_);
+
+  const auto count = ca_parse_integer(&begin);
+  KJ_REQUIRE(count <= static_cast<uint64_t>(payload_end - begin), count);
+  result.hashes_.reserve(count);
+
+  uint64_t hash = 0;
+  for (size_t i = 0; i < count; ++i) {
+    hash += ca_parse_integer(&begin);
+    result.hashes_.emplace_back(hash);
+  }
+
+  KJ_REQUIRE(begin <= payload_end);
+  KJ_REQUIRE(result.hashes_.empty() || result.hashes_.back() < result.theta_);
+
+  *sketch = std::move(result);
+
+  return true;
+}
+
+uint64_t ThetaSketch::Hash(uint64_t offset) {
+  // The finalizer of SplitMix64, which is a bijection, so distinct offsets
+  // never collide before the top bit is dropped.
+  offset += 0x9e3779b97f4a7c15ULL;
+  offset = (offset ^ (offset >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  offset = (offset ^ (offset >> 27)) * 0x94d049bb133111ebULL;
+  offset ^= offset >> 31;
+
+  return offset >> 1;
+}
+
+void ThetaSketch::Truncate(size_t size) {
+  if (hashes_.size() <= size) return;
+
+  theta_ = hashes_[size];
+  hashes_.resize(size);
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
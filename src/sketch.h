@@ -0,0 +1,79 @@
+#ifndef CA_TABLE_SKETCH_H_
+#define CA_TABLE_SKETCH_H_ 1
+
+#include <cstdint>
+#include <vector>
+
+#include "src/ca-table.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// A theta sketch of a set of offsets, from which the size of the set, and of
+// its unions, intersections and differences with other sets, can be
+// estimated without the sets themselves.
+//
+// Offsets are hashed to 63 bits, and the sketch keeps the hashes below a
+// threshold `theta', at most `size' of them.  Sets no larger than `size' keep
+// every hash, and their sizes are exact.  Otherwise the relative error is
+// about 1/sqrt(size).
+class ThetaSketch {
+ public:
+  // The number of hashes kept by sketches stored in index tables.
+  static const size_t kDefaultSize = 1024;
+
+  // An empty set.
+  ThetaSketch() = default;
+
+  // Returns the sketch of the offsets of `values', which may have duplicates
+  // and be in any order.
+  static ThetaSketch FromOffsets(const ca_offset_score* values, size_t count,
+                                 size_t size = kDefaultSize);
+
+  static ThetaSketch Union(const ThetaSketch& lhs, const ThetaSketch& rhs,
+                           size_t size = kDefaultSize);
+
+  static ThetaSketch Intersection(const ThetaSketch& lhs,
+                                  const ThetaSketch& rhs);
+
+  // Estimates the offsets in `lhs' that are not in `rhs'.
+  static ThetaSketch Difference(const ThetaSketch& lhs,
+                                const ThetaSketch& rhs);
+
+  // Returns the estimated number of distinct offsets.
+  double Estimate() const;
+
+  // Returns true if Estimate() is exact.
+  bool exact() const { return theta_ == kMaxTheta; }
+
+  // Returns the maximum size of the output of Format().
+  size_t FormattedSize() const;
+
+  // Writes the sketch as a CA_OFFSET_SCORE_SKETCH record, to be followed by
+  // the values it describes.  Returns the number of bytes written.
+  size_t Format(uint8_t* output, size_t output_size) const;
+
+  // Reads the CA_OFFSET_SCORE_SKETCH record at the start of `input', if
+  // any.  Returns false, without reading the values, if there is none.
+  static bool Parse(string_view input, ThetaSketch* sketch);
+
+ private:
+  static const uint64_t kMaxTheta = uint64_t(1) << 63;
+
+  static uint64_t Hash(uint64_t offset);
+
+  // Keeps at most `size' hashes, lowering `theta_' if necessary.
+  void Truncate(size_t size);
+
+  uint64_t theta_ = kMaxTheta;
+
+  // The distinct hashes below `theta_', in ascending order.
+  std::vector<uint64_t> hashes_;
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !CA_TABLE_SKETCH_H_
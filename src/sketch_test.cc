@@ -0,0 +1,155 @@
+#include <cmath>
+#include <vector>
+
+#include <kj/debug.h>
+
+#include "src/ca-table.h"
+#include "src/sketch.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace cantera::table;
+using namespace cantera::table::internal;
+
+namespace {
+
+// Returns the values with offsets in [begin, end) that are multiples of
+// `step'.
+std::vector<ca_offset_score> MakeValues(uint64_t begin, uint64_t end,
+                                        uint64_t step = 1) {
+  std::vector<ca_offset_score> result;
+  for (auto offset = begin; offset < end; ++offset) {
+    if (offset % step == 0)
+      result.emplace_back(offset, static_cast<float>(offset % 100));
+  }
+  return result;
+}
+
+ThetaSketch MakeSketch(const std::vector<ca_offset_score>& values) {
+  return ThetaSketch::FromOffsets(values.data(), values.size());
+}
+
+// Expects `sketch' to estimate `expected' within 10%, about three standard
+// deviations.
+void ExpectEstimate(double expected, const ThetaSketch& sketch) {
+  EXPECT_FALSE(sketch.exact());
+  EXPECT_NEAR(expected, sketch.Estimate(), expected * 0.1);
+}
+
+}  // namespace
+
+struct SketchTest : testing::Test {};
+
+TEST_F(SketchTest, SmallSetsAreExact) {
+  EXPECT_TRUE(ThetaSketch().exact());
+  EXPECT_EQ(0, ThetaSketch().Estimate());
+
+  auto values = MakeValues(0, ThetaSketch::kDefaultSize);
+  // Duplicates are counted once.
+  values.emplace_back(values.front());
+
+  const auto sketch = MakeSketch(values);
+  EXPECT_TRUE(sketch.exact());
+  EXPECT_EQ(ThetaSketch::kDefaultSize, sketch.Estimate());
+
+  const auto half = MakeSketch(MakeValues(0, ThetaSketch::kDefaultSize, 2));
+  EXPECT_EQ(ThetaSketch::kDefaultSize / 2,
+            ThetaSketch::Intersection(sketch, half).Estimate());
+  EXPECT_EQ(ThetaSketch::kDefaultSize / 2,
+            ThetaSketch::Difference(sketch, half).Estimate());
+  EXPECT_EQ(ThetaSketch::kDefaultSize,
+            ThetaSketch::Union(sketch, half).Estimate());
+}
+
+TEST_F(SketchTest, Estimates) {
+  const auto a = MakeSketch(MakeValues(0, 200000));
+  const auto b = MakeSketch(MakeValues(100000, 400000));
+  const auto c = MakeSketch(MakeValues(0, 400000, 4));
+
+  ExpectEstimate(200000, a);
+  ExpectEstimate(300000, b);
+  ExpectEstimate(100000, c);
+
+  ExpectEstimate(400000, ThetaSketch::Union(a, b));
+  ExpectEstimate(100000, ThetaSketch::Intersection(a, b));
+  ExpectEstimate(100000, ThetaSketch::Difference(a, b));
+  ExpectEstimate(200000, ThetaSketch::Difference(b, a));
+
+  // (a AND c) OR (b AND c).
+  ExpectEstimate(100000,
+                 ThetaSketch::Union(ThetaSketch::Intersection(a, c),
+                                    ThetaSketch::Intersection(b, c)));
+
+  // A small exact set intersected with a large one.
+  const auto small = MakeSketch(MakeValues(0, 1000));
+  EXPECT_NEAR(1000, ThetaSketch::Intersection(small, a).Estimate(), 300);
+  EXPECT_EQ(0, ThetaSketch::Intersection(
+                   small, MakeSketch(MakeValues(1000, 200000)))
+                   .Estimate());
+}
+
+TEST_F(SketchTest, FormatAndParse) {
+  for (const auto count : {0, 10, 100000}) {
+    const auto values = MakeValues(0, count);
+    const auto sketch = MakeSketch(values);
+
+    std::vector<uint8_t> data(sketch.FormattedSize() +
+                              ca_offset_score_impact_size(
+                                  values.data(), values.size(), 1000) +
+                              ca_offset_score_size(values.data(),
+                                                   values.size()));
+    auto size = sketch.Format(data.data(), data.size());
+    ASSERT_EQ(CA_OFFSET_SCORE_SKETCH, data[0]);
+
+    // Values written after the sketch, as by ca_table_write_index().
+    size += ca_format_offset_score_impact(&data[size], data.size() - size,
+                                          values.data(), values.size(), 1000);
+    size += ca_format_offset_score(&data[size], data.size() - size,
+                                   values.data(), values.size());
+    data.resize(size);
+
+    const cantera::string_view input{
+        reinterpret_cast<const char*>(data.data()), data.size()};
+
+    ThetaSketch parsed_sketch;
+    ASSERT_TRUE(ThetaSketch::Parse(input, &parsed_sketch));
+    EXPECT_EQ(sketch.exact(), parsed_sketch.exact());
+    EXPECT_EQ(sketch.Estimate(), parsed_sketch.Estimate());
+
+    // The sketch is skipped when reading the values.
+    std::vector<ca_offset_score> parsed;
+    ca_offset_score_parse(input, &parsed);
+    ASSERT_EQ(values.size(), parsed.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+      EXPECT_EQ(values[i].offset, parsed[i].offset);
+      EXPECT_EQ(values[i].score, parsed[i].score);
+    }
+
+    EXPECT_EQ(values.size(),
+              ca_offset_score_count(&data[0], &data[data.size()]));
+
+    parsed.clear();
+    EXPECT_EQ(values.size(), ca_offset_score_parse_top(input, 5, &parsed));
+
+    parsed.clear();
+    ca_offset_score_parse_score_range(input, 10, 20, &parsed);
+    for (const auto& value : parsed) {
+      EXPECT_LE(10, value.score);
+      EXPECT_GE(20, value.score);
+    }
+  }
+}
+
+TEST_F(SketchTest, ParseWithoutSketch) {
+  const auto values = MakeValues(0, 100);
+
+  std::vector<uint8_t> data(ca_offset_score_size(values.data(), values.size()));
+  data.resize(ca_format_offset_score(data.data(), data.size(), values.data(),
+                                     values.size()));
+
+  ThetaSketch sketch;
+  EXPECT_FALSE(ThetaSketch::Parse(
+      cantera::string_view{reinterpret_cast<const char*>(data.data()),
+                           data.size()},
+      &sketch));
+  EXPECT_FALSE(ThetaSketch::Parse(cantera::string_view{}, &sketch));
+}
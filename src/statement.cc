@@ -1,33 +1,137 @@
+#include <chrono>
 #include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include <kj/debug.h>
+
+#include "src/access-log.h"
 #include "src/ca-table.h"
+#include "src/deadline.h"
+#include "src/memory-budget.h"
 #include "src/query.h"
 #include "src/select.h"
+#include "src/stats.h"
+#include "src/trace.h"
 
 namespace cantera {
 namespace table {
 
+size_t CA_memory_limit = size_t(4) << 30;
+uint64_t CA_statement_timeout = 0;
+
+namespace {
+
+// Adds the index keys looked up by `stmt' to `keys'.
+void CollectStatementKeys(const Statement* stmt,
+                          std::vector<std::string>& keys) {
+  switch (stmt->type) {
+    case kStatementQuery:
+      CollectIndexKeys(stmt->u.query.query, keys);
+      if (stmt->u.query.thresholds) {
+        auto key = stmt->u.query.thresholds->key;
+        if (*key == '~') ++key;
+        keys.emplace_back(key);
+      }
+      break;
+
+    case kStatementCorrelate:
+      CollectIndexKeys(stmt->u.query_correlate.query_A, keys);
+      CollectIndexKeys(stmt->u.query_correlate.query_B, keys);
+      break;
+
+    case kStatementSelect:
+      CollectIndexKeys(stmt->u.select.query, keys);
+      for (auto field = stmt->u.select.fields; field; field = field->next)
+        CollectIndexKeys(field->query, keys);
+      break;
+
+    default:
+      break;
+  }
+}
+
+}  // namespace
+
 void CA_process_statement(QueryParseContext* context, Statement* stmt) {
+  // Statements run to completion on the schema generation that is current
+  // when they start, even if the schema is reloaded in the meantime.
+  const auto schema = context->schemas->Current();
+
+  // Intermediate results are charged to this, so that a statement using too
+  // much memory fails before the process runs out of it.
+  internal::MemoryBudget memory_budget(CA_memory_limit);
+  internal::MemoryBudget::Scope memory_scope(&memory_budget);
+
+  // Lists prefetched for the statement count against its limit too.
+  internal::MemoryCharge prefetch_memory;
+  prefetch_memory.Set(IndexKeyPrefetch::MemoryUsed());
+
+  // Long-running loops check this, so that a statement that runs out of time
+  // fails promptly.
+  internal::Deadline deadline{
+      std::chrono::milliseconds(CA_statement_timeout)};
+  internal::Deadline::Scope deadline_scope(&deadline);
+
   /* Execute the statement itself */
 
   switch (stmt->type) {
     case kStatementQuery:
-      ca_schema_query(context->schema.get(), stmt->u.query);
+      if (context->shards.empty()) {
+        ca_schema_query(schema.get(), stmt->u.query);
+      } else {
+        std::vector<std::shared_ptr<Schema>> generations;
+        std::vector<Schema*> shards;
+        for (const auto& shard : context->shards) {
+          generations.emplace_back(shard->Current());
+          shards.emplace_back(generations.back().get());
+        }
+        ca_sharded_query(shards, stmt->u.query);
+      }
       break;
 
     case kStatementCorrelate:
-      ca_schema_query_correlate(context->schema.get(),
+      KJ_REQUIRE(context->shards.empty(),
+                 "CORRELATE is not supported on sharded schemas");
+      ca_schema_query_correlate(schema.get(),
                                 stmt->u.query_correlate.query_A,
                                 stmt->u.query_correlate.query_B);
       break;
 
+    case kStatementEstimateCount: {
+      std::vector<std::shared_ptr<Schema>> generations;
+      std::vector<Schema*> shards;
+      if (context->shards.empty()) {
+        shards.emplace_back(schema.get());
+      } else {
+        for (const auto& shard : context->shards) {
+          generations.emplace_back(shard->Current());
+          shards.emplace_back(generations.back().get());
+        }
+      }
+      ca_schema_estimate_count(shards, stmt->u.estimate_count.query);
+    } break;
+
     case kStatementParse:
       PrintQuery(stmt->u.parse.query);
       printf("\n");
       break;
 
+    case kStatementReloadSchema:
+      if (context->reload_schema) {
+        context->reload_schema();
+      } else if (context->shards.empty()) {
+        context->schemas->Reload();
+      } else {
+        for (const auto& shard : context->shards) shard->Reload();
+      }
+      break;
+
     case kStatementSelect:
-      Select(context->schema.get(), stmt->u.select);
+      KJ_REQUIRE(context->shards.empty(),
+                 "SELECT is not supported on sharded schemas");
+      Select(schema.get(), stmt->u.select);
       break;
 
     case kStatementSet:
@@ -43,8 +147,101 @@ void CA_process_statement(QueryParseContext* context, Statement* stmt) {
           strcpy(CA_time_format, stmt->u.set.v.string_value);
 
           break;
+
+        case CA_PARAM_TRACE:
+          if (stmt->u.set.v.string_value)
+            internal::StartTrace(stmt->u.set.v.string_value);
+          else
+            internal::StopTrace();
+          break;
+
+        case CA_PARAM_MEMORY_LIMIT:
+          KJ_REQUIRE(stmt->u.set.v.int_value >= 0,
+                     "memory limit must not be negative");
+          CA_memory_limit = stmt->u.set.v.int_value;
+          break;
+
+        case CA_PARAM_STATEMENT_TIMEOUT:
+          KJ_REQUIRE(stmt->u.set.v.int_value >= 0,
+                     "statement timeout must not be negative");
+          CA_statement_timeout = stmt->u.set.v.int_value;
+          break;
       }
       break;
+
+    case kStatementShowStats:
+      printf("%s\n", internal::StatsToJSON().c_str());
+      break;
+  }
+}
+
+void CA_submit_statement(QueryParseContext* context, Statement* stmt) {
+  if (context->batch_mode) {
+    stmt->next = nullptr;
+    *context->batch_tail = stmt;
+    context->batch_tail = &stmt->next;
+    return;
+  }
+
+  CA_process_statement(context, stmt);
+  fflush(stdout);
+
+  internal::FlushAccessLogsIfDue();
+}
+
+void CA_process_batch(QueryParseContext* context) {
+  auto stmt = context->batch;
+  context->batch = nullptr;
+  context->batch_tail = &context->batch;
+
+  while (stmt) {
+    // Keeps the generation alive, so that the prefetched lists can't be
+    // mistaken for those of a later generation at the same address.
+    const auto schema = context->schemas->Current();
+
+    // Keys are shared by the statements up to the next RELOAD SCHEMA, which
+    // may replace the index tables, or SET, which may change the limits the
+    // prefetch is subject to.
+    std::vector<std::string> keys;
+    auto end = stmt;
+    for (; end && end->type != kStatementReloadSchema &&
+           end->type != kStatementSet;
+         end = end->next)
+      CollectStatementKeys(end, keys);
+
+    // The prefetched lists outlive every statement, so they have a budget of
+    // their own, and each statement charges them to its budget as well.
+    // Together they stay within the limit of a single statement.
+    internal::MemoryBudget prefetch_budget(CA_memory_limit);
+
+    // Sharded queries run in other threads, and look up keys themselves.
+    std::unique_ptr<IndexKeyPrefetch> prefetch;
+    if (context->shards.empty() && !keys.empty()) {
+      internal::MemoryBudget::Scope memory_scope(&prefetch_budget);
+
+      // Reading the keys takes at most as long as a statement may.
+      internal::Deadline deadline{
+          std::chrono::milliseconds(CA_statement_timeout)};
+      internal::Deadline::Scope deadline_scope(&deadline);
+
+      prefetch = std::make_unique<IndexKeyPrefetch>(schema.get(),
+                                                    std::move(keys));
+    }
+
+    for (; stmt != end; stmt = stmt->next) {
+      CA_process_statement(context, stmt);
+      fflush(stdout);
+    }
+
+    prefetch.reset();
+
+    if (stmt) {
+      CA_process_statement(context, stmt);
+      fflush(stdout);
+      stmt = stmt->next;
+    }
+
+    internal::FlushAccessLogsIfDue();
   }
 }
 
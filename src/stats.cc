@@ -0,0 +1,155 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/stats.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "src/util.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+namespace {
+
+std::mutex table_stats_mutex;
+
+// Never destroyed, since tables may be closed by static destructors.
+auto& table_stats = *new std::map<std::string, std::unique_ptr<TableStats>>;
+
+const char* PostingFormatName(size_t type) {
+  switch (type) {
+    case CA_OFFSET_SCORE_WITH_PREDICTION:
+      return "with-prediction";
+    case CA_OFFSET_SCORE_FLEXI:
+      return "flexi";
+    case CA_OFFSET_SCORE_DELTA_OROCH_FLOAT:
+      return "delta-oroch-float";
+    case CA_OFFSET_SCORE_DELTA_OROCH_OROCH:
+      return "delta-oroch-oroch";
+    case CA_OFFSET_SCORE_SINGLE_FLOAT:
+      return "single-float";
+    case CA_OFFSET_SCORE_SINGLE_POSITIVE_1:
+    case CA_OFFSET_SCORE_SINGLE_NEGATIVE_1:
+    case CA_OFFSET_SCORE_SINGLE_POSITIVE_2:
+    case CA_OFFSET_SCORE_SINGLE_NEGATIVE_2:
+    case CA_OFFSET_SCORE_SINGLE_POSITIVE_3:
+    case CA_OFFSET_SCORE_SINGLE_NEGATIVE_3:
+      return "single-integer";
+    default:
+      return nullptr;
+  }
+}
+
+struct TableStatsSnapshot {
+  uint64_t seeks = 0;
+  uint64_t blocks_read = 0;
+  uint64_t bytes_read = 0;
+  uint64_t bytes_decompressed = 0;
+  uint64_t decompress_ns = 0;
+  uint64_t cache_hits = 0;
+  uint64_t cache_misses = 0;
+
+  void Add(const TableStats& stats) {
+    seeks += stats.seeks;
+    blocks_read += stats.blocks_read;
+    bytes_read += stats.bytes_read;
+    bytes_decompressed += stats.bytes_decompressed;
+    decompress_ns += stats.decompress_ns;
+    cache_hits += stats.cache_hits;
+    cache_misses += stats.cache_misses;
+  }
+
+  std::string ToJSON() const {
+    return StringPrintf(
+        "{\"seeks\":%llu,\"blocks-read\":%llu,\"bytes-read\":%llu,"
+        "\"bytes-decompressed\":%llu,\"decompress-ns\":%llu,"
+        "\"cache-hits\":%llu,\"cache-misses\":%llu}",
+        static_cast<unsigned long long>(seeks),
+        static_cast<unsigned long long>(blocks_read),
+        static_cast<unsigned long long>(bytes_read),
+        static_cast<unsigned long long>(bytes_decompressed),
+        static_cast<unsigned long long>(decompress_ns),
+        static_cast<unsigned long long>(cache_hits),
+        static_cast<unsigned long long>(cache_misses));
+  }
+};
+
+}  // namespace
+
+TableStats* GetTableStats(const std::string& path) {
+  std::lock_guard<std::mutex> lock(table_stats_mutex);
+
+  auto& result = table_stats[path];
+  if (!result) result = std::make_unique<TableStats>();
+
+  return result.get();
+}
+
+DecodeStats& GetDecodeStats() {
+  static DecodeStats result;
+  return result;
+}
+
+LookupStats& GetLookupStats() {
+  static LookupStats result;
+  return result;
+}
+
+std::string StatsToJSON() {
+  std::string result = "{\"tables\":{";
+
+  TableStatsSnapshot total;
+
+  {
+    std::lock_guard<std::mutex> lock(table_stats_mutex);
+
+    for (const auto& entry : table_stats) {
+      TableStatsSnapshot snapshot;
+      snapshot.Add(*entry.second);
+      total.Add(*entry.second);
+
+      if (result.back() != '{') result.push_back(',');
+      ToJSON(entry.first, result);
+      result.push_back(':');
+      result += snapshot.ToJSON();
+    }
+  }
+
+  result += "},\"total\":";
+  result += total.ToJSON();
+
+  // Several encodings share a name, so sum them up first.
+  std::map<std::string, uint64_t> postings;
+  const auto& decode_stats = GetDecodeStats();
+  for (size_t type = 0; type <= CA_OFFSET_SCORE_LAST; ++type) {
+    if (const auto name = PostingFormatName(type))
+      postings[name] += decode_stats.postings[type];
+  }
+
+  result += ",\"postings-decoded\":{";
+  for (const auto& entry : postings) {
+    if (result.back() != '{') result.push_back(',');
+    result += StringPrintf("\"%s\":%llu", entry.first.c_str(),
+                           static_cast<unsigned long long>(entry.second));
+  }
+
+  const auto& lookup_stats = GetLookupStats();
+  result += StringPrintf(
+      "},\"decode-ns\":%llu,\"index-lookups\":{\"keys\":%llu,"
+      "\"tables-searched\":%llu,\"tables-skipped\":%llu}}",
+      static_cast<unsigned long long>(decode_stats.decode_ns.load()),
+      static_cast<unsigned long long>(lookup_stats.keys.load()),
+      static_cast<unsigned long long>(lookup_stats.tables_searched.load()),
+      static_cast<unsigned long long>(lookup_stats.tables_skipped.load()));
+
+  return result;
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
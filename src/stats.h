@@ -0,0 +1,92 @@
+#ifndef CA_TABLE_STATS_H_
+#define CA_TABLE_STATS_H_ 1
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <kj/common.h>
+
+#include "src/ca-table.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+// I/O counters for one table file.  Every open instance of the same path
+// shares one set of counters.  Counters are updated with relaxed atomic
+// additions, so a snapshot is not necessarily consistent across counters.
+struct TableStats {
+  std::atomic<uint64_t> seeks{0};
+  std::atomic<uint64_t> blocks_read{0};
+  std::atomic<uint64_t> bytes_read{0};
+  std::atomic<uint64_t> bytes_decompressed{0};
+  std::atomic<uint64_t> decompress_ns{0};
+  std::atomic<uint64_t> cache_hits{0};
+  std::atomic<uint64_t> cache_misses{0};
+};
+
+// Posting list decoding counters, for all tables.
+struct DecodeStats {
+  // Number of decoded offset/score pairs, indexed by `ca_offset_score_type'.
+  std::atomic<uint64_t> postings[CA_OFFSET_SCORE_LAST + 1];
+
+  // Time spent decoding multi-posting encodings.  Single-posting encodings
+  // are too cheap to time.
+  std::atomic<uint64_t> decode_ns{0};
+
+  DecodeStats() {
+    for (auto& p : postings) p = 0;
+  }
+};
+
+// Index key lookup counters, for all schemas.  Tables are skipped when their
+// key range or shard can't contain the key.
+struct LookupStats {
+  std::atomic<uint64_t> keys{0};
+  std::atomic<uint64_t> tables_searched{0};
+  std::atomic<uint64_t> tables_skipped{0};
+};
+
+// Returns the counters for the table at `path'.  The returned object lives
+// until the process exits.
+TableStats* GetTableStats(const std::string& path);
+
+DecodeStats& GetDecodeStats();
+
+LookupStats& GetLookupStats();
+
+// Returns all counters as a JSON object, with one member per table, the sum
+// over all tables, the posting list decoding counters and the index lookup
+// counters.
+std::string StatsToJSON();
+
+inline void AddStat(std::atomic<uint64_t>& counter, uint64_t amount = 1) {
+  counter.fetch_add(amount, std::memory_order_relaxed);
+}
+
+// Adds the time elapsed between construction and destruction to a counter.
+class ScopedStatTimer {
+ public:
+  explicit ScopedStatTimer(std::atomic<uint64_t>& counter)
+      : counter_(counter), start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedStatTimer() {
+    AddStat(counter_, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start_)
+                          .count());
+  }
+
+  KJ_DISALLOW_COPY(ScopedStatTimer);
+
+ private:
+  std::atomic<uint64_t>& counter_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#endif  // !CA_TABLE_STATS_H_
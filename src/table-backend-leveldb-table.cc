@@ -41,12 +41,16 @@
 
 #include <kj/debug.h>
 #include <leveldb/env.h>
+#include <leveldb/filter_policy.h>
 #include <leveldb/iterator.h>
 #include <leveldb/options.h>
 #include <leveldb/table.h>
 #include <leveldb/table_builder.h>
 
+#include "src/access-log.h"
 #include "src/ca-table.h"
+#include "src/stats.h"
+#include "src/trace.h"
 #include "src/util.h"
 
 #if !HAVE_FDATASYNC || !HAVE_DECL_FDATASYNC
@@ -71,7 +75,9 @@ namespace {
 class LevelDBFile : public leveldb::RandomAccessFile,
                     public leveldb::WritableFile {
  public:
-  LevelDBFile(kj::AutoCloseFd&& fd) : fd_(std::move(fd)) {}
+  LevelDBFile(kj::AutoCloseFd&& fd, TableStats* stats = nullptr,
+              AccessRecorder* access = nullptr)
+      : fd_(std::move(fd)), stats_(stats), access_(access) {}
 
   ~LevelDBFile() noexcept(true) {
     try {
@@ -82,9 +88,16 @@ class LevelDBFile : public leveldb::RandomAccessFile,
 
   leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result,
                        char* scratch) const override {
+    CA_TRACE_SPAN("table", "read-block");
+
     auto amount_read = pread(fd_.get(), scratch, n, offset);
     if (amount_read < 0)
       return leveldb::Status::IOError("pread failed", strerror(errno));
+    if (stats_) {
+      AddStat(stats_->blocks_read);
+      AddStat(stats_->bytes_read, amount_read);
+    }
+    if (access_) access_->Record(offset, n);
     *result = leveldb::Slice(scratch, static_cast<size_t>(n));
     return leveldb::Status::OK();
   }
@@ -125,6 +138,12 @@ class LevelDBFile : public leveldb::RandomAccessFile,
 
  private:
   mutable kj::AutoCloseFd fd_;
+
+  // Read counters, or nullptr for files being written.
+  TableStats* stats_;
+
+  // Block access recorder, or nullptr if recording is disabled.
+  AccessRecorder* access_;
 };
 
 /*****************************************************************************/
@@ -132,16 +151,20 @@ class LevelDBFile : public leveldb::RandomAccessFile,
 class LevelDBTable : public Table {
  public:
   LevelDBTable(std::unique_ptr<leveldb::WritableFile>&& writable_file,
-               leveldb::Options& leveldb_options, int temp_fd, std::string path)
-      : writable_file_(std::move(writable_file)),
+               leveldb::Options& leveldb_options,
+               std::unique_ptr<const leveldb::FilterPolicy>&& filter_policy,
+               int temp_fd, std::string path)
+      : filter_policy_(std::move(filter_policy)),
+        writable_file_(std::move(writable_file)),
         table_builder_(std::make_unique<leveldb::TableBuilder>(
             leveldb_options, writable_file_.get())),
         temp_fd_(temp_fd),
         path_(std::move(path)) {}
 
   LevelDBTable(std::unique_ptr<leveldb::RandomAccessFile>&& file,
-               leveldb::Table* table)
-      : file_(std::move(file)),
+               leveldb::Table* table, TableStats* stats)
+      : stats_(stats),
+        file_(std::move(file)),
         table_(table),
         iterator_(table_->NewIterator(leveldb::ReadOptions())) {
     iterator_->SeekToFirst();
@@ -196,6 +219,24 @@ class LevelDBTable : public Table {
                    const_cast<const void**>(&value->iov_base), &value->iov_len);
   }
 
+  bool GetKeyRange(std::string* first_key, std::string* last_key) override {
+    KJ_REQUIRE(table_ != nullptr);
+
+    // Uses a separate iterator, to keep the cursor.
+    std::unique_ptr<leveldb::Iterator> iterator(
+        table_->NewIterator(leveldb::ReadOptions()));
+
+    iterator->SeekToFirst();
+    if (!iterator->Valid()) return false;
+    *first_key = iterator->key().ToString();
+
+    iterator->SeekToLast();
+    KJ_REQUIRE(iterator->Valid());
+    *last_key = iterator->key().ToString();
+
+    return true;
+  }
+
   void Add(const leveldb::Slice& key, const leveldb::Slice& value) {
     KJ_REQUIRE(table_builder_ != nullptr);
     auto key_begin = reinterpret_cast<const uint8_t*>(key.data());
@@ -214,6 +255,8 @@ class LevelDBTable : public Table {
   bool SeekToKey(const leveldb::Slice& key) {
     KJ_REQUIRE(iterator_ != nullptr);
 
+    AddStat(stats_->seeks);
+
     iterator_->Seek(key);
 
     need_seek_ = false;
@@ -253,6 +296,10 @@ class LevelDBTable : public Table {
   }
 
  private:
+  // Filter policy referenced by the options given to `table_builder_'.  Must
+  // outlive the builder, so it's declared first.
+  std::unique_ptr<const leveldb::FilterPolicy> filter_policy_;
+
   // Writing
   std::unique_ptr<leveldb::WritableFile> writable_file_;
   std::unique_ptr<leveldb::TableBuilder> table_builder_;
@@ -268,6 +315,7 @@ class LevelDBTable : public Table {
   std::string path_;
 
   // Reading
+  TableStats* stats_ = nullptr;
   std::unique_ptr<leveldb::RandomAccessFile> file_;
   std::unique_ptr<leveldb::Table> table_;
   std::unique_ptr<leveldb::Iterator> iterator_;
@@ -310,19 +358,37 @@ std::unique_ptr<Table> LevelDBTableBackend::Create(
       KJ_FAIL_REQUIRE("LevelDB tables do not support given compression method");
   }
 
+  if (options.GetBlockSize() > 0)
+    leveldb_options.block_size = options.GetBlockSize();
+
+  if (options.GetBlockRestartInterval() > 0)
+    leveldb_options.block_restart_interval = options.GetBlockRestartInterval();
+
+  // NOTE: leveldb::Table only consults the filter block from its internal
+  // point lookup path, not from iterators, so the filter mainly benefits
+  // other LevelDB-based readers of the table.
+  std::unique_ptr<const leveldb::FilterPolicy> filter_policy;
+  if (options.GetFilterBitsPerKey() > 0) {
+    filter_policy.reset(
+        leveldb::NewBloomFilterPolicy(options.GetFilterBitsPerKey()));
+    leveldb_options.filter_policy = filter_policy.get();
+  }
+
   return std::make_unique<LevelDBTable>(std::move(file), leveldb_options,
-                                        temp_fd, path);
+                                        std::move(filter_policy), temp_fd,
+                                        path);
 }
 
 std::unique_ptr<Table> LevelDBTableBackend::Open(const char* path) {
-  auto file =
-      std::make_unique<LevelDBFile>(OpenFile(path, O_RDONLY | O_CLOEXEC));
+  auto stats = GetTableStats(path);
+  auto file = std::make_unique<LevelDBFile>(
+      OpenFile(path, O_RDONLY | O_CLOEXEC), stats, AccessRecorder::Get(path));
 
   leveldb::Table* table;
   CHECK_STATUS(leveldb::Table::Open(leveldb::Options(), file.get(),
                                     file->FileSize(), &table));
 
-  return std::make_unique<LevelDBTable>(std::move(file), table);
+  return std::make_unique<LevelDBTable>(std::move(file), table, stats);
 }
 
 std::unique_ptr<SeekableTable> LevelDBTableBackend::OpenSeekable(
@@ -47,7 +47,10 @@
 
 #include <zstd.h>
 
+#include "src/access-log.h"
 #include "src/ca-table.h"
+#include "src/stats.h"
+#include "src/trace.h"
 #include "src/util.h"
 
 #include "third_party/oroch/oroch/integer_codec.h"
@@ -603,6 +606,19 @@ class WriteOnceIndex {
       return blocks_[num];
     }
 
+    // Returns the number of the block containing the given file offset.
+    size_t FindBlockByOffset(uint64_t offset) {
+      if (blocks_.empty()) InitializeBlocks();
+      auto pos = std::upper_bound(blocks_.begin(), blocks_.end(), offset);
+      if (pos == blocks_.begin()) return 0;
+      return std::distance(blocks_.begin(), pos) - 1;
+    }
+
+    string_view GetLastKey(size_t num) {
+      if (keys_.empty()) InitializeKeys();
+      return keys_[num];
+    }
+
    private:
     void InitializeKeys() {
       size_t num = index_.num_blocks();
@@ -743,6 +759,8 @@ class WriteOnceBuilder {
   }
 
   void WriteBlock(const WriteOnceBlock& block, WriteOnceIndex& index) {
+    CA_TRACE_SPAN("load", "write-block");
+
     bool seekable = options_.GetOutputSeekable();
     block.Marshal(marshal_buffer_, seekable);
     if (!marshal_buffer_.size()) return;
@@ -775,6 +793,8 @@ class WriteOnceBuilder {
     if (compression_ == TableCompression::kTableCompressionNone)
       return marshal_buffer_;
 
+    CA_TRACE_SPAN("load", "compress");
+
     compress_buffer_.reserve(ZSTD_compressBound(marshal_buffer_.size()));
     compressor_.Go(compress_buffer_, marshal_buffer_, compression_level_);
 
@@ -843,7 +863,10 @@ class WriteOnceSortingBuilder : public WriteOnceBuilder {
 
   uint64_t Build() override {
     FlushEntryData();
-    SortEntries();
+    {
+      CA_TRACE_SPAN("load", "sort-entries");
+      SortEntries();
+    }
 
     DataBuffer buffer;
     for (const Entry& entry : index_) {
@@ -976,6 +999,12 @@ class WriteOnceReader {
 
   virtual bool ReadRow(struct iovec* key, struct iovec* value) = 0;
 
+  virtual std::vector<std::string> SplitKeys(size_t count) { return {}; }
+
+  virtual bool GetKeyRange(std::string* first_key, std::string* last_key) {
+    return false;
+  }
+
   virtual off_t Offset() = 0;
 
   virtual void Seek(off_t offset, int whence) = 0;
@@ -1004,6 +1033,8 @@ class WriteOnceReader_v4 : public WriteOnceReader {
       : WriteOnceReader(path, std::move(fd), index_offset),
         compression_(compression),
         seekable_(seekable),
+        stats_(GetTableStats(path)),
+        access_(AccessRecorder::Get(path)),
         index_cache_(index_),
         block_cache_(block_) {
     ReadIndex();
@@ -1017,9 +1048,11 @@ class WriteOnceReader_v4 : public WriteOnceReader {
   }
 
   bool SeekToKey(const string_view& key) override {
+    AddStat(stats_->seeks);
+
     uint64_t block_num = index_cache_.FindBlockByKey(key);
     if (block_num >= index_.num_blocks()) return NotFound();
-    if (block_num != block_read_num_) ReadBlock(block_num);
+    LoadBlock(block_num);
 
     block_num_ = block_num;
     entry_num_ = block_cache_.FindEntryByKey(key);
@@ -1074,6 +1107,39 @@ class WriteOnceReader_v4 : public WriteOnceReader {
     return true;
   }
 
+  std::vector<std::string> SplitKeys(size_t count) override {
+    std::vector<std::string> result;
+
+    const auto num_blocks = index_.num_blocks();
+    for (size_t i = 1; i < count; ++i) {
+      const auto block_num = i * num_blocks / count;
+      if (!block_num) continue;
+
+      // Split right after the last key of the preceding block, so that rows
+      // sharing a key never end up in different parts.
+      auto key = index_cache_.GetLastKey(block_num - 1).to_string();
+      key.push_back(0);
+      if (result.empty() || result.back() != key)
+        result.emplace_back(std::move(key));
+    }
+
+    return result;
+  }
+
+  bool GetKeyRange(std::string* first_key, std::string* last_key) override {
+    const auto num_blocks = index_.num_blocks();
+    if (!num_blocks) return false;
+
+    // The index only stores the last key of each block, so the first key
+    // costs a block read.  The cursor is kept, since ReadRow() reloads its
+    // block if needed.
+    LoadBlock(0);
+    *first_key = block_cache_.GetKey(0).to_string();
+    *last_key = index_cache_.GetLastKey(num_blocks - 1).to_string();
+
+    return true;
+  }
+
   off_t Offset() override {
     KJ_REQUIRE(seekable_);
 
@@ -1112,12 +1178,11 @@ class WriteOnceReader_v4 : public WriteOnceReader {
     KJ_REQUIRE(offset <= index_offset_,
                "attempt to seek past end of table");
 
-    block_num_ = 0;
-    while ((block_num_ + 1) < index_.num_blocks() &&
-           index_cache_.GetBlockOffset(block_num_ + 1) <= offset)
-      ++block_num_;
+    AddStat(stats_->seeks);
 
-    if (block_num_ != block_read_num_) ReadBlock(block_num_);
+    block_num_ = index_cache_.FindBlockByOffset(offset);
+
+    LoadBlock(block_num_);
 
     entry_num_ =
         block_.GetEntryNumber(offset - index_cache_.GetBlockOffset(block_num_));
@@ -1130,7 +1195,21 @@ class WriteOnceReader_v4 : public WriteOnceReader {
     index_.Unmarshal(Read(index_offset_, size, compressed));
   }
 
+  // Reads the given block, unless it's already loaded.  Used by random access
+  // paths, where it's interesting to know how often the block is reused.
+  void LoadBlock(size_t num) {
+    if (num == block_read_num_) {
+      AddStat(stats_->cache_hits);
+      return;
+    }
+
+    AddStat(stats_->cache_misses);
+    ReadBlock(num);
+  }
+
   void ReadBlock(size_t num) {
+    CA_TRACE_SPAN("table", "read-block");
+
     KJ_REQUIRE(num < index_.num_blocks());
 
     uint64_t offset = index_cache_.GetBlockOffset(num);
@@ -1159,11 +1238,21 @@ class WriteOnceReader_v4 : public WriteOnceReader {
     read_buffer_.resize(size);
     FileIO(fd_).Read(read_buffer_, offset);
 
+    AddStat(stats_->blocks_read);
+    AddStat(stats_->bytes_read, size);
+    if (access_) access_->Record(offset, size);
+
     if (!compressed) return read_buffer_;
 
     size_t decomp_size = ZSTD_getDecompressedSize(read_buffer_.data(), size);
     decompress_buffer_.resize(decomp_size);
-    decompressor_.Go(decompress_buffer_, read_buffer_);
+    {
+      CA_TRACE_SPAN("table", "decompress");
+      ScopedStatTimer timer(stats_->decompress_ns);
+      decompressor_.Go(decompress_buffer_, read_buffer_);
+    }
+
+    AddStat(stats_->bytes_decompressed, decompress_buffer_.size());
 
     return decompress_buffer_;
   }
@@ -1171,6 +1260,9 @@ class WriteOnceReader_v4 : public WriteOnceReader {
   const TableCompression compression_;
   const bool seekable_;
 
+  TableStats* const stats_;
+  AccessRecorder* const access_;
+
   WriteOnceIndex index_;
   WriteOnceIndex::Cache index_cache_;
 
@@ -1201,7 +1293,8 @@ class WriteOnceReader_v3 : public WriteOnceReader {
  public:
   WriteOnceReader_v3(const std::string& path, kj::AutoCloseFd&& fd,
                      uint64_t index_offset)
-      : WriteOnceReader(path, std::move(fd), index_offset) {
+      : WriteOnceReader(path, std::move(fd), index_offset),
+        stats_(GetTableStats(path)) {
     MemoryMap();
   }
 
@@ -1216,6 +1309,8 @@ class WriteOnceReader_v3 : public WriteOnceReader {
   void SeekToFirst() override { Seek(0, SEEK_SET); }
 
   bool SeekToKey(const string_view& key) override {
+    AddStat(stats_->seeks);
+
     if (!has_madvised_index_) MAdviseIndex();
 
     uint64_t hash, tmp_offset;
@@ -1388,6 +1483,8 @@ class WriteOnceReader_v3 : public WriteOnceReader {
     has_madvised_index_ = true;
   }
 
+  TableStats* const stats_;
+
   // Entire mmap()-ed file.
   void* buffer_ = MAP_FAILED;
   size_t buffer_size_ = 0, buffer_fill_ = 0;
@@ -1499,6 +1596,15 @@ class WriteOnceTable : public SeekableTable {
     return reader_ ? reader_->ReadRow(key, value) : false;
   }
 
+  std::vector<std::string> SplitKeys(size_t count) override {
+    if (!reader_) return {};
+    return reader_->SplitKeys(count);
+  }
+
+  bool GetKeyRange(std::string* first_key, std::string* last_key) override {
+    return reader_ ? reader_->GetKeyRange(first_key, last_key) : false;
+  }
+
  private:
   // Table reader.
   std::unique_ptr<WriteOnceReader> reader_;
@@ -24,29 +24,36 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>
+#include <vector>
 
 #include <kj/debug.h>
 
 #include "src/ca-table.h"
+#include "src/sketch.h"
 
 #define MAX_HEADER_SIZE 64
 
 namespace cantera {
 namespace table {
 
-void ca_table_write_offset_score(Table* table,
-                                 const string_view& key,
-                                 const struct ca_offset_score* values,
-                                 size_t count) {
-  auto buffer_alloc = ca_offset_score_size(values, count);
-  std::vector<uint8_t> buffer(buffer_alloc);
+namespace {
 
-  auto size =
-      ca_format_offset_score(buffer.data(), buffer_alloc, values, count);
+// Number of values per block in time series with a skip index.  Each block
+// adds a few bytes to the index, and is the unit of decoding for time range
+// lookups.
+const size_t kTimeSeriesBlockSize = 512;
 
-  KJ_ASSERT(size <= buffer_alloc, size, buffer_alloc);
-  buffer.resize(size);
+// Number of values per score bucket in impact indexes.  Top-k lookups decode
+// at least one bucket.
+const size_t kImpactBucketSize = 1024;
+
+// Number of values per block in posting lists with doc values.  Looking up
+// the score of an offset decodes one block.
+const size_t kDocValuesBlockSize = 128;
 
+void InsertOffsetScore(Table* table, const string_view& key,
+                       const std::vector<uint8_t>& buffer,
+                       const struct ca_offset_score* values, size_t count) {
   string_view buffer_view{reinterpret_cast<const char*>(buffer.data()), buffer.size()};
 
   table->InsertRow(key, buffer_view);
@@ -69,5 +76,77 @@ void ca_table_write_offset_score(Table* table,
 #endif
 }
 
+}  // namespace
+
+void ca_table_write_offset_score(Table* table,
+                                 const string_view& key,
+                                 const struct ca_offset_score* values,
+                                 size_t count) {
+  auto buffer_alloc = ca_offset_score_size(values, count);
+  std::vector<uint8_t> buffer(buffer_alloc);
+
+  auto size =
+      ca_format_offset_score(buffer.data(), buffer_alloc, values, count);
+
+  KJ_ASSERT(size <= buffer_alloc, size, buffer_alloc);
+  buffer.resize(size);
+
+  InsertOffsetScore(table, key, buffer, values, count);
+}
+
+void ca_table_write_time_series(Table* table, const string_view& key,
+                                const struct ca_offset_score* values,
+                                size_t count) {
+  auto buffer_alloc =
+      ca_offset_score_indexed_size(values, count, kTimeSeriesBlockSize);
+  std::vector<uint8_t> buffer(buffer_alloc);
+
+  auto size = ca_format_offset_score_indexed(buffer.data(), buffer_alloc,
+                                             values, count,
+                                             kTimeSeriesBlockSize);
+
+  KJ_ASSERT(size <= buffer_alloc, size, buffer_alloc);
+  buffer.resize(size);
+
+  InsertOffsetScore(table, key, buffer, values, count);
+}
+
+void ca_table_write_index(Table* table, const string_view& key,
+                          const struct ca_offset_score* values, size_t count,
+                          unsigned int options) {
+  internal::ThetaSketch sketch;
+  if (options & CA_INDEX_SKETCH)
+    sketch = internal::ThetaSketch::FromOffsets(values, count);
+
+  auto buffer_alloc =
+      sketch.FormattedSize() +
+      ca_offset_score_impact_size(values, count, kImpactBucketSize) +
+      ca_offset_score_indexed_size(values, count, kDocValuesBlockSize);
+  std::vector<uint8_t> buffer(buffer_alloc);
+
+  size_t size = 0;
+
+  if (options & CA_INDEX_SKETCH)
+    size += sketch.Format(buffer.data(), buffer_alloc);
+
+  if (options & CA_INDEX_IMPACT) {
+    size += ca_format_offset_score_impact(&buffer[size], buffer_alloc - size,
+                                          values, count, kImpactBucketSize);
+  }
+
+  if (options & CA_INDEX_DOC_VALUES) {
+    size += ca_format_offset_score_indexed(&buffer[size], buffer_alloc - size,
+                                           values, count, kDocValuesBlockSize);
+  } else {
+    size += ca_format_offset_score(&buffer[size], buffer_alloc - size, values,
+                                   count);
+  }
+
+  KJ_ASSERT(size <= buffer_alloc, size, buffer_alloc);
+  buffer.resize(size);
+
+  InsertOffsetScore(table, key, buffer, values, count);
+}
+
 }  // namespace table
 }  // namespace cantera
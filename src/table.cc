@@ -52,6 +52,12 @@ Table::Table() {}
 
 Table::~Table() {}
 
+std::vector<std::string> Table::SplitKeys(size_t count) { return {}; }
+
+bool Table::GetKeyRange(std::string* first_key, std::string* last_key) {
+  return false;
+}
+
 Backend::~Backend() {}
 
 ca_offset_score::ca_offset_score(uint64_t offset, const ca_score& score)
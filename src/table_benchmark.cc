@@ -0,0 +1,385 @@
+// Measures read performance of the table backends.
+//
+// Usage: table_benchmark [OPTION]...
+//
+// Builds a synthetic table for each combination of backend, compression and
+// seekability, and times key lookups that hit and miss, offset seeks (for
+// seekable tables only), sequential scans and skips.  Each operation is run
+// twice: once right after the table's pages have been evicted from the page
+// cache, and once more on the same open table.  The results are printed as a
+// JSON array, with one object per table configuration, operation and cache
+// state.  `bytes-read-per-op' counts bytes read from the table file, and
+// `bytes-per-op' counts key and value bytes returned.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <kj/debug.h>
+#include <kj/io.h>
+
+#include "src/ca-table.h"
+#include "src/stats.h"
+
+namespace ca_table = cantera::table;
+
+namespace {
+
+enum Option {
+  kBackendOption = 1,
+  kKeySizeOption,
+  kOperationsOption,
+  kRowsOption,
+  kValueDistributionOption,
+  kValueSizeOption,
+};
+
+int print_help;
+
+struct option kLongOptions[] = {
+    {"backend", required_argument, nullptr, kBackendOption},
+    {"key-size", required_argument, nullptr, kKeySizeOption},
+    {"operations", required_argument, nullptr, kOperationsOption},
+    {"rows", required_argument, nullptr, kRowsOption},
+    {"value-distribution", required_argument, nullptr,
+     kValueDistributionOption},
+    {"value-size", required_argument, nullptr, kValueSizeOption},
+    {"help", no_argument, &print_help, 1},
+    {nullptr, 0, nullptr, 0}};
+
+// Number of rows passed over by each call to Skip().
+const size_t kSkipStride = 64;
+
+size_t row_count = 100000;
+size_t key_size = 24;
+size_t value_size = 256;
+bool lognormal_values = false;
+size_t operation_count = 100000;
+
+struct TableConfig {
+  const char* backend;
+  bool compressed;
+  bool seekable;
+};
+
+struct Result {
+  uint64_t ops = 0;
+  uint64_t bytes = 0;
+  double seconds = 0;
+  uint64_t bytes_read = 0;
+};
+
+double Now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Keys are numbered, and only even numbers are present in the table, so that
+// odd numbers produce misses that fall between existing keys.
+std::string MakeKey(size_t n) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "key:%012zu", n);
+  std::string result(buffer);
+  if (result.size() < key_size) result.resize(key_size, '.');
+  return result;
+}
+
+// Returns values of roughly the requested size, made of words from a small
+// vocabulary so that they compress about as well as summary JSON.
+std::vector<std::string> MakeValues() {
+  static const char* const kWords[] = {
+      "\"name\":", "\"title\":", "\"score\":", "\"date\":", "example",
+      "search",    "table",      "index",      "2017-",     "0.5",
+      "{",         "}",          ",",          " ",         "query"};
+
+  std::mt19937_64 rng(1234);
+  std::lognormal_distribution<double> size_dist(0.0, 1.0);
+  std::uniform_int_distribution<size_t> word_dist(
+      0, sizeof(kWords) / sizeof(kWords[0]) - 1);
+
+  std::vector<std::string> result;
+  result.reserve(row_count);
+
+  for (size_t i = 0; i < row_count; ++i) {
+    size_t size = value_size;
+    if (lognormal_values) {
+      // The mean of lognormal(0, 1) is exp(0.5).
+      size = static_cast<size_t>(value_size * size_dist(rng) / 1.6487);
+    }
+
+    std::string value;
+    while (value.size() < size) value += kWords[word_dist(rng)];
+    value.resize(size);
+    result.emplace_back(std::move(value));
+  }
+
+  return result;
+}
+
+void BuildTable(const TableConfig& config, const std::string& path,
+                const std::vector<std::string>& values) {
+  auto options =
+      ca_table::TableOptions::Create().SetNoFSync().SetOutputSeekable(
+          config.seekable);
+  if (!config.compressed)
+    options.SetCompression(ca_table::kTableCompressionNone);
+
+  auto table =
+      ca_table::TableFactory::Create(config.backend, path.c_str(), options);
+  for (size_t i = 0; i < row_count; ++i)
+    table->InsertRow(MakeKey(i * 2), values[i]);
+  table->Sync();
+}
+
+// Writes back and evicts the file's pages from the page cache.
+void DropPageCache(const std::string& path) {
+  kj::AutoCloseFd fd(open(path.c_str(), O_RDONLY));
+  if (fd.get() == -1) err(EXIT_FAILURE, "%s", path.c_str());
+  if (-1 == fdatasync(fd.get())) err(EXIT_FAILURE, "fdatasync");
+  if (0 != posix_fadvise(fd.get(), 0, 0, POSIX_FADV_DONTNEED))
+    errx(EXIT_FAILURE, "posix_fadvise failed");
+}
+
+void SeekHit(ca_table::Table* table, Result& result) {
+  std::mt19937_64 rng(1);
+  std::uniform_int_distribution<size_t> row_dist(0, row_count - 1);
+
+  cantera::string_view key, value;
+  for (size_t i = 0; i < operation_count; ++i) {
+    KJ_REQUIRE(table->SeekToKey(MakeKey(row_dist(rng) * 2)));
+    KJ_REQUIRE(table->ReadRow(key, value));
+    result.bytes += key.size() + value.size();
+  }
+  result.ops = operation_count;
+}
+
+void SeekMiss(ca_table::Table* table, Result& result) {
+  std::mt19937_64 rng(2);
+  std::uniform_int_distribution<size_t> row_dist(0, row_count - 1);
+
+  for (size_t i = 0; i < operation_count; ++i)
+    KJ_REQUIRE(!table->SeekToKey(MakeKey(row_dist(rng) * 2 + 1)));
+  result.ops = operation_count;
+}
+
+void SeekOffset(ca_table::SeekableTable* table,
+                const std::vector<off_t>& offsets, Result& result) {
+  std::mt19937_64 rng(3);
+  std::uniform_int_distribution<size_t> row_dist(0, offsets.size() - 1);
+
+  cantera::string_view key, value;
+  for (size_t i = 0; i < operation_count; ++i) {
+    table->Seek(offsets[row_dist(rng)], SEEK_SET);
+    KJ_REQUIRE(table->ReadRow(key, value));
+    result.bytes += key.size() + value.size();
+  }
+  result.ops = operation_count;
+}
+
+void Scan(ca_table::Table* table, Result& result) {
+  table->SeekToFirst();
+
+  cantera::string_view key, value;
+  while (table->ReadRow(key, value)) {
+    result.bytes += key.size() + value.size();
+    ++result.ops;
+  }
+  KJ_REQUIRE(result.ops == row_count, result.ops);
+}
+
+void Skip(ca_table::Table* table, Result& result) {
+  table->SeekToFirst();
+  while (table->Skip(kSkipStride)) ++result.ops;
+}
+
+void PrintResult(const TableConfig& config, const char* operation,
+                 const char* cache, const Result& result) {
+  static bool first = true;
+
+  const auto ops = std::max(result.ops, uint64_t(1));
+  printf(
+      "%s\n  {\"backend\":\"%s\",\"compressed\":%s,\"seekable\":%s,"
+      "\"operation\":\"%s\",\"cache\":\"%s\",\"ops\":%llu,"
+      "\"ns-per-op\":%.1f,\"bytes-per-op\":%.1f,\"bytes-read-per-op\":%.1f}",
+      first ? "" : ",", config.backend, config.compressed ? "true" : "false",
+      config.seekable ? "true" : "false", operation, cache,
+      static_cast<unsigned long long>(result.ops),
+      1.0e9 * result.seconds / ops, static_cast<double>(result.bytes) / ops,
+      static_cast<double>(result.bytes_read) / ops);
+  fflush(stdout);
+
+  first = false;
+}
+
+template <typename Function>
+void Measure(const TableConfig& config, const std::string& path,
+             const char* operation, Function&& function) {
+  const auto stats = ca_table::internal::GetTableStats(path);
+
+  DropPageCache(path);
+
+  std::unique_ptr<ca_table::Table> table;
+
+  for (const char* cache : {"cold", "warm"}) {
+    Result result;
+    const uint64_t bytes_read = stats->bytes_read;
+    const auto start = Now();
+
+    // The table is opened as part of the cold run, so that reading its index
+    // is included.
+    if (!table) {
+      if (config.seekable)
+        table = ca_table::TableFactory::OpenSeekable(config.backend,
+                                                     path.c_str());
+      else
+        table = ca_table::TableFactory::Open(config.backend, path.c_str());
+    }
+
+    function(table.get(), result);
+
+    result.seconds = Now() - start;
+    result.bytes_read = stats->bytes_read - bytes_read;
+    PrintResult(config, operation, cache, result);
+  }
+}
+
+void RunBenchmark(const TableConfig& config, const std::string& path,
+                  const std::vector<std::string>& values) {
+  BuildTable(config, path, values);
+
+  Measure(config, path, "seek-hit", SeekHit);
+  Measure(config, path, "seek-miss", SeekMiss);
+  Measure(config, path, "scan", Scan);
+  Measure(config, path, "skip", Skip);
+
+  if (config.seekable) {
+    std::vector<off_t> offsets;
+    {
+      auto table =
+          ca_table::TableFactory::OpenSeekable(config.backend, path.c_str());
+      struct iovec key, value;
+      for (;;) {
+        const auto offset = table->Offset();
+        if (!table->ReadRow(&key, &value)) break;
+        offsets.emplace_back(offset);
+      }
+    }
+
+    Measure(config, path, "seek-offset",
+            [&offsets](ca_table::Table* table, Result& result) {
+              SeekOffset(static_cast<ca_table::SeekableTable*>(table), offsets,
+                         result);
+            });
+  }
+
+  unlink(path.c_str());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) try {
+  std::vector<const char*> backends;
+
+  int i;
+  while ((i = getopt_long(argc, argv, "", kLongOptions, 0)) != -1) {
+    if (i == 0) continue;
+
+    if (i == '?')
+      errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
+
+    switch (static_cast<Option>(i)) {
+      case kBackendOption:
+        backends.emplace_back(optarg);
+        break;
+
+      case kKeySizeOption:
+        key_size = strtoul(optarg, nullptr, 0);
+        break;
+
+      case kOperationsOption:
+        operation_count = strtoul(optarg, nullptr, 0);
+        break;
+
+      case kRowsOption:
+        row_count = strtoul(optarg, nullptr, 0);
+        if (!row_count) errx(EX_USAGE, "Row count must be positive");
+        break;
+
+      case kValueDistributionOption:
+        if (!strcmp(optarg, "fixed"))
+          lognormal_values = false;
+        else if (!strcmp(optarg, "lognormal"))
+          lognormal_values = true;
+        else
+          errx(EX_USAGE, "Unknown value distribution: %s", optarg);
+        break;
+
+      case kValueSizeOption:
+        value_size = strtoul(optarg, nullptr, 0);
+        break;
+    }
+  }
+
+  if (print_help) {
+    printf(
+        "Usage: %s [OPTION]...\n"
+        "\n"
+        "      --backend=NAME         benchmark this backend; may be given\n"
+        "                             more than once [write-once and\n"
+        "                             leveldb-table]\n"
+        "      --key-size=N           pad keys to N bytes [24]\n"
+        "      --operations=N         number of random lookups per run "
+        "[100000]\n"
+        "      --rows=N               number of table rows [100000]\n"
+        "      --value-distribution=fixed|lognormal\n"
+        "                             distribution of value sizes [fixed]\n"
+        "      --value-size=N         mean value size in bytes [256]\n"
+        "      --help     display this help and exit\n",
+        argv[0]);
+    return EXIT_SUCCESS;
+  }
+
+  if (optind != argc)
+    errx(EX_USAGE, "Usage: %s [OPTION]...", argv[0]);
+
+  if (backends.empty()) backends = {"write-once", "leveldb-table"};
+
+  const char* tmpdir = getenv("TMPDIR");
+  if (!tmpdir) tmpdir = "/tmp";
+  const auto path =
+      std::string(tmpdir) + "/table_benchmark." + std::to_string(getpid());
+
+  const auto values = MakeValues();
+
+  printf("[");
+
+  for (const auto backend : backends) {
+    for (const bool compressed : {false, true}) {
+      for (const bool seekable : {false, true}) {
+        // LevelDB tables do not support offset seeks.
+        if (seekable && !strcmp(backend, "leveldb-table")) continue;
+
+        RunBenchmark(TableConfig{backend, compressed, seekable}, path, values);
+      }
+    }
+  }
+
+  printf("\n]\n");
+} catch (kj::Exception e) {
+  fprintf(stderr, "%s\n", e.getDescription().cStr());
+  return EXIT_FAILURE;
+}
@@ -1,14 +1,23 @@
 #ifndef BASE_THREAD_POOL_H_
 #define BASE_THREAD_POOL_H_ 1
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <cstdlib>
 #include <deque>
+#include <exception>
+#include <functional>
 #include <future>
+#include <iterator>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include <kj/common.h>
+
 #include "src/delegate.h"
 
 namespace cantera {
@@ -27,14 +36,23 @@ namespace internal {
 //
 // This is basically a replacement for std::async(std::launch::async, ...),
 // which creates a thread on every invocation, which doesn't scale well.
+//
+// Every worker thread has its own task queue.  Tasks launched from a worker
+// thread go to that worker's queue, and tasks launched from other threads are
+// distributed round-robin.  Workers take tasks from the back of their own
+// queue, and steal from the front of other queues when theirs is empty, so
+// there is no single lock shared by all tasks.  Threads blocked in Wait() run
+// queued tasks while they wait.
 class ThreadPool {
  public:
   // Constructs a thread pool with the given number of threads.
-  ThreadPool(size_t n, size_t max_backlog = 256)
-      : max_backlog_(max_backlog) {
-    while (n-- > 0)
-      threads_.emplace_back(
-          std::thread(std::bind(&ThreadPool::ThreadMain, this, n)));
+  ThreadPool(size_t n, size_t max_backlog = 256) : max_backlog_(max_backlog) {
+    queues_.reserve(std::max(n, size_t(1)));
+    for (size_t i = 0; i < std::max(n, size_t(1)); ++i)
+      queues_.emplace_back(std::make_unique<TaskQueue>());
+
+    for (size_t i = 0; i < n; ++i)
+      threads_.emplace_back(std::bind(&ThreadPool::ThreadMain, this, i));
   }
 
   // Constructs a thread pool with the same number of threads as supported by
@@ -47,9 +65,9 @@ class ThreadPool {
   // destroys the thread pool.  Call Wait() before destruction if you want to
   // ensure all tasks have completed.
   ~ThreadPool() {
-    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_lock<std::mutex> lock(idle_mutex_);
     done_ = true;
-    queue_not_empty_cv_.notify_all();
+    work_available_cv_.notify_all();
     lock.unlock();
 
     while (!threads_.empty()) {
@@ -64,22 +82,7 @@ class ThreadPool {
                 std::is_void<typename std::result_of<Function()>::type>::value,
                 void>::type* = nullptr>
   void Launch(Function&& f) {
-    std::unique_lock<std::mutex> lock(mutex_);
-
-    // If we've reached the backlog limit, we just execute in the context of
-    // the calling thread.
-    if (queued_calls_.size() >= max_backlog_) {
-      lock.unlock();
-      f();
-      return;
-    }
-
-    queued_calls_.emplace_back(std::move(f));
-
-    ++scheduled_tasks_;
-    lock.unlock();
-
-    queue_not_empty_cv_.notify_one();
+    Schedule(Delegate<void()>(std::forward<Function>(f)));
   }
 
   // Schedules a task for asynchronous execution.
@@ -91,17 +94,7 @@ class ThreadPool {
     std::promise<typename std::result_of<Function()>::type> promise;
     auto result = promise.get_future();
 
-    std::unique_lock<std::mutex> lock(mutex_);
-
-    // If we've reached the backlog limit, we just execute in the context of
-    // the calling thread.
-    if (queued_calls_.size() >= max_backlog_) {
-      lock.unlock();
-      promise.set_value(f());
-      return result;
-    }
-
-    queued_calls_.emplace_back(
+    Schedule(Delegate<void()>(
         [ f = std::move(f), promise = std::move(promise) ]() mutable {
           try {
             promise.set_value(f());
@@ -112,69 +105,376 @@ class ThreadPool {
               std::terminate();
             }
           }
-        });
+        }));
 
-    ++scheduled_tasks_;
-    lock.unlock();
+    return result;
+  }
 
-    queue_not_empty_cv_.notify_one();
+  // Schedules every void task in the range [begin, end).  The tasks are
+  // split into one contiguous run per queue, so each queue is locked once and
+  // sleeping workers are woken up once.  If this exceeds the backlog limit,
+  // the calling thread runs queued tasks until the backlog is below the limit.
+  template <class Iterator>
+  void LaunchBatch(Iterator begin, Iterator end) {
+    const auto count = static_cast<size_t>(std::distance(begin, end));
+    if (!count) return;
+
+    if (threads_.empty()) {
+      for (; begin != end; ++begin) (*begin)();
+      return;
+    }
 
-    return result;
+    unfinished_tasks_ += count;
+    pending_tasks_ += count;
+
+    const auto per_queue = (count + queues_.size() - 1) / queues_.size();
+    auto queue_idx = next_queue_++;
+
+    for (size_t remaining = count; remaining > 0; ++queue_idx) {
+      auto& queue = *queues_[queue_idx % queues_.size()];
+      const auto n = std::min(per_queue, remaining);
+
+      std::unique_lock<std::mutex> lock(queue.mutex);
+      for (size_t i = 0; i < n; ++i, ++begin)
+        queue.tasks.emplace_back(std::move(*begin));
+      lock.unlock();
+
+      remaining -= n;
+    }
+
+    WakeWorkers(count);
+    HelpWhileBacklogged();
   }
 
   // Returns the number of threads in this thread pool.
   size_t Size() const { return threads_.size(); }
 
-  // Waits for completion of all scheduled tasks.
+  // Calls `f(chunk_begin, chunk_end)' for consecutive chunks of at most
+  // `grain_size' indexes covering [begin, end), and waits for all calls to
+  // complete.  The calling thread processes chunks too, so this is safe to
+  // use from within a task running on this pool.  If `grain_size' is zero, a
+  // grain size giving a few chunks per thread is chosen.
+  //
+  // If a call throws, chunks that have not yet started are skipped, and the
+  // exception from the lowest-numbered failing chunk is rethrown once every
+  // running chunk has completed.  If `cancel' is non-null, chunks that have
+  // not yet started are likewise skipped once `*cancel' becomes true; the
+  // caller is expected to check the flag afterwards.
+  //
+  // Example use:
+  //
+  //   pool.ParallelFor(0, values.size(), 1024, [&](size_t begin, size_t end) {
+  //     for (auto i = begin; i != end; ++i) values[i] = Transform(values[i]);
+  //   });
+  template <class Function>
+  void ParallelFor(size_t begin, size_t end, size_t grain_size, Function&& f,
+                   const std::atomic<bool>* cancel = nullptr) {
+    if (begin >= end) return;
+
+    if (!grain_size) grain_size = DefaultGrainSize(end - begin);
+
+    const auto chunk_count = (end - begin + grain_size - 1) / grain_size;
+
+    auto loop = std::make_shared<ParallelLoop>(
+        chunk_count, cancel, [&f, begin, end, grain_size](size_t chunk) {
+          const auto chunk_begin = begin + chunk * grain_size;
+          f(chunk_begin, std::min(chunk_begin + grain_size, end));
+        });
+
+    // Each helper task processes chunks until none are left.  The loop
+    // state is shared, since helper tasks may not start until after the
+    // last chunk is done and this function has returned.
+    const auto helpers = std::min(chunk_count, threads_.size() + 1) - 1;
+    for (size_t i = 0; i < helpers; ++i) Launch([loop] { loop->Run(); });
+
+    loop->Run();
+    loop->Wait();
+  }
+
+  // Computes `map(chunk_begin, chunk_end)' for chunks of [begin, end) as in
+  // ParallelFor(), and combines the results in chunk order, i.e.
+  // `reduce(...reduce(reduce(identity, r0), r1)..., rN)'.  Since the order is
+  // fixed, `reduce' needs to be associative, but not commutative, and the
+  // result does not depend on scheduling.  Exceptions and cancellation are
+  // handled as in ParallelFor(); if cancelled, the return value is
+  // unspecified.
+  template <class T, class Map, class Reduce>
+  T ParallelReduce(size_t begin, size_t end, size_t grain_size, T identity,
+                   Map&& map, Reduce&& reduce,
+                   const std::atomic<bool>* cancel = nullptr) {
+    if (begin >= end) return identity;
+
+    if (!grain_size) grain_size = DefaultGrainSize(end - begin);
+
+    std::vector<T> partial((end - begin + grain_size - 1) / grain_size,
+                           identity);
+
+    ParallelFor(begin, end, grain_size,
+                [&map, &partial, begin, grain_size](size_t chunk_begin,
+                                                    size_t chunk_end) {
+                  partial[(chunk_begin - begin) / grain_size] =
+                      map(chunk_begin, chunk_end);
+                },
+                cancel);
+
+    for (auto& value : partial) identity = reduce(std::move(identity), value);
+
+    return identity;
+  }
+
+  // Waits for completion of all scheduled tasks.  The calling thread runs
+  // queued tasks until none are left, then sleeps until the tasks running on
+  // other threads have completed.
   void Wait() {
-    std::unique_lock<std::mutex> lock(mutex_);
-    completion_cv_.wait(
-        lock, [this] { return completed_tasks_ == scheduled_tasks_; });
+    const auto self = CurrentQueue();
+
+    while (unfinished_tasks_ > 0) {
+      if (RunPendingTask(self)) continue;
+
+      std::unique_lock<std::mutex> lock(completion_mutex_);
+      completion_cv_.wait(lock, [this] {
+        return unfinished_tasks_ == 0 || pending_tasks_ > 0;
+      });
+    }
   }
 
  private:
-  // Worker thread entry point.  Runs tasks added to the queue until `done_' is
-  // set to true by the destructor.
-  void ThreadMain(size_t index) {
-    std::unique_lock<std::mutex> lock(mutex_);
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<Delegate<void()>> tasks;
+  };
+
+  enum : size_t { kNoQueue = static_cast<size_t>(-1) };
+
+  // State shared by the threads participating in a ParallelFor() call.
+  class ParallelLoop {
+   public:
+    ParallelLoop(size_t chunk_count, const std::atomic<bool>* cancel,
+                 Delegate<void(size_t)>&& run_chunk)
+        : chunk_count_(chunk_count),
+          cancel_(cancel),
+          run_chunk_(std::move(run_chunk)) {}
+
+    // Processes chunks until none are left to claim.
+    void Run() {
+      for (;;) {
+        const auto chunk = next_chunk_++;
+        if (chunk >= chunk_count_) return;
+
+        if (!failed_ && !(cancel_ && *cancel_)) {
+          try {
+            run_chunk_(chunk);
+          } catch (...) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!error_ || chunk < error_chunk_) {
+              error_ = std::current_exception();
+              error_chunk_ = chunk;
+            }
+            failed_ = true;
+          }
+        }
 
-    for (;;) {
-      queue_not_empty_cv_.wait(
-          lock, [this] { return done_ || !queued_calls_.empty(); });
-      if (done_) break;
+        if (++finished_chunks_ == chunk_count_) {
+          std::unique_lock<std::mutex> lock(mutex_);
+          finished_cv_.notify_all();
+        }
+      }
+    }
 
-      Delegate<void()> call(std::move(queued_calls_.front()));
-      queued_calls_.pop_front();
+    // Waits for all chunks to finish, and rethrows the first exception
+    // thrown by a chunk, if any.
+    void Wait() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      finished_cv_.wait(lock,
+                        [this] { return finished_chunks_ == chunk_count_; });
 
-      lock.unlock();
+      if (error_) std::rethrow_exception(error_);
+    }
+
+   private:
+    const size_t chunk_count_;
+    const std::atomic<bool>* cancel_;
+
+    // Only called for chunks claimed before Wait() returns, so references
+    // captured from the ParallelFor() caller stay valid.
+    Delegate<void(size_t)> run_chunk_;
+
+    std::atomic<size_t> next_chunk_{0};
+    std::atomic<size_t> finished_chunks_{0};
+    std::atomic<bool> failed_{false};
+
+    std::mutex mutex_;
+    std::condition_variable finished_cv_;
+    std::exception_ptr error_;
+    size_t error_chunk_ = 0;
+  };
+
+  // Returns a grain size that splits `count' indexes into about four chunks
+  // per thread.
+  size_t DefaultGrainSize(size_t count) const {
+    const auto chunks = 4 * queues_.size();
+    return (count + chunks - 1) / chunks;
+  }
+
+  // Returns the thread pool and queue index of the calling thread, if it's a
+  // worker thread.
+  static std::pair<const ThreadPool*, size_t>& CurrentWorker() {
+    static thread_local std::pair<const ThreadPool*, size_t> worker{
+        nullptr, size_t(kNoQueue)};
+    return worker;
+  }
+
+  // Returns the queue owned by the calling thread, or kNoQueue if the calling
+  // thread is not one of our workers.
+  size_t CurrentQueue() const {
+    const auto& worker = CurrentWorker();
+    return (worker.first == this) ? worker.second : kNoQueue;
+  }
+
+  void Schedule(Delegate<void()>&& task) {
+    // Without worker threads, tasks can only run in the calling thread.  If
+    // we've reached the backlog limit, we also just execute in the context of
+    // the calling thread, since queuing the task would only add overhead.
+    if (threads_.empty() || pending_tasks_ >= max_backlog_) {
+      task();
+      return;
+    }
+
+    ++unfinished_tasks_;
+    ++pending_tasks_;
+
+    auto queue_idx = CurrentQueue();
+    if (queue_idx == kNoQueue) queue_idx = next_queue_++ % queues_.size();
+
+    auto& queue = *queues_[queue_idx];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    queue.tasks.emplace_back(std::move(task));
+    lock.unlock();
+
+    WakeWorkers(1);
+  }
+
+  // Wakes up to `count' sleeping workers.  This is cheap when no worker is
+  // sleeping, which is the common case when the pool is busy.
+  void WakeWorkers(size_t count) {
+    if (idle_workers_ == 0) return;
+
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    if (count == 1)
+      work_available_cv_.notify_one();
+    else
+      work_available_cv_.notify_all();
+  }
+
+  // If we've reached the backlog limit, the calling thread runs queued tasks
+  // until the backlog is below the limit again.
+  void HelpWhileBacklogged() {
+    const auto self = CurrentQueue();
+    while (pending_tasks_ > max_backlog_ && RunPendingTask(self)) {
+    }
+  }
+
+  // Removes one task from the queues, preferring the back of the queue owned
+  // by the calling thread.  Returns false if all queues are empty.
+  bool PopTask(size_t self, Delegate<void()>& task) {
+    if (self != kNoQueue) {
+      auto& queue = *queues_[self];
+      std::unique_lock<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+      }
+    }
+
+    const auto start = (self != kNoQueue) ? self + 1 : size_t(next_steal_++);
+
+    for (size_t i = 0; i < queues_.size(); ++i) {
+      const auto victim = (start + i) % queues_.size();
+      if (victim == self) continue;
+
+      auto& queue = *queues_[victim];
+      std::unique_lock<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+      }
+    }
+
+    return false;
+  }
 
-      call();
+  // Runs one queued task.  Returns false if there was nothing to run.
+  bool RunPendingTask(size_t self) {
+    Delegate<void()> task;
+    if (!PopTask(self, task)) return false;
 
-      lock.lock();
+    --pending_tasks_;
 
-      if (++completed_tasks_ == scheduled_tasks_) completion_cv_.notify_all();
+    try {
+      task();
+    } catch (...) {
+      FinishTask();
+      throw;
     }
+
+    FinishTask();
+
+    return true;
   }
 
-  // The number of tasks added with Launch().
-  size_t scheduled_tasks_ = 0;
+  void FinishTask() {
+    if (--unfinished_tasks_ == 0) {
+      std::unique_lock<std::mutex> lock(completion_mutex_);
+      completion_cv_.notify_all();
+    }
+  }
 
-  // The number of completed tasks.
-  size_t completed_tasks_ = 0;
+  // Worker thread entry point.  Runs tasks until `done_' is set to true by
+  // the destructor.
+  void ThreadMain(size_t index) {
+    CurrentWorker() = std::make_pair(this, index);
 
-  // The maximum number of queued tasks, before we start running tasks in the
-  // calling thread.
+    while (!done_) {
+      if (RunPendingTask(index)) continue;
+
+      std::unique_lock<std::mutex> lock(idle_mutex_);
+      ++idle_workers_;
+      work_available_cv_.wait(lock,
+                              [this] { return done_ || pending_tasks_ > 0; });
+      --idle_workers_;
+    }
+  }
+
+  // The number of tasks that have been scheduled, but not yet completed.
+  std::atomic<size_t> unfinished_tasks_{0};
+
+  // The number of tasks waiting in the queues.
+  std::atomic<size_t> pending_tasks_{0};
+
+  // The number of workers waiting for `work_available_cv_'.
+  std::atomic<size_t> idle_workers_{0};
+
+  // Round-robin counters for distributing and stealing tasks.
+  std::atomic<size_t> next_queue_{0};
+  std::atomic<size_t> next_steal_{0};
+
+  // The maximum number of queued tasks, before the calling thread starts
+  // running tasks itself.
   size_t max_backlog_;
 
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+
   std::vector<std::thread> threads_;
 
-  std::condition_variable queue_not_empty_cv_;
-  std::condition_variable completion_cv_;
-  std::mutex mutex_;
+  std::condition_variable work_available_cv_;
+  std::mutex idle_mutex_;
 
-  bool done_ = false;
+  std::condition_variable completion_cv_;
+  std::mutex completion_mutex_;
 
-  std::deque<Delegate<void()>> queued_calls_;
+  std::atomic<bool> done_{false};
 };
 
 }  // namespace internal
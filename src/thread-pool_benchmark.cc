@@ -0,0 +1,182 @@
+// Compares the work-stealing ThreadPool against a thread pool with a single
+// shared queue, which is what ThreadPool used to be.
+//
+// Usage: thread-pool_benchmark [THREADS]
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/time.h>
+
+#include "src/delegate.h"
+#include "src/thread-pool.h"
+
+using namespace cantera::table::internal;
+
+namespace {
+
+const size_t kTaskCount = 1000000;
+
+double Now() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+}
+
+// Thread pool with one queue shared by all workers, protected by one mutex.
+class MutexThreadPool {
+ public:
+  MutexThreadPool(size_t n, size_t max_backlog = 256)
+      : max_backlog_(max_backlog) {
+    while (n-- > 0) threads_.emplace_back([this] { ThreadMain(); });
+  }
+
+  ~MutexThreadPool() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_ = true;
+    queue_not_empty_cv_.notify_all();
+    lock.unlock();
+
+    for (auto& thread : threads_) thread.join();
+  }
+
+  template <class Function>
+  void Launch(Function&& f) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (queued_calls_.size() >= max_backlog_) {
+      lock.unlock();
+      f();
+      return;
+    }
+
+    queued_calls_.emplace_back(std::move(f));
+
+    ++scheduled_tasks_;
+    lock.unlock();
+
+    queue_not_empty_cv_.notify_one();
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    completion_cv_.wait(
+        lock, [this] { return completed_tasks_ == scheduled_tasks_; });
+  }
+
+ private:
+  void ThreadMain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;) {
+      queue_not_empty_cv_.wait(
+          lock, [this] { return done_ || !queued_calls_.empty(); });
+      if (done_) break;
+
+      Delegate<void()> call(std::move(queued_calls_.front()));
+      queued_calls_.pop_front();
+
+      lock.unlock();
+
+      call();
+
+      lock.lock();
+
+      if (++completed_tasks_ == scheduled_tasks_) completion_cv_.notify_all();
+    }
+  }
+
+  size_t scheduled_tasks_ = 0;
+  size_t completed_tasks_ = 0;
+  size_t max_backlog_;
+
+  std::vector<std::thread> threads_;
+
+  std::condition_variable queue_not_empty_cv_;
+  std::condition_variable completion_cv_;
+  std::mutex mutex_;
+
+  bool done_ = false;
+
+  std::deque<Delegate<void()>> queued_calls_;
+};
+
+// A small amount of work, comparable to processing one short posting list.
+void Work(std::atomic<uint64_t>& sink, size_t i) {
+  uint64_t h = i;
+  for (size_t j = 0; j < 64; ++j) h = h * 6364136223846793005ULL + 1;
+  sink.fetch_add(h & 1, std::memory_order_relaxed);
+}
+
+void Report(const char* name, size_t threads, double elapsed) {
+  printf("%-28s %4zu %10.2f %12.0f\n", name, threads,
+         1.0e9 * elapsed / kTaskCount, kTaskCount / elapsed);
+  fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t max_threads =
+      (argc > 1) ? strtoul(argv[1], nullptr, 0)
+                 : std::max(std::thread::hardware_concurrency(), 1U);
+
+  std::atomic<uint64_t> sink{0};
+
+  printf("%-28s %4s %10s %12s\n", "pool", "thr", "ns/task", "tasks/s");
+
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    {
+      MutexThreadPool pool(threads);
+      const auto start = Now();
+      for (size_t i = 0; i < kTaskCount; ++i)
+        pool.Launch([&sink, i] { Work(sink, i); });
+      pool.Wait();
+      Report("mutex", threads, Now() - start);
+    }
+
+    {
+      ThreadPool pool(threads);
+      const auto start = Now();
+      for (size_t i = 0; i < kTaskCount; ++i)
+        pool.Launch([&sink, i] { Work(sink, i); });
+      pool.Wait();
+      Report("work-stealing", threads, Now() - start);
+    }
+
+    {
+      ThreadPool pool(threads);
+      const auto start = Now();
+      // Each task fans out into subtasks, which stay on the worker's own
+      // queue unless another worker steals them.
+      for (size_t i = 0; i < kTaskCount; i += 1000) {
+        pool.Launch([&pool, &sink, i] {
+          for (size_t j = i; j < i + 1000; ++j)
+            pool.Launch([&sink, j] { Work(sink, j); });
+        });
+      }
+      pool.Wait();
+      Report("work-stealing (nested)", threads, Now() - start);
+    }
+
+    {
+      ThreadPool pool(threads, kTaskCount);
+      const auto start = Now();
+      std::vector<Delegate<void()>> tasks;
+      tasks.reserve(kTaskCount);
+      for (size_t i = 0; i < kTaskCount; ++i)
+        tasks.emplace_back([&sink, i] { Work(sink, i); });
+      pool.LaunchBatch(tasks.begin(), tasks.end());
+      pool.Wait();
+      Report("work-stealing (batch)", threads, Now() - start);
+    }
+  }
+
+  return (sink.load() == 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
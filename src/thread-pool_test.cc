@@ -0,0 +1,190 @@
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <kj/debug.h>
+
+#include "src/thread-pool.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace cantera::table::internal;
+
+struct ThreadPoolTest : testing::Test {};
+
+TEST_F(ThreadPoolTest, WaitRunsAllTasks) {
+  ThreadPool pool(4);
+  std::atomic<size_t> sum{0};
+
+  for (size_t i = 0; i < 10000; ++i) pool.Launch([&sum, i] { sum += i; });
+
+  pool.Wait();
+
+  EXPECT_EQ(10000U * 9999U / 2, sum.load());
+}
+
+TEST_F(ThreadPoolTest, FuturesReturnValuesAndExceptions) {
+  ThreadPool pool(2);
+
+  auto a = pool.Launch([] { return 1; });
+  auto b = pool.Launch([]() -> int { throw std::runtime_error("b"); });
+
+  EXPECT_EQ(1, a.get());
+  EXPECT_THROW(b.get(), std::runtime_error);
+}
+
+TEST_F(ThreadPoolTest, LaunchBatch) {
+  ThreadPool pool(3);
+  std::vector<std::atomic<int>> hits(1000);
+  for (auto& h : hits) h = 0;
+
+  std::vector<Delegate<void()>> tasks;
+  for (size_t i = 0; i < hits.size(); ++i)
+    tasks.emplace_back([&hits, i] { ++hits[i]; });
+
+  pool.LaunchBatch(tasks.begin(), tasks.end());
+  pool.Wait();
+
+  for (const auto& h : hits) EXPECT_EQ(1, h.load());
+}
+
+TEST_F(ThreadPoolTest, TasksCanLaunchTasks) {
+  ThreadPool pool(4, 16);
+  std::atomic<size_t> count{0};
+
+  for (size_t i = 0; i < 100; ++i) {
+    pool.Launch([&pool, &count] {
+      for (size_t j = 0; j < 100; ++j) pool.Launch([&count] { ++count; });
+    });
+  }
+
+  pool.Wait();
+
+  EXPECT_EQ(10000U, count.load());
+}
+
+TEST_F(ThreadPoolTest, ZeroThreadsRunsInline) {
+  ThreadPool pool(0);
+  int value = 0;
+
+  pool.Launch([&value] { value = 1; });
+  EXPECT_EQ(1, value);
+
+  EXPECT_EQ(2, pool.Launch([] { return 2; }).get());
+
+  pool.Wait();
+}
+
+TEST_F(ThreadPoolTest, ParallelForCoversRange) {
+  ThreadPool pool(4);
+  std::vector<int> hits(10007, 0);
+
+  pool.ParallelFor(3, hits.size(), 100, [&hits](size_t begin, size_t end) {
+    EXPECT_LE(end - begin, 100U);
+    for (auto i = begin; i != end; ++i) ++hits[i];
+  });
+
+  for (size_t i = 0; i < hits.size(); ++i) EXPECT_EQ(i >= 3 ? 1 : 0, hits[i]);
+
+  // Automatic grain size.
+  std::atomic<size_t> count{0};
+  pool.ParallelFor(0, 12345, 0, [&count](size_t begin, size_t end) {
+    count += end - begin;
+  });
+  EXPECT_EQ(12345U, count.load());
+}
+
+TEST_F(ThreadPoolTest, ParallelReduceIsOrdered) {
+  ThreadPool pool(4);
+
+  const auto result = pool.ParallelReduce(
+      0, 1000, 7, std::string(),
+      [](size_t begin, size_t end) {
+        std::string s;
+        for (auto i = begin; i != end; ++i) s.push_back('a' + i % 26);
+        return s;
+      },
+      [](std::string lhs, const std::string& rhs) { return lhs + rhs; });
+
+  ASSERT_EQ(1000U, result.size());
+  for (size_t i = 0; i < result.size(); ++i)
+    EXPECT_EQ(static_cast<char>('a' + i % 26), result[i]);
+
+  EXPECT_EQ(5, pool.ParallelReduce(0, 0, 1, 5, [](size_t, size_t) { return 1; },
+                                   std::plus<int>()));
+}
+
+TEST_F(ThreadPoolTest, ParallelForPropagatesFirstException) {
+  ThreadPool pool(4);
+  std::atomic<bool> started_10{false};
+
+  // Chunk 500 may still be running when chunk 10 fails, but it waits until
+  // chunk 10 has started, so that both fail whatever the scheduling.
+  try {
+    pool.ParallelFor(0, 1000, 1, [&started_10](size_t begin, size_t) {
+      if (begin == 10) {
+        started_10 = true;
+        throw std::runtime_error("10");
+      }
+      if (begin == 500) {
+        while (!started_10) std::this_thread::yield();
+        throw std::runtime_error("500");
+      }
+    });
+    FAIL();
+  } catch (std::runtime_error& e) {
+    EXPECT_EQ(std::string("10"), e.what());
+  }
+}
+
+TEST_F(ThreadPoolTest, ParallelForSkipsChunksAfterException) {
+  // Without worker threads, chunks run in order in the calling thread.
+  ThreadPool pool(0);
+  size_t calls = 0;
+
+  try {
+    pool.ParallelFor(0, 1000, 1, [&calls](size_t begin, size_t) {
+      ++calls;
+      if (begin == 10) throw std::runtime_error("10");
+    });
+    FAIL();
+  } catch (std::runtime_error& e) {
+    EXPECT_EQ(std::string("10"), e.what());
+  }
+
+  EXPECT_EQ(11U, calls);
+}
+
+TEST_F(ThreadPoolTest, ParallelForCancellation) {
+  ThreadPool pool(2);
+  std::atomic<bool> cancel{false};
+  std::atomic<size_t> calls{0};
+
+  // Every chunk waits for the cancellation, so each of the three threads
+  // taking part starts at most one chunk before it's seen.
+  pool.ParallelFor(0, 1000, 1,
+                   [&cancel, &calls](size_t begin, size_t) {
+                     ++calls;
+                     if (begin == 0) cancel = true;
+                     while (!cancel) std::this_thread::yield();
+                   },
+                   &cancel);
+
+  EXPECT_TRUE(cancel.load());
+  EXPECT_LE(calls.load(), 3U);
+}
+
+TEST_F(ThreadPoolTest, NestedParallelFor) {
+  ThreadPool pool(4);
+  std::atomic<size_t> count{0};
+
+  pool.ParallelFor(0, 64, 1, [&pool, &count](size_t, size_t) {
+    pool.ParallelFor(0, 64, 1, [&count](size_t begin, size_t end) {
+      count += end - begin;
+    });
+  });
+
+  EXPECT_EQ(64U * 64U, count.load());
+}
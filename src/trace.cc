@@ -0,0 +1,348 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <kj/debug.h>
+
+#include "src/util.h"
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+std::atomic<bool> trace_enabled{false};
+
+namespace {
+
+struct TraceEvent {
+  const char* category;
+  const char* name;
+  std::string detail;
+  int64_t start;
+  int64_t duration;
+  unsigned int thread_id;
+};
+
+// Each thread buffers at most this many events before writing them, so that
+// memory use stays bounded however long tracing runs.
+const size_t kMaxBufferedEvents = 1024;
+
+// Events recorded by one thread and not yet written.  Only contended while
+// the trace is stopped or switched to another file.
+struct ThreadEvents {
+  std::mutex mutex;
+  std::vector<TraceEvent> events;
+};
+
+// Guards the variables below.  Acquired before the mutex of any
+// ThreadEvents.
+std::mutex trace_mutex;
+
+// Never destroyed, since spans may end during static destruction.
+auto& thread_events = *new std::vector<ThreadEvents*>;
+auto& trace_path = *new std::string;
+
+// If not empty, the trace was started from CA_TABLE_TRACE, and this is its
+// value.  The file name is then suffixed by the process ID, so that forked
+// processes write their own file.
+auto& environment_path = *new std::string;
+
+int trace_fd = -1;
+
+// True until the first event is written to `trace_fd'.
+bool trace_empty = true;
+
+// Incremented whenever the output file changes, so that events taken from a
+// thread's buffer just before are not written to the next file.
+std::atomic<uint64_t> trace_generation{0};
+
+// The buffer of the calling thread, once created.
+thread_local ThreadEvents* current_thread_events;
+
+// Becomes true once the calling thread's buffer has been destroyed.
+thread_local bool thread_events_destroyed;
+
+unsigned int CurrentThreadID() {
+  static std::atomic<unsigned int> next_thread_id{1};
+  static thread_local unsigned int thread_id = next_thread_id++;
+  return thread_id;
+}
+
+void AppendMicroseconds(int64_t ns, std::string& output) {
+  output += StringPrintf("%lld.%03lld", static_cast<long long>(ns / 1000),
+                         static_cast<long long>(ns % 1000));
+}
+
+void CloseTraceLocked() {
+  if (trace_fd != -1) close(trace_fd);
+  trace_fd = -1;
+  trace_enabled = false;
+  trace_path.clear();
+  environment_path.clear();
+  ++trace_generation;
+}
+
+// Writes `data' to the trace file.  Tracing must never make the traced code
+// fail, so on errors, tracing is stopped instead.
+void WriteLocked(const std::string& data) {
+  for (size_t offset = 0; offset < data.size();) {
+    const auto ret =
+        write(trace_fd, data.data() + offset, data.size() - offset);
+    if (ret == -1) {
+      if (errno == EINTR) continue;
+      KJ_LOG(ERROR, "stopping trace", trace_path, strerror(errno));
+      CloseTraceLocked();
+      return;
+    }
+    offset += ret;
+  }
+}
+
+// Appends `events' to the trace file, in the JSON array format, which needs
+// no closing bracket, so that events can be added as they are recorded.
+void WriteEventsLocked(const std::vector<TraceEvent>& events) {
+  if (trace_fd == -1 || events.empty()) return;
+
+  const auto pid = static_cast<long>(getpid());
+
+  std::string output;
+
+  for (const auto& event : events) {
+    if (!trace_empty) output.push_back(',');
+    trace_empty = false;
+    output += "\n{\"name\":";
+    ToJSON(event.name, output);
+    output += ",\"cat\":";
+    ToJSON(event.category, output);
+    output += ",\"ph\":\"X\",\"ts\":";
+    AppendMicroseconds(event.start, output);
+    output += ",\"dur\":";
+    AppendMicroseconds(event.duration, output);
+    output += StringPrintf(",\"pid\":%ld,\"tid\":%u", pid, event.thread_id);
+    if (!event.detail.empty()) {
+      output += ",\"args\":{\"detail\":";
+      ToJSON(event.detail, output);
+      output.push_back('}');
+    }
+    output.push_back('}');
+  }
+
+  WriteLocked(output);
+}
+
+// Writes the events buffered by every thread.
+void FlushThreadEventsLocked() {
+  for (auto buffer : thread_events) {
+    std::vector<TraceEvent> events;
+    {
+      std::lock_guard<std::mutex> lock(buffer->mutex);
+      events.swap(buffer->events);
+    }
+    WriteEventsLocked(events);
+  }
+}
+
+// Opens `path' for the trace, after writing out and closing the current
+// trace file, if any.  If `append' is true, the events are added to those
+// already in the file.
+void OpenTraceLocked(const std::string& path, bool append) {
+  if (trace_enabled) FlushThreadEventsLocked();
+  CloseTraceLocked();
+
+  const auto fd =
+      open(path.c_str(),
+           O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC),
+           0666);
+  if (fd == -1) KJ_FAIL_SYSCALL("open", errno, path);
+
+  struct stat st;
+  if (-1 == fstat(fd, &st)) {
+    const auto error = errno;
+    close(fd);
+    KJ_FAIL_SYSCALL("fstat", error, path);
+  }
+
+  trace_fd = fd;
+  trace_path = path;
+  trace_empty = st.st_size <= 1;
+  if (!st.st_size) WriteLocked("[");
+
+  trace_enabled = trace_fd != -1;
+}
+
+// Returns the name of this process's trace file for CA_TABLE_TRACE=`base'.
+std::string EnvironmentTracePath(const std::string& base) {
+  return base + "." + std::to_string(getpid());
+}
+
+void LockBeforeFork() { trace_mutex.lock(); }
+
+void UnlockAfterFork() { trace_mutex.unlock(); }
+
+// The buffers of other threads don't exist in the child, and the events in
+// its own were recorded by the parent, which writes them itself.  A trace
+// from CA_TABLE_TRACE continues in a file of the child's own, and any other
+// trace is stopped, since the parent writes to its file.
+void ResetAfterFork() {
+  thread_events.clear();
+  if (current_thread_events) {
+    current_thread_events->events.clear();
+    thread_events.emplace_back(current_thread_events);
+  }
+
+  if (environment_path.empty()) {
+    CloseTraceLocked();
+  } else {
+    const auto base = environment_path;
+    try {
+      OpenTraceLocked(EnvironmentTracePath(base), false);
+      environment_path = base;
+    } catch (kj::Exception e) {
+      KJ_LOG(ERROR, e);
+    }
+  }
+
+  trace_mutex.unlock();
+}
+
+void RegisterHandlers() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    atexit([] { StopTrace(); });
+    pthread_atfork(LockBeforeFork, UnlockAfterFork, ResetAfterFork);
+  });
+}
+
+// Registers the buffer of the calling thread on creation, and writes out and
+// unregisters it when the thread exits.
+class ThreadEventsOwner {
+ public:
+  ThreadEventsOwner() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    thread_events.emplace_back(&events_);
+    current_thread_events = &events_;
+  }
+
+  ~ThreadEventsOwner() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    {
+      std::lock_guard<std::mutex> events_lock(events_.mutex);
+      WriteEventsLocked(events_.events);
+    }
+    thread_events.erase(
+        std::remove(thread_events.begin(), thread_events.end(), &events_),
+        thread_events.end());
+    current_thread_events = nullptr;
+    thread_events_destroyed = true;
+  }
+
+  KJ_DISALLOW_COPY(ThreadEventsOwner);
+
+  ThreadEvents* events() { return &events_; }
+
+ private:
+  ThreadEvents events_;
+};
+
+// Returns the buffer of the calling thread, or nullptr if the thread is
+// exiting and the buffer has already been destroyed.
+ThreadEvents* CurrentThreadEvents() {
+  if (thread_events_destroyed) return nullptr;
+  static thread_local ThreadEventsOwner owner;
+  return owner.events();
+}
+
+// Starts tracing before main() if CA_TABLE_TRACE is set.
+const bool trace_from_environment = [] {
+  const auto path = getenv("CA_TABLE_TRACE");
+  if (!path || !*path) return false;
+
+  RegisterHandlers();
+
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  OpenTraceLocked(EnvironmentTracePath(path), false);
+  environment_path = path;
+  return true;
+}();
+
+}  // namespace
+
+void StartTrace(const char* path) {
+  RegisterHandlers();
+
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  OpenTraceLocked(path, false);
+}
+
+void ResumeTrace(const char* path) {
+  RegisterHandlers();
+
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  OpenTraceLocked(path, true);
+}
+
+void StopTrace() {
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  if (!trace_enabled) return;
+  FlushThreadEventsLocked();
+  CloseTraceLocked();
+}
+
+std::string TracePath() {
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  return trace_enabled ? trace_path : std::string();
+}
+
+int64_t TraceSpan::TraceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void TraceSpan::End() {
+  const auto end = TraceNow();
+
+  TraceEvent event{category_, name_,        std::move(detail_),
+                   start_,    end - start_, CurrentThreadID()};
+
+  std::vector<TraceEvent> events;
+  auto generation = trace_generation.load();
+
+  if (const auto buffer = CurrentThreadEvents()) {
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    // Spans that straddle StopTrace() are dropped.
+    if (!trace_enabled) return;
+
+    buffer->events.emplace_back(std::move(event));
+    if (buffer->events.size() < kMaxBufferedEvents) return;
+
+    events.swap(buffer->events);
+    generation = trace_generation;
+  } else {
+    events.emplace_back(std::move(event));
+  }
+
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  if (trace_enabled && generation == trace_generation)
+    WriteEventsLocked(events);
+}
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
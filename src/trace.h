@@ -0,0 +1,102 @@
+#ifndef CA_TABLE_TRACE_H_
+#define CA_TABLE_TRACE_H_ 1
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <kj/common.h>
+
+// Trace spans are compiled in unless the library is configured with
+// `--disable-tracing'.  When compiled in, a span that is reached while
+// tracing is off costs one relaxed atomic load.
+//
+// Tracing is started either by setting the environment variable
+// CA_TABLE_TRACE to an output file name, or with the statement
+// `SET TRACE 'file';'.  With CA_TABLE_TRACE, the process ID is appended to
+// the file name, and processes forked while tracing write their own file.
+// Each thread buffers its events, and writes them when it has recorded a
+// batch, when it exits, and when the trace is stopped.  Events are written in
+// the JSON array format of the Chrome trace event format, which can be viewed
+// with chrome://tracing or https://ui.perfetto.dev/.
+
+namespace cantera {
+namespace table {
+namespace internal {
+
+extern std::atomic<bool> trace_enabled;
+
+// Starts recording trace events to `path', replacing its contents.  If
+// another trace is active, its remaining events are written to its file
+// first.  Tracing stops when the process exits.
+void StartTrace(const char* path);
+
+// Like StartTrace(), but adds the events to those already in `path', as
+// written by an earlier trace.
+void ResumeTrace(const char* path);
+
+// Stops recording trace events, and writes the remaining events.  Does
+// nothing if tracing is not active.
+void StopTrace();
+
+// Returns the path given to StartTrace(), or an empty string if tracing is
+// not active.
+std::string TracePath();
+
+// Records a complete event covering the lifetime of the object.  `category'
+// and `name' must have static storage duration, like string literals.
+// `detail' may be null, and is copied only when tracing is enabled.
+class TraceSpan {
+ public:
+  TraceSpan(const char* category, const char* name)
+      : category_(category), name_(name) {
+    if (trace_enabled.load(std::memory_order_relaxed)) start_ = TraceNow();
+  }
+
+  TraceSpan(const char* category, const char* name, const char* detail)
+      : category_(category), name_(name) {
+    if (trace_enabled.load(std::memory_order_relaxed)) {
+      if (detail) detail_ = detail;
+      start_ = TraceNow();
+    }
+  }
+
+  ~TraceSpan() {
+    if (start_ >= 0) End();
+  }
+
+  KJ_DISALLOW_COPY(TraceSpan);
+
+ private:
+  // Returns the current time in nanoseconds, relative to an arbitrary epoch.
+  static int64_t TraceNow();
+
+  void End();
+
+  const char* category_;
+  const char* name_;
+  std::string detail_;
+  int64_t start_ = -1;
+};
+
+}  // namespace internal
+}  // namespace table
+}  // namespace cantera
+
+#define CA_TRACE_CONCAT_(a, b) a##b
+#define CA_TRACE_CONCAT(a, b) CA_TRACE_CONCAT_(a, b)
+
+// Declares a span that ends at the end of the enclosing scope.  Takes a
+// category, a name and an optional detail string.  When tracing is compiled
+// out, the arguments are not evaluated.
+#if CA_TABLE_TRACING
+#define CA_TRACE_SPAN(...)                          \
+  ::cantera::table::internal::TraceSpan CA_TRACE_CONCAT( \
+      ca_trace_span_, __LINE__)(__VA_ARGS__)
+#else
+#define CA_TRACE_SPAN(...) \
+  do {                     \
+  } while (0)
+#endif
+
+#endif  // !CA_TABLE_TRACE_H_
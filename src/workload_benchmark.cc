@@ -0,0 +1,609 @@
+// Measures end-to-end query performance on a synthetic corpus.
+//
+// Usage: workload_benchmark [OPTION]... [QUERY-FILE]
+//
+// Generates a corpus of documents whose keywords follow a Zipf distribution,
+// builds summary and index tables from it with `ca-load', and replays a query
+// log against a `ca-shell --listen' server using `shell_server_benchmark'.
+// Each document is also indexed under a "date:YYYY-MM" key with the document
+// date as its score, so that the log can contain date range filters.  A
+// time-series table with the daily document count of each keyword is built
+// too, but only its load time is measured, since `ca-shell' has no statement
+// that reads time-series tables.
+//
+// If QUERY-FILE is not given, a query log is generated from the corpus
+// vocabulary.  Statements are grouped by their first word (QUERY, SELECT, and
+// so on), and each group is replayed against a freshly started server, so that
+// the server's peak RSS can be attributed to one statement type.  All random
+// choices derive from --seed, so runs with the same options use identical
+// data and queries.
+//
+// Run from the build directory, or point --ca-load, --ca-shell and
+// --shell-server-benchmark at the programs to use.  Prints a JSON object.
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+namespace {
+
+enum Option {
+  kCaLoadOption = 1,
+  kCaShellOption,
+  kClientsOption,
+  kDocumentsOption,
+  kDurationOption,
+  kKeepOption,
+  kKeywordsOption,
+  kKeywordsPerDocumentOption,
+  kSeedOption,
+  kShellServerBenchmarkOption,
+  kWorkDirOption,
+  kZipfOption,
+};
+
+int print_help;
+
+struct option kLongOptions[] = {
+    {"ca-load", required_argument, nullptr, kCaLoadOption},
+    {"ca-shell", required_argument, nullptr, kCaShellOption},
+    {"clients", required_argument, nullptr, kClientsOption},
+    {"documents", required_argument, nullptr, kDocumentsOption},
+    {"duration", required_argument, nullptr, kDurationOption},
+    {"keep", no_argument, nullptr, kKeepOption},
+    {"keywords", required_argument, nullptr, kKeywordsOption},
+    {"keywords-per-document", required_argument, nullptr,
+     kKeywordsPerDocumentOption},
+    {"seed", required_argument, nullptr, kSeedOption},
+    {"shell-server-benchmark", required_argument, nullptr,
+     kShellServerBenchmarkOption},
+    {"work-dir", required_argument, nullptr, kWorkDirOption},
+    {"zipf", required_argument, nullptr, kZipfOption},
+    {"help", no_argument, &print_help, 1},
+    {nullptr, 0, nullptr, 0}};
+
+// Document dates are spread over 2015-01-01 to 2019-12-31, in days since the
+// Unix epoch.
+const uint64_t kFirstDay = 16436;
+const uint64_t kLastDay = 18261;
+
+// Number of statements generated per statement kind when no query log is
+// given.
+const size_t kGeneratedStatements = 1000;
+
+const char* ca_load_path = "./ca-load";
+const char* ca_shell_path = "./ca-shell";
+const char* shell_server_benchmark_path = "src/shell_server_benchmark";
+
+size_t client_count = 4;
+size_t document_count = 100000;
+std::string duration = "10";
+bool keep_work_dir = false;
+size_t keyword_count = 20000;
+size_t keywords_per_document = 16;
+uint64_t seed = 1;
+double zipf_exponent = 1.1;
+
+double Now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// A xorshift64* generator.  Used instead of <random> distributions, whose
+// output differs between standard library implementations.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+
+  uint64_t Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545f4914f6cdd1dULL;
+  }
+
+  // Returns a number in [0, 1).
+  double Uniform() { return (Next() >> 11) / 9007199254740992.0; }
+
+  // Returns a number in [0, n).
+  uint64_t Below(uint64_t n) { return static_cast<uint64_t>(Uniform() * n); }
+
+ private:
+  uint64_t state_;
+};
+
+// Samples keyword ranks, where rank r has probability proportional to
+// 1 / (r + 1)^s.
+class ZipfSampler {
+ public:
+  ZipfSampler(size_t n, double s) : cdf_(n) {
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i) cdf_[i] = (sum += std::pow(i + 1, -s));
+    for (auto& v : cdf_) v /= sum;
+  }
+
+  size_t operator()(Random& rng) const {
+    const auto i = std::upper_bound(cdf_.begin(), cdf_.end(), rng.Uniform());
+    return std::min(static_cast<size_t>(i - cdf_.begin()), cdf_.size() - 1);
+  }
+
+ private:
+  std::vector<double> cdf_;
+};
+
+std::string DocumentName(size_t n) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "doc-%08zu", n);
+  return buffer;
+}
+
+std::string Keyword(size_t rank) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "keyword:w%06zu", rank);
+  return buffer;
+}
+
+// Formats a day number as YYYY-MM-DD, or YYYY-MM if `month_only' is set.
+std::string DayToString(uint64_t day, bool month_only = false) {
+  const time_t t = day * 86400;
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  char buffer[16];
+  strftime(buffer, sizeof(buffer), month_only ? "%Y-%m" : "%Y-%m-%d", &tm);
+  return buffer;
+}
+
+void WriteLines(const std::string& path,
+                const std::vector<std::string>& lines) {
+  auto file = fopen(path.c_str(), "w");
+  if (!file) err(EXIT_FAILURE, "%s", path.c_str());
+  for (const auto& line : lines) fwrite(line.data(), 1, line.size(), file);
+  if (fclose(file)) err(EXIT_FAILURE, "%s", path.c_str());
+}
+
+// Writes the ca-load input files for the summary, index and time-series
+// tables.  Lines are sorted, as `ca-load' expects.
+void GenerateCorpus(const std::string& dir) {
+  Random rng(seed);
+  ZipfSampler keyword_sampler(keyword_count, zipf_exponent);
+
+  std::vector<std::string> summaries, postings;
+  std::vector<size_t> keywords;
+
+  // The number of documents with each keyword rank and day.
+  std::map<std::pair<size_t, uint64_t>, size_t> daily_counts;
+
+  for (size_t i = 0; i < document_count; ++i) {
+    const auto name = DocumentName(i);
+    const auto day = kFirstDay + rng.Below(kLastDay - kFirstDay + 1);
+    // Document popularity is long-tailed too.
+    const auto popularity = std::floor(1000.0 * std::pow(rng.Uniform(), 4.0));
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "%s\t{\"title\":\"Document %zu\",\"date\":\"%s\","
+             "\"popularity\":%.0f}\n",
+             name.c_str(), i, DayToString(day).c_str(), popularity);
+    summaries.emplace_back(buffer);
+
+    keywords.clear();
+    for (size_t j = 0; j < keywords_per_document; ++j)
+      keywords.emplace_back(keyword_sampler(rng));
+    std::sort(keywords.begin(), keywords.end());
+    keywords.erase(std::unique(keywords.begin(), keywords.end()),
+                   keywords.end());
+
+    for (const auto rank : keywords) {
+      snprintf(buffer, sizeof(buffer), "%s\t%s\t%.3f\n", Keyword(rank).c_str(),
+               name.c_str(), rng.Uniform());
+      postings.emplace_back(buffer);
+
+      ++daily_counts[std::make_pair(rank, day)];
+    }
+
+    snprintf(buffer, sizeof(buffer), "date:%s\t%s\t%llu\n",
+             DayToString(day, true).c_str(), name.c_str(),
+             static_cast<unsigned long long>(day));
+    postings.emplace_back(buffer);
+  }
+
+  std::sort(postings.begin(), postings.end());
+
+  std::vector<std::string> time_series;
+  for (const auto& count : daily_counts) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s\t%s\t%zu\n",
+             Keyword(count.first.first).c_str(),
+             DayToString(count.first.second).c_str(), count.second);
+    time_series.emplace_back(buffer);
+  }
+
+  std::sort(time_series.begin(), time_series.end());
+
+  WriteLines(dir + "/summaries.txt", summaries);
+  WriteLines(dir + "/postings.txt", postings);
+  WriteLines(dir + "/time-series.txt", time_series);
+}
+
+// Returns a query log with single keyword lookups, conjunctions, date range
+// filters and SELECT statements.  Keywords are drawn from the same Zipf
+// distribution as the corpus, so popular keywords are queried more often.
+std::vector<std::string> GenerateQueries() {
+  Random rng(seed + 1);
+  ZipfSampler keyword_sampler(keyword_count, zipf_exponent);
+
+  std::vector<std::string> result;
+
+  for (size_t i = 0; i < kGeneratedStatements; ++i) {
+    const auto a_rank = keyword_sampler(rng);
+    auto b_rank = keyword_sampler(rng);
+    if (b_rank == a_rank) b_rank = (a_rank + 1) % keyword_count;
+
+    const auto a = Keyword(a_rank);
+    const auto b = Keyword(b_rank);
+    const auto day = kFirstDay + rng.Below(kLastDay - kFirstDay - 30);
+
+    result.emplace_back("QUERY (\"" + a + "\") LIMIT 10;\n");
+    result.emplace_back("QUERY (\"" + a + "\" AND \"" + b + "\") LIMIT 10;\n");
+    result.emplace_back("QUERY (\"" + a + "\" AND \"date:" +
+                        DayToString(day, true) + "\" >= " + DayToString(day) +
+                        ") LIMIT 10;\n");
+    result.emplace_back("SELECT \"date:" + DayToString(day, true) +
+                        "\" FROM (\"" + a + "\");\n");
+  }
+
+  return result;
+}
+
+std::vector<std::string> ReadQueries(const char* path) {
+  auto input = fopen(path, "r");
+  if (!input) err(EXIT_FAILURE, "%s", path);
+
+  std::vector<std::string> result;
+
+  char* line = nullptr;
+  size_t line_size = 0;
+  ssize_t line_length;
+  while (-1 != (line_length = getline(&line, &line_size, input))) {
+    if (line_length <= 1) continue;
+    result.emplace_back(line, line_length);
+    if (result.back().back() != '\n') result.back().push_back('\n');
+  }
+  free(line);
+  fclose(input);
+
+  return result;
+}
+
+// Returns the upper case first word of a statement.
+std::string StatementType(const std::string& statement) {
+  std::string result;
+  for (auto ch : statement) {
+    if (std::isalpha(static_cast<unsigned char>(ch)))
+      result.push_back(std::toupper(static_cast<unsigned char>(ch)));
+    else if (!result.empty() || !std::isspace(static_cast<unsigned char>(ch)))
+      break;
+  }
+  return result.empty() ? "OTHER" : result;
+}
+
+// Starts a program, with standard input and output redirected to the given
+// files unless they are null.
+pid_t Spawn(const std::vector<std::string>& args, const char* input_path,
+            const char* output_path) {
+  std::vector<char*> argv;
+  for (const auto& arg : args)
+    argv.emplace_back(const_cast<char*>(arg.c_str()));
+  argv.emplace_back(nullptr);
+
+  const auto pid = fork();
+  if (pid == -1) err(EXIT_FAILURE, "fork");
+
+  if (!pid) {
+    if (input_path) {
+      const auto fd = open(input_path, O_RDONLY);
+      if (fd == -1 || -1 == dup2(fd, STDIN_FILENO)) _exit(127);
+    }
+    if (output_path) {
+      const auto fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (fd == -1 || -1 == dup2(fd, STDOUT_FILENO)) _exit(127);
+    }
+    execv(argv[0], argv.data());
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+
+  return pid;
+}
+
+// Waits for a process, and returns its peak RSS in kilobytes, including that
+// of any children it waited for.
+long Wait(pid_t pid, const std::string& name, bool allow_signal = false) {
+  int status;
+  struct rusage usage;
+  while (-1 == wait4(pid, &status, 0, &usage)) {
+    if (errno != EINTR) err(EXIT_FAILURE, "wait4");
+  }
+
+  if (WIFSIGNALED(status) && !allow_signal)
+    errx(EXIT_FAILURE, "%s killed by signal %d", name.c_str(),
+         WTERMSIG(status));
+  if (WIFEXITED(status) && WEXITSTATUS(status))
+    errx(EXIT_FAILURE, "%s exited with status %d", name.c_str(),
+         WEXITSTATUS(status));
+
+  return usage.ru_maxrss;
+}
+
+void Run(const std::vector<std::string>& args, const char* input_path,
+         const char* output_path = nullptr) {
+  Wait(Spawn(args, input_path, output_path), args[0]);
+}
+
+void WaitForSocket(const std::string& path, pid_t server) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    errx(EX_USAGE, "Socket path too long: %s", path.c_str());
+  strcpy(addr.sun_path, path.c_str());
+
+  const auto deadline = Now() + 60.0;
+
+  for (;;) {
+    const auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) err(EXIT_FAILURE, "socket");
+    const auto ret =
+        connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    close(fd);
+    if (!ret) return;
+
+    if (0 != waitpid(server, nullptr, WNOHANG))
+      errx(EXIT_FAILURE, "%s exited during startup", ca_shell_path);
+    if (Now() > deadline) errx(EXIT_FAILURE, "Timed out waiting for server");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
+
+std::string ReadFile(const std::string& path) {
+  std::string result;
+  auto file = fopen(path.c_str(), "r");
+  if (!file) err(EXIT_FAILURE, "%s", path.c_str());
+  char buffer[4096];
+  size_t size;
+  while (0 < (size = fread(buffer, 1, sizeof(buffer), file)))
+    result.append(buffer, size);
+  fclose(file);
+  while (!result.empty() &&
+         std::isspace(static_cast<unsigned char>(result.back())))
+    result.pop_back();
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string work_dir;
+  int i;
+
+  while (-1 != (i = getopt_long(argc, argv, "", kLongOptions, 0))) {
+    if (!i) continue;
+
+    switch (i) {
+      case kCaLoadOption:
+        ca_load_path = optarg;
+        break;
+
+      case kCaShellOption:
+        ca_shell_path = optarg;
+        break;
+
+      case kClientsOption:
+        client_count = strtoul(optarg, nullptr, 0);
+        if (!client_count) errx(EX_USAGE, "Invalid client count: %s", optarg);
+        break;
+
+      case kDocumentsOption:
+        document_count = strtoul(optarg, nullptr, 0);
+        if (!document_count)
+          errx(EX_USAGE, "Invalid document count: %s", optarg);
+        break;
+
+      case kDurationOption:
+        if (!(strtod(optarg, nullptr) > 0.0))
+          errx(EX_USAGE, "Invalid duration: %s", optarg);
+        duration = optarg;
+        break;
+
+      case kKeepOption:
+        keep_work_dir = true;
+        break;
+
+      case kKeywordsOption:
+        keyword_count = strtoul(optarg, nullptr, 0);
+        if (!keyword_count) errx(EX_USAGE, "Invalid keyword count: %s", optarg);
+        break;
+
+      case kKeywordsPerDocumentOption:
+        keywords_per_document = strtoul(optarg, nullptr, 0);
+        break;
+
+      case kSeedOption:
+        seed = strtoull(optarg, nullptr, 0);
+        break;
+
+      case kShellServerBenchmarkOption:
+        shell_server_benchmark_path = optarg;
+        break;
+
+      case kWorkDirOption:
+        work_dir = optarg;
+        break;
+
+      case kZipfOption:
+        zipf_exponent = strtod(optarg, nullptr);
+        if (!(zipf_exponent > 0.0))
+          errx(EX_USAGE, "Invalid Zipf exponent: %s", optarg);
+        break;
+
+      case '?':
+        errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
+    }
+  }
+
+  if (print_help) {
+    printf(
+        "Usage: %s [OPTION]... [QUERY-FILE]\n"
+        "\n"
+        "      --ca-load=PATH         ca-load program [./ca-load]\n"
+        "      --ca-shell=PATH        ca-shell program [./ca-shell]\n"
+        "      --clients=N            concurrent connections and server\n"
+        "                             workers [4]\n"
+        "      --documents=N          number of documents [100000]\n"
+        "      --duration=SECONDS     replay time per statement type [10]\n"
+        "      --keep                 keep the work directory\n"
+        "      --keywords=N           vocabulary size [20000]\n"
+        "      --keywords-per-document=N\n"
+        "                             keyword draws per document [16]\n"
+        "      --seed=N               random seed [1]\n"
+        "      --shell-server-benchmark=PATH\n"
+        "                             replay program\n"
+        "                             [src/shell_server_benchmark]\n"
+        "      --work-dir=DIR         where to put tables [$TMPDIR]\n"
+        "      --zipf=S               Zipf exponent of keyword frequencies "
+        "[1.1]\n"
+        "      --help     display this help and exit\n"
+        "\n"
+        "QUERY-FILE contains one request per line.  If it is not given,\n"
+        "queries are generated from the corpus vocabulary.\n",
+        argv[0]);
+
+    return EXIT_SUCCESS;
+  }
+
+  if (optind + 1 < argc)
+    errx(EX_USAGE, "Usage: %s [OPTION]... [QUERY-FILE]", argv[0]);
+
+  const bool own_work_dir = work_dir.empty();
+  if (own_work_dir) {
+    const char* tmpdir = getenv("TMPDIR");
+    work_dir = std::string(tmpdir ? tmpdir : "/tmp") +
+               "/workload_benchmark.XXXXXX";
+    if (!mkdtemp(&work_dir[0])) err(EXIT_FAILURE, "mkdtemp");
+  } else if (-1 == mkdir(work_dir.c_str(), 0777) && errno != EEXIST) {
+    err(EXIT_FAILURE, "%s", work_dir.c_str());
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  // Build the tables.
+
+  auto start = Now();
+  GenerateCorpus(work_dir);
+  const auto generate_time = Now() - start;
+
+  const auto schema_path = work_dir + "/schema";
+  WriteLines(schema_path, {"summary\t" + work_dir + "/summary\t0\n",
+                           "index\t" + work_dir + "/index\n"});
+
+  start = Now();
+  Run({ca_load_path, "--output-type=summaries", work_dir + "/summary"},
+      (work_dir + "/summaries.txt").c_str());
+  const auto summary_time = Now() - start;
+
+  start = Now();
+  Run({ca_load_path, "--output-type=index", "--schema=" + schema_path,
+       work_dir + "/index"},
+      (work_dir + "/postings.txt").c_str());
+  const auto index_time = Now() - start;
+
+  start = Now();
+  Run({ca_load_path, "--output-type=time-series", "--date-format=%Y-%m-%d",
+       work_dir + "/time-series"},
+      (work_dir + "/time-series.txt").c_str());
+  const auto time_series_time = Now() - start;
+
+  // Replay the queries, one statement type at a time.
+
+  const auto queries =
+      (optind < argc) ? ReadQueries(argv[optind]) : GenerateQueries();
+  if (queries.empty()) errx(EXIT_FAILURE, "No queries");
+
+  std::map<std::string, std::vector<std::string>> queries_by_type;
+  for (const auto& query : queries)
+    queries_by_type[StatementType(query)].emplace_back(query);
+
+  const auto socket_path = work_dir + "/socket";
+  const auto result_path = work_dir + "/result.json";
+
+  printf(
+      "{\"documents\":%zu,\"keywords\":%zu,\"keywords-per-document\":%zu,"
+      "\"zipf\":%g,\"seed\":%llu,\"clients\":%zu,\"generate-seconds\":%.3f,"
+      "\"load-summaries-seconds\":%.3f,\"load-index-seconds\":%.3f,"
+      "\"load-time-series-seconds\":%.3f,\"statements\":{",
+      document_count, keyword_count, keywords_per_document, zipf_exponent,
+      static_cast<unsigned long long>(seed), client_count, generate_time,
+      summary_time, index_time, time_series_time);
+
+  bool first = true;
+  for (const auto& type : queries_by_type) {
+    const auto query_path = work_dir + "/queries." + type.first;
+    WriteLines(query_path, type.second);
+
+    const auto server = Spawn(
+        {ca_shell_path, "--listen=" + socket_path,
+         "--workers=" + std::to_string(client_count), schema_path},
+        nullptr, "/dev/null");
+    WaitForSocket(socket_path, server);
+
+    Run({shell_server_benchmark_path,
+         "--clients=" + std::to_string(client_count), "--duration=" + duration,
+         socket_path, query_path},
+        nullptr, result_path.c_str());
+
+    kill(server, SIGTERM);
+    const auto max_rss = Wait(server, ca_shell_path, true);
+
+    printf("%s\"%s\":{\"max-rss-kb\":%ld,\"replay\":%s}", first ? "" : ",",
+           type.first.c_str(), max_rss, ReadFile(result_path).c_str());
+    fflush(stdout);
+    first = false;
+  }
+
+  printf("}}\n");
+
+  if (own_work_dir && !keep_work_dir) {
+    for (const auto& name :
+         {"summaries.txt", "postings.txt", "time-series.txt", "schema",
+          "summary", "index", "time-series", "result.json"})
+      unlink((work_dir + "/" + name).c_str());
+    for (const auto& type : queries_by_type)
+      unlink((work_dir + "/queries." + type.first).c_str());
+    rmdir(work_dir.c_str());
+  }
+}